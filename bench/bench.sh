@@ -0,0 +1,91 @@
+#!/bin/bash
+#
+# End-to-end benchmark of irccmd against a local mock irc server.
+#
+# Every scenario starts mockircd, pipes the lines of linegen through irccmd and
+# prints the report of mockircd together with the cpu time irccmd used.
+#
+# Usage: bench.sh [irccmd] ; the environment variables below tune the runs.
+
+IRCCMD=${1:-../src/irccmd}
+BENCHDIR=$(cd "$(dirname "$0")" && pwd)
+MOCKIRCD=${MOCKIRCD:-./mockircd}
+LINEGEN=${LINEGEN:-./linegen}
+PLUGINDIR=${PLUGINDIR:-$BENCHDIR/../plugins}
+
+PORT=${BENCH_PORT:-6699}
+LINES=${BENCH_LINES:-20000}         # lines for the throughput runs
+RATE=${BENCH_RATE:-200}             # lines per second for the latency run
+RATE_LINES=${BENCH_RATE_LINES:-2000}
+SIZE=${BENCH_SIZE:-100}             # bytes per line
+DROP_EVERY=${BENCH_DROP_EVERY:-500} # messages between connection drops in the reconnect run
+
+WORKDIR=$(mktemp -d /tmp/irccmd-bench.XXXXXX)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+if [ ! -x "$IRCCMD" ] || [ ! -x "$MOCKIRCD" ] || [ ! -x "$LINEGEN" ]
+then
+    echo "bench: build irccmd, mockircd and linegen first (make bench)" >&2
+    exit 1
+fi
+
+# write_config <file> <plugins: true|false>
+write_config()
+{
+    cat > "$1" <<EOF
+settings = {
+    silent = true,
+    interactive = false,
+    name = "bench",
+    server = "127.0.0.1",
+    port = $PORT,
+    oflood = 0,
+    timeout = 2,
+    queue_size = 100000,
+    channels = { { name = "#bench" } },
+    plugins = $2,
+    plugin_path = { "$PLUGINDIR" },
+    plugin = { "crc" },
+}
+EOF
+}
+
+# run <name> <plugins> <expected messages> <mockircd options> -- <linegen options>
+run()
+{
+    local name=$1 plugins=$2 expect=$3
+    shift 3
+    local mockopts=() genopts=()
+
+    while [ $# -gt 0 ] && [ "$1" != "--" ]; do mockopts+=("$1"); shift; done
+    shift
+    genopts=("$@")
+
+    write_config "$WORKDIR/$name.cnf" "$plugins"
+    "$MOCKIRCD" -p "$PORT" -n "$expect" -i 10 -o "$WORKDIR/$name.report" "${mockopts[@]}" &
+    local mockpid=$!
+    sleep 0.2
+
+    # Only irccmd is timed; linegen writes into the pipe
+    local TIMEFORMAT="%U %S"
+    local cpu
+    cpu=$( { time "$IRCCMD" -c "$WORKDIR/$name.cnf" --noninteractive --mode in \
+                < <("$LINEGEN" "${genopts[@]}") > "$WORKDIR/$name.out" 2>&1 ; } 2>&1 )
+    wait "$mockpid"
+
+    local user=${cpu% *} sys=${cpu#* }
+    local messages
+    messages=$(awk '$1 == "messages" { print $2 }' "$WORKDIR/$name.report")
+
+    echo "== $name"
+    cat "$WORKDIR/$name.report"
+    awk -v u="$user" -v s="$sys" -v m="$messages" 'BEGIN {
+        printf "cpu_user_s %.3f\ncpu_sys_s %.3f\ncpu_us_per_message %.2f\n", u, s, (m > 0) ? (u + s) * 1000000 / m : 0 }'
+}
+
+run throughput       false "$LINES"      -- -n "$LINES" -s "$SIZE" -w 1
+run throughput_crc   true  "$LINES"      -- -n "$LINES" -s "$SIZE" -w 1
+run latency          false "$RATE_LINES" -- -n "$RATE_LINES" -r "$RATE" -s "$SIZE" -w 1
+run latency_crc      true  "$RATE_LINES" -- -n "$RATE_LINES" -r "$RATE" -s "$SIZE" -w 1
+run latency_echo     false "$RATE_LINES" -e -- -n "$RATE_LINES" -r "$RATE" -s "$SIZE" -w 1
+run reconnect        false "$RATE_LINES" -k "$DROP_EVERY" -- -n "$RATE_LINES" -r "$RATE" -s "$SIZE" -w 1
@@ -0,0 +1,108 @@
+/*
+* Writes numbered, timestamped lines to stdout at a fixed rate, for benchmarking irccmd.
+*
+* Every line has the format "$<seq>,<usec>,<padding>*CRC*". The timestamp is taken from
+* the monotonic clock just before the line is written, so mockircd can compute the latency.
+* The "$...*CRC*" framing is what the crc plugin works on.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#define LINEGEN_MAX_SIZE    (8192)
+
+static uint64_t now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ( (uint64_t) ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+static void sleep_until(uint64_t due)
+{
+    uint64_t now = now_usec();
+    struct timespec ts;
+
+    if (due <= now) return;
+    ts.tv_sec = (due - now) / 1000000ULL;
+    ts.tv_nsec = ( (due - now) % 1000000ULL) * 1000;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+static int write_all(const char *buf, size_t len)
+{
+    size_t written = 0;
+
+    while (written < len)
+    {
+        ssize_t result = write(STDOUT_FILENO, &buf[written], len - written);
+        if (result < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        written += result;
+    }
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-n lines] [-r lines_per_second] [-s size] [-w seconds]\n", name);
+    fprintf(stderr, "  -n  number of lines (default 1000)\n");
+    fprintf(stderr, "  -r  lines per second; 0 writes as fast as possible (default 0)\n");
+    fprintf(stderr, "  -s  size of a line in bytes, without the newline (default 64)\n");
+    fprintf(stderr, "  -w  seconds to wait before the first line, e.g. for the connection setup\n");
+}
+
+int main(int argc, char **argv)
+{
+    char line[LINEGEN_MAX_SIZE +2];
+    unsigned long long lines = 1000;
+    unsigned long long counter = 0;
+    double rate = 0.0;
+    int size = 64;
+    int wait = 0;
+    int opt = 0;
+    uint64_t start = 0;
+
+    while ( (opt = getopt(argc, argv, "n:r:s:w:h") ) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': lines = strtoull(optarg, NULL, 10); break;
+            case 'r': rate = atof(optarg); break;
+            case 's': size = atoi(optarg); break;
+            case 'w': wait = atoi(optarg); break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+
+    if (size < 40) size = 40;
+    if (size > LINEGEN_MAX_SIZE) size = LINEGEN_MAX_SIZE;
+    if (wait > 0) sleep(wait);
+
+    start = now_usec();
+    for (counter = 0; counter < lines; counter++)
+    {
+        int len = 0;
+
+        if (rate > 0.0) sleep_until(start + (uint64_t) (counter * 1000000.0 / rate) );
+
+        len = snprintf(line, sizeof(line), "$%llu,%llu,", counter, (unsigned long long) now_usec() );
+        memset(&line[len], 'x', size - len -5);
+        memcpy(&line[size -5], "*CRC*\n", 6);
+
+        if (write_all(line, size +1) != 0)
+        {
+            perror("linegen: write");
+            return 1;
+        }
+    }
+
+    return 0;
+}
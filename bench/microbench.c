@@ -0,0 +1,228 @@
+/*
+* Microbenchmarks of the functions every line passes through.
+*
+* Each benchmark runs a function in a tight loop and reports the time per call.
+* The results are written as JSON to stdout, so runs of different versions can be compared.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "def.h"
+#include "main.h"
+#include "config.h"
+#include "line.h"
+#include "output.h"
+
+#define MICROBENCH_LINE "$1234,5678901234,sensor-17,21.5,1013.2,0.42,ok*CRC*"
+
+struct config_options options;
+
+struct benchmark
+{
+    const char *name;
+    void (*setup)();
+    void (*run)();
+    unsigned long iterations;
+};
+
+static char line[9000];
+static int line_fd = -1;
+static FILE *devnull = NULL;
+static const char *plugindir = "../plugins";
+
+static uint64_t now_nsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ( (uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void setup_sgets()
+{
+    char path[] = "/tmp/irccmd-microbench.XXXXXX";
+    int counter = 0;
+
+    if ( (line_fd = mkstemp(path) ) < 0)
+    {
+        perror("microbench: mkstemp");
+        exit(1);
+    }
+    (void) unlink(path);
+
+    for (counter = 0; counter < 1000; counter++)
+    {
+        if (write(line_fd, MICROBENCH_LINE "\n", sizeof(MICROBENCH_LINE) ) != sizeof(MICROBENCH_LINE) )
+        {
+            perror("microbench: write");
+            exit(1);
+        }
+    }
+    (void) lseek(line_fd, 0, SEEK_SET);
+}
+
+static void run_sgets()
+{
+    if (sgets(line_fd, line, sizeof(line) ) == 0)
+    {
+        (void) lseek(line_fd, 0, SEEK_SET);
+        (void) sgets(line_fd, line, sizeof(line) );
+    }
+}
+
+static void run_tokenize()
+{
+    struct line_tokens tokens;
+
+    strcpy(line, "   " MICROBENCH_LINE "   ");
+    tokenize_line(line, strlen(line), &tokens);
+}
+
+static void setup_channels()
+{
+    int counter = 0;
+
+    options.no_channels = MAX_CHANNELS;
+    for (counter = 0; counter < MAX_CHANNELS; counter++)
+    {
+        (void) snprintf(options.channels[counter], MAX_CHANNELS_NAMELEN, "#channel%02d", counter);
+    }
+}
+
+static void run_get_channel()
+{
+    (void) get_channel("#channel19", strlen("#channel19"), 0);
+}
+
+static void run_send_parse()
+{
+    struct line_tokens tokens;
+
+    strcpy(line, "#channel19 " MICROBENCH_LINE);
+    tokenize_line(line, strlen(line), &tokens);
+    if (tokens.body.start != NULL && tokens.target.len > 0) (void) get_channel(tokens.target.start, tokens.target.len, 0);
+}
+
+static void setup_plugins()
+{
+    options.enableplugins = true;
+    options.no_pluginpaths = 1;
+    options.no_plugins = 1;
+    strncpy(options.pluginpaths[0], plugindir, MAX_PATH_LEN -1);
+    strncpy(options.plugins[0], "crc", MAX_CHANNELS_NAMELEN -1);
+}
+
+static void run_plugins()
+{
+    strcpy(line, MICROBENCH_LINE);
+    (void) execute_str_plugins(line);
+}
+
+static void setup_output()
+{
+    setup_channels();
+    options.showchannel = true;
+    options.shownick = true;
+    if (devnull == NULL && (devnull = fopen("/dev/null", "w") ) == NULL)
+    {
+        perror("microbench: /dev/null");
+        exit(1);
+    }
+}
+
+static void run_output()
+{
+    print_channel_message(devnull, "sensorbot", "#channel03", MICROBENCH_LINE);
+}
+
+static void setup_output_plain()
+{
+    setup_output();
+    options.showchannel = false;
+    options.shownick = false;
+}
+
+static struct benchmark benchmarks[] =
+{
+    { "sgets"                , setup_sgets        , run_sgets       , 20000   },
+    { "tokenize_line"        , NULL               , run_tokenize    , 1000000 },
+    { "get_channel"          , setup_channels     , run_get_channel , 1000000 },
+    { "send_irc_message_parse", setup_channels    , run_send_parse  , 1000000 },
+    { "execute_str_plugins_crc", setup_plugins    , run_plugins     , 2000    },
+    { "channel_message_format", setup_output      , run_output      , 1000000 },
+    { "channel_message_plain", setup_output_plain , run_output      , 1000000 },
+    { NULL                   , NULL               , NULL            , 0       },
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-p plugindir] [-s scale] [benchmark...]\n", name);
+    fprintf(stderr, "  -p  directory with crc.lua (default %s)\n", plugindir);
+    fprintf(stderr, "  -s  multiplies the number of iterations (default 1)\n");
+}
+
+static bool selected(const char *name, int argc, char **argv)
+{
+    int counter = 0;
+
+    if (optind >= argc) return true;
+    for (counter = optind; counter < argc; counter++)
+    {
+        if (strcmp(argv[counter], name) == 0) return true;
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    struct benchmark *benchmark = NULL;
+    double scale = 1.0;
+    bool first = true;
+    int opt = 0;
+
+    while ( (opt = getopt(argc, argv, "p:s:h") ) != -1)
+    {
+        switch (opt)
+        {
+            case 'p': plugindir = optarg; break;
+            case 's': scale = atof(optarg); break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+
+    options.running = true;
+    options.silent = true;
+
+    printf("{\n  \"package\": \"%s\",\n  \"version\": \"%s\",\n  \"benchmarks\": [", PACKAGE, VERSION);
+    for (benchmark = benchmarks; benchmark->name != NULL; benchmark++)
+    {
+        unsigned long iterations = (unsigned long) (benchmark->iterations * scale);
+        unsigned long counter = 0;
+        uint64_t start = 0;
+        uint64_t elapsed = 0;
+
+        if (selected(benchmark->name, argc, argv) == false) continue;
+        if (iterations == 0) iterations = 1;
+        if (benchmark->setup != NULL) benchmark->setup();
+
+        /* Warm up the caches before timing */
+        for (counter = 0; counter < iterations / 10; counter++) benchmark->run();
+
+        start = now_nsec();
+        for (counter = 0; counter < iterations; counter++) benchmark->run();
+        elapsed = now_nsec() - start;
+
+        printf("%s\n    { \"name\": \"%s\", \"iterations\": %lu, \"total_ns\": %llu, \"ns_per_op\": %.1f }",
+                (first) ? "" : ",", benchmark->name, iterations, (unsigned long long) elapsed, (double) elapsed / iterations);
+        first = false;
+        (void) fflush(stdout);
+    }
+    printf("\n  ]\n}\n");
+
+    if (line_fd >= 0) close(line_fd);
+    if (devnull != NULL) fclose(devnull);
+    return 0;
+}
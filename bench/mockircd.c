@@ -0,0 +1,427 @@
+/*
+* A minimal irc server for benchmarking irccmd.
+*
+* It registers clients, answers PING, JOIN and CAP, and timestamps every PRIVMSG.
+* Messages in the format of linegen ("$<seq>,<usec>,...") are used to measure the
+* latency between the line being written to the stdin of irccmd and its arrival here.
+* When it exits it writes a report of "key value" lines.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MOCK_MAX_CLIENTS    (8)
+#define MOCK_BUFSIZE        (9000)
+#define MOCK_NAME           "mock.irc"
+
+struct mock_client
+{
+    int fd;
+    char buf[MOCK_BUFSIZE];
+    size_t len;
+    char nick[32];
+    bool user;
+    bool registered;
+    bool echo;
+};
+
+static struct
+{
+    int port;
+    uint64_t expect;        /* Exit after this many messages; 0 runs until signalled */
+    uint64_t drop_every;    /* Drop the connection after every N messages; 0 never drops */
+    bool offer_echo;        /* Offer the echo-message capability */
+    int idle_timeout;       /* Exit after this many seconds without messages */
+    const char *report;
+} settings =
+{
+    .port         = 6699,
+    .expect       = 0,
+    .drop_every   = 0,
+    .offer_echo   = false,
+    .idle_timeout = 30,
+    .report       = NULL,
+};
+
+static struct mock_client clients[MOCK_MAX_CLIENTS];
+static volatile bool running = true;
+
+static uint64_t *latencies = NULL;
+static uint64_t no_latencies = 0;
+static uint64_t max_latencies = 0;
+static uint64_t no_messages = 0;
+static uint64_t no_bytes = 0;
+static uint64_t first_message = 0;
+static uint64_t last_message = 0;
+
+static uint64_t dropped_at = 0;
+static uint64_t no_reconnects = 0;
+static uint64_t reconnect_total = 0;
+static uint64_t reconnect_max = 0;
+
+static uint64_t now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ( (uint64_t) ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+static void sigfunc()
+{
+    running = false;
+}
+
+static void client_send(struct mock_client *client, const char *format, ...) __attribute__ ((format (printf, 2, 3) ));
+static void client_send(struct mock_client *client, const char *format, ...)
+{
+    char line[MOCK_BUFSIZE];
+    va_list args;
+    int len = 0;
+
+    va_start(args, format);
+    len = vsnprintf(line, sizeof(line) -2, format, args);
+    va_end(args);
+
+    if (len < 0) return;
+    if (len > (int) sizeof(line) -3) len = sizeof(line) -3;
+    line[len++] = '\r';
+    line[len++] = '\n';
+
+    if (write(client->fd, line, len) != len) fprintf(stderr, "mockircd: short write to %s\n", client->nick);
+}
+
+static void client_close(struct mock_client *client)
+{
+    close(client->fd);
+    memset(client, 0, sizeof(*client) );
+    client->fd = -1;
+}
+
+static void record_message(const char *text, size_t len)
+{
+    uint64_t now = now_usec();
+    const char *packet = strchr(text, '$');
+    unsigned long long seq = 0;
+    unsigned long long sent = 0;
+
+    if (first_message == 0) first_message = now;
+    last_message = now;
+    no_messages++;
+    no_bytes += len;
+
+    if (packet != NULL && sscanf(packet, "$%llu,%llu,", &seq, &sent) == 2 && sent <= now)
+    {
+        if (no_latencies == max_latencies)
+        {
+            max_latencies = (max_latencies == 0) ? 4096 : max_latencies *2;
+            latencies = realloc(latencies, max_latencies * sizeof(*latencies) );
+            if (latencies == NULL)
+            {
+                fprintf(stderr, "mockircd: out of memory\n");
+                exit(1);
+            }
+        }
+        latencies[no_latencies++] = now - sent;
+    }
+}
+
+static void handle_line(struct mock_client *client, char *line)
+{
+    char *command = strtok(line, " ");
+    char *rest = strtok(NULL, "");
+
+    if (command == NULL) return;
+    if (rest == NULL) rest = "";
+
+    if (strcasecmp(command, "NICK") == 0)
+    {
+        strncpy(client->nick, rest, sizeof(client->nick) -1);
+    }
+    else if (strcasecmp(command, "USER") == 0)
+    {
+        client->user = true;
+    }
+    else if (strcasecmp(command, "PING") == 0)
+    {
+        client_send(client, ":%s PONG %s :%s", MOCK_NAME, MOCK_NAME, (rest[0] == ':') ? rest +1 : rest);
+    }
+    else if (strcasecmp(command, "CAP") == 0)
+    {
+        if (strncasecmp(rest, "LS", 2) == 0) client_send(client, ":%s CAP * LS :%s", MOCK_NAME, (settings.offer_echo) ? "echo-message" : "");
+        else if (strncasecmp(rest, "REQ", 3) == 0)
+        {
+            char *caps = strchr(rest, ':');
+            caps = (caps != NULL) ? caps +1 : rest +4;
+
+            if (settings.offer_echo && strcmp(caps, "echo-message") == 0)
+            {
+                client->echo = true;
+                client_send(client, ":%s CAP * ACK :echo-message", MOCK_NAME);
+            }
+            else client_send(client, ":%s CAP * NAK :%s", MOCK_NAME, caps);
+        }
+    }
+    else if (strcasecmp(command, "JOIN") == 0)
+    {
+        char *channel = strtok(rest, " ,");
+
+        /* Only the first join after a drop counts towards the reconnect time */
+        if (dropped_at > 0)
+        {
+            uint64_t duration = now_usec() - dropped_at;
+            no_reconnects++;
+            reconnect_total += duration;
+            if (duration > reconnect_max) reconnect_max = duration;
+            dropped_at = 0;
+        }
+
+        for (; channel != NULL; channel = strtok(NULL, " ,") )
+        {
+            if (channel[0] != '#' && channel[0] != '&') continue;
+            client_send(client, ":%s!bench@localhost JOIN :%s", client->nick, channel);
+            client_send(client, ":%s 353 %s = %s :%s", MOCK_NAME, client->nick, channel, client->nick);
+            client_send(client, ":%s 366 %s %s :End of /NAMES list.", MOCK_NAME, client->nick, channel);
+        }
+    }
+    else if (strcasecmp(command, "PRIVMSG") == 0 || strcasecmp(command, "NOTICE") == 0)
+    {
+        char *text = strchr(rest, ':');
+        if (text == NULL) return;
+
+        record_message(text +1, strlen(text +1) );
+        if (client->echo) client_send(client, ":%s!bench@localhost %s %s", client->nick, command, rest);
+
+        if (settings.expect > 0 && no_messages >= settings.expect) running = false;
+        else if (settings.drop_every > 0 && (no_messages % settings.drop_every) == 0)
+        {
+            dropped_at = now_usec();
+            client_close(client);
+            return;
+        }
+    }
+    else if (strcasecmp(command, "QUIT") == 0)
+    {
+        client_close(client);
+        return;
+    }
+
+    if (client->registered == false && client->user && strlen(client->nick) > 0)
+    {
+        client->registered = true;
+        client_send(client, ":%s 001 %s :Welcome to the benchmark", MOCK_NAME, client->nick);
+        client_send(client, ":%s 376 %s :End of /MOTD command.", MOCK_NAME, client->nick);
+    }
+}
+
+static void client_read(struct mock_client *client)
+{
+    ssize_t result = read(client->fd, &client->buf[client->len], sizeof(client->buf) - client->len -1);
+    size_t start = 0;
+    size_t counter = 0;
+
+    if (result <= 0)
+    {
+        if (result == 0 || errno != EINTR) client_close(client);
+        return;
+    }
+
+    client->len += result;
+    for (counter = 0; counter < client->len && client->fd >= 0; counter++)
+    {
+        if (client->buf[counter] == '\n')
+        {
+            size_t end = counter;
+            if (end > start && client->buf[end -1] == '\r') end--;
+            client->buf[end] = '\0';
+
+            handle_line(client, &client->buf[start]);
+            start = counter +1;
+        }
+    }
+
+    if (client->fd < 0) return;
+
+    /* A line which does not fit is discarded */
+    if (start == 0 && client->len == sizeof(client->buf) -1) start = client->len;
+    memmove(client->buf, &client->buf[start], client->len - start);
+    client->len -= start;
+}
+
+static int compare_uint64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(double p)
+{
+    uint64_t index = 0;
+
+    if (no_latencies == 0) return 0;
+    index = (uint64_t) (p * (no_latencies -1) );
+    return latencies[index];
+}
+
+static void write_report()
+{
+    FILE *fp = stdout;
+    double duration = (last_message > first_message) ? (last_message - first_message) / 1000000.0 : 0.0;
+
+    if (settings.report != NULL && (fp = fopen(settings.report, "w") ) == NULL)
+    {
+        fprintf(stderr, "mockircd: could not open %s: %s\n", settings.report, strerror(errno) );
+        fp = stdout;
+    }
+
+    qsort(latencies, no_latencies, sizeof(*latencies), compare_uint64);
+
+    fprintf(fp, "messages %llu\n", (unsigned long long) no_messages);
+    fprintf(fp, "bytes %llu\n", (unsigned long long) no_bytes);
+    fprintf(fp, "duration_s %.3f\n", duration);
+    fprintf(fp, "lines_per_s %.1f\n", (duration > 0.0) ? no_messages / duration : 0.0);
+    fprintf(fp, "latency_samples %llu\n", (unsigned long long) no_latencies);
+    fprintf(fp, "latency_p50_us %llu\n", (unsigned long long) percentile(0.50) );
+    fprintf(fp, "latency_p90_us %llu\n", (unsigned long long) percentile(0.90) );
+    fprintf(fp, "latency_p99_us %llu\n", (unsigned long long) percentile(0.99) );
+    fprintf(fp, "latency_max_us %llu\n", (unsigned long long) ( (no_latencies > 0) ? latencies[no_latencies -1] : 0) );
+    fprintf(fp, "reconnects %llu\n", (unsigned long long) no_reconnects);
+    fprintf(fp, "reconnect_avg_ms %.1f\n", (no_reconnects > 0) ? (reconnect_total / 1000.0) / no_reconnects : 0.0);
+    fprintf(fp, "reconnect_max_ms %.1f\n", reconnect_max / 1000.0);
+
+    if (fp != stdout) fclose(fp);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-p port] [-n messages] [-k drop_every] [-e] [-i idle_seconds] [-o report]\n", name);
+    fprintf(stderr, "  -p  port to listen on (default %d)\n", settings.port);
+    fprintf(stderr, "  -n  exit after receiving this many messages\n");
+    fprintf(stderr, "  -k  drop the connection after every N messages, to measure reconnects\n");
+    fprintf(stderr, "  -e  offer the echo-message capability\n");
+    fprintf(stderr, "  -i  exit after this many seconds without messages (default %d)\n", settings.idle_timeout);
+    fprintf(stderr, "  -o  write the report to this file instead of stdout\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in addr;
+    struct sigaction setmask;
+    int listen_fd = -1;
+    int one = 1;
+    int opt = 0;
+    int counter = 0;
+    uint64_t last_activity = 0;
+
+    while ( (opt = getopt(argc, argv, "p:n:k:ei:o:h") ) != -1)
+    {
+        switch (opt)
+        {
+            case 'p': settings.port = atoi(optarg); break;
+            case 'n': settings.expect = strtoull(optarg, NULL, 10); break;
+            case 'k': settings.drop_every = strtoull(optarg, NULL, 10); break;
+            case 'e': settings.offer_echo = true; break;
+            case 'i': settings.idle_timeout = atoi(optarg); break;
+            case 'o': settings.report = optarg; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+
+    sigemptyset(&setmask.sa_mask);
+    setmask.sa_handler = sigfunc;
+    setmask.sa_flags = 0;
+    sigaction(SIGINT, &setmask, NULL);
+    sigaction(SIGTERM, &setmask, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (counter = 0; counter < MOCK_MAX_CLIENTS; counter++) clients[counter].fd = -1;
+
+    memset(&addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(settings.port);
+
+    if ( (listen_fd = socket(AF_INET, SOCK_STREAM, 0) ) < 0)
+    {
+        perror("mockircd: socket");
+        return 1;
+    }
+
+    (void) setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) );
+    if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr) ) != 0 || listen(listen_fd, MOCK_MAX_CLIENTS) != 0)
+    {
+        perror("mockircd: listen");
+        return 1;
+    }
+
+    last_activity = now_usec();
+    while (running)
+    {
+        fd_set readset;
+        struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+        int maxfd = listen_fd;
+
+        FD_ZERO(&readset);
+        FD_SET(listen_fd, &readset);
+        for (counter = 0; counter < MOCK_MAX_CLIENTS; counter++)
+        {
+            if (clients[counter].fd < 0) continue;
+            FD_SET(clients[counter].fd, &readset);
+            if (clients[counter].fd > maxfd) maxfd = clients[counter].fd;
+        }
+
+        if (select(maxfd +1, &readset, NULL, NULL, &tv) <= 0)
+        {
+            if (settings.idle_timeout > 0 && (now_usec() - last_activity) > (uint64_t) settings.idle_timeout * 1000000ULL)
+            {
+                fprintf(stderr, "mockircd: idle for %d seconds; stopping\n", settings.idle_timeout);
+                running = false;
+            }
+            continue;
+        }
+        last_activity = now_usec();
+
+        for (counter = 0; counter < MOCK_MAX_CLIENTS; counter++)
+        {
+            if (clients[counter].fd >= 0 && FD_ISSET(clients[counter].fd, &readset) ) client_read(&clients[counter]);
+        }
+
+        if (FD_ISSET(listen_fd, &readset) )
+        {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd < 0) continue;
+
+            for (counter = 0; counter < MOCK_MAX_CLIENTS && clients[counter].fd >= 0; counter++);
+            if (counter == MOCK_MAX_CLIENTS) close(fd);
+            else
+            {
+                memset(&clients[counter], 0, sizeof(clients[counter]) );
+                clients[counter].fd = fd;
+            }
+        }
+    }
+
+    write_report();
+
+    for (counter = 0; counter < MOCK_MAX_CLIENTS; counter++)
+    {
+        if (clients[counter].fd >= 0) client_close(&clients[counter]);
+    }
+    close(listen_fd);
+    free(latencies);
+    return 0;
+}
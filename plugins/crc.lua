@@ -63,6 +63,17 @@ function plugin_string_exec(s)
     return sensor_packet_crc(s)
 end
 
+plugin_commands = {
+    { name = "/crc", doc = "shows a sensor packet with its crc", args = true },
+}
+
+function plugin_command_exec(name, args)
+    if name == "/crc" then
+        return sensor_packet_crc(args)
+    end
+    return false, "unknown command " .. name
+end
+
 --print(plugin_string_exec("blaat"))
 --print(plugin_string_exec("$1,3,1,1,stop*55D9*"))
 --print(plugin_string_exec("$1,3,1,1,stop*CRC*"))
@@ -2,10 +2,14 @@
 
 #include "arguments.h"
 #include "configdefaults.h"
+#include "follow.h"
 
 struct arg_file *config;
 struct arg_str  *mode;
 struct arg_int  *port;
+struct arg_lit  *ssl;
+struct arg_lit  *ssl_noverify;
+struct arg_file *ssl_session;
 struct arg_str  *server;
 struct arg_str  *channel;
 struct arg_str  *botname;
@@ -15,11 +19,33 @@ struct arg_lit  *keepreading;
 struct arg_lit  *showchannel;
 struct arg_lit  *shownick;
 struct arg_lit  *showjoins;
+struct arg_lit  *broadcast;
 struct arg_lit  *disable_plugins;
 struct arg_lit  *retry_init_connect;
 struct arg_int  *lines;
 struct arg_int  *timeout;
 struct arg_int  *output_flood;
+struct arg_int  *dedup_window;
+struct arg_int  *fragment_size;
+struct arg_int  *queue_size;
+struct arg_file *spoolfile;
+struct arg_lit  *daemon_mode;
+struct arg_lit  *submit;
+struct arg_file *socketpath;
+struct arg_file *controlpath;
+struct arg_int  *metrics_port;
+struct arg_file *metricspath;
+struct arg_file *tracefile;
+struct arg_file *recordfile;
+struct arg_file *replayfile;
+struct arg_lit  *replay_realtime;
+struct arg_file *followfile;
+struct arg_file *followstate;
+struct arg_str  *send_nick;
+struct arg_file *send_file;
+struct arg_file *receive_dir;
+struct arg_str  *dcc_address;
+struct arg_str  *input_format;
 struct arg_rem  *remark1;
 
 struct arg_lit  *silent;
@@ -28,12 +54,9 @@ struct arg_lit  *debug;
 struct arg_lit  *help;
 struct arg_lit  *version;
 struct arg_end  *end;
-void *argtable[40];
+void *argtable[60];
 
-/** 
-* Frees the argtable memory allocations.
-*/
-static void arg_clean()
+void arg_clean()
 {
     /* deallocate each non-null entry in argtable[] */
     arg_freetable(argtable,sizeof(argtable)/sizeof(argtable[0]));
@@ -55,17 +78,51 @@ int arg_parseprimairy(int argc, char **argv)
 
     mode            = arg_str0("m"  , "mode"            , "in/out/both"                , "set the mode, input, output or both");
     port            = arg_int0("p"  , "port"            , XSTR(CONFIG_PORT)            , "set the port of the irc server");
+    ssl             = arg_lit0(""   , "ssl"                                            , "connect to the irc server using ssl/tls");
+    ssl_noverify    = arg_lit0(""   , "ssl_noverify"                                   , "do not verify the certificate of the irc server");
+    ssl_session     = arg_file0(""  , "ssl_session"     , "<file>"                     , "keep the tls session in <file>, so a restart can resume it");
     botname         = arg_str0("n"  , "name"            , CONFIG_BOTNAME               , "set the botname");
     timeout         = arg_int0("t"  , "timeout"         , XSTR(CONFIG_CONNECTION_TIMEOUT), "set the maximum timeout of the irc connection");
     output_flood    = arg_int0(""   , "oflood"          , XSTR(CONFIG_OUTGOING_FLOOD_TIMEOUT), "sets the delay in msec between outgoing message");
+    dedup_window    = arg_int0(""   , "dedup"           , "<msec>"                     , "suppress repeats of a message to the same channel within <msec>, "
+                                                                                         "and send a single summary of them instead");
+    fragment_size   = arg_int0(""   , "fragment"        , "<bytes>"                    , "send messages longer than <bytes> in checksummed fragments, "
+                                                                                         "and reassemble the fragments which are received");
+    queue_size      = arg_int0(""   , "queue"           , XSTR(CONFIG_QUEUE_SIZE)      , "sets the number of outgoing messages kept in memory");
+    spoolfile       = arg_file0(""  , "spool"           , "<file>"                     , "append outgoing messages which do not fit in memory to <file>, "
+                                                                                         "they will be send when the connection allows it");
+    daemon_mode     = arg_lit0("D"  , "daemon"                                         , "keep running and send the lines of '--submit' clients; stdin is not read");
+    submit          = arg_lit0(""   , "submit"                                         , "hand stdin to a running daemon instead of connecting to the irc server");
+    socketpath      = arg_file0(""  , "socket"          , CONFIG_SOCKET                , "the unix socket of the daemon");
+    controlpath     = arg_file0(""  , "control"         , "<socket>"                   , "accept commands like /join and /status on a unix socket");
+    metrics_port    = arg_int0(""   , "metrics_port"    , "<port>"                     , "serve prometheus metrics over http on this port of 127.0.0.1");
+    metricspath     = arg_file0(""  , "metrics_socket"  , "<socket>"                   , "serve prometheus metrics over http on a unix socket");
+    tracefile       = arg_file0(""  , "trace"           , "<file>"                     , "write the time every message passes each stage to <file>; "
+                                                                                         "read it with irccmd-tracestat");
+    recordfile      = arg_file0(""  , "record"          , "<file>"                     , "record all irc events to <file>");
+    replayfile      = arg_file0(""  , "replay"          , "<file>"                     , "feed a recording through irccmd instead of connecting to the server");
+    replay_realtime = arg_lit0(""   , "replay_realtime"                                , "replay at the recorded pace instead of as fast as possible");
+    followfile      = arg_file0(""  , "follow"          , "<file>"                     , "send the lines appended to <file>, like tail -F; "
+                                                                                         "a restart resumes after the last line which was read");
+    followstate     = arg_file0(""  , "follow_state"    , "<file>"                     , "checkpoint the offset of '--follow' to <file> "
+                                                                                         "instead of <file>" FOLLOW_STATE_SUFFIX);
+    send_nick       = arg_str0(""   , "send_file"       , "<nick>"                     , "send <file> to <nick> over a direct DCC connection, and quit when it is done");
+    send_file       = arg_file0(NULL, NULL              , "<file>"                     , "the file for '--send_file'");
+    receive_dir     = arg_file0(""  , "receive_dir"     , "<dir>"                      , "accept the files which are offered over DCC into <dir>; "
+                                                                                         "a partial file is resumed");
+    dcc_address     = arg_str0(""   , "dcc_address"     , "<ip>"                       , "the IPv4 address DCC receivers connect to; "
+                                                                                         "by default the address of the irc connection");
     lines           = arg_int0("l"  , "lines"           , "0"                          , "quit when the number of messages has exceeded <lines>. "
                                                                                          "Off when set to zero.");
     noninteractive  = arg_lit0("N"  , "noninteractive"                                 , "will force a non-interactive session");
+    input_format    = arg_str0(""   , "input_format"    , "line/nul/lp/json"           , "how messages on stdin are framed: lines, NUL terminated, "
+                                                                                         "length prefixed frames or JSON objects with a target and a text");
     keepreading     = arg_lit0("K"  , "keepreading"                                    , "will stay in the channel after "
                                                                                          "the writing end of stdin has closed.");
     showchannel     = arg_lit0("H"  , "showchannel"                                    , "show channel when printing irc messages to stdout");
     shownick        = arg_lit0("N"  , "shownick"                                       , "show nick from sender when printing irc messages to stdout");
     showjoins       = arg_lit0("J"  , "showjoins"                                      , "show joins from the connected channels");
+    broadcast       = arg_lit0(""   , "broadcast"                                      , "send a line starting with '* ' to every channel");
     server          = arg_str0("S"  , "server"          , CONFIG_SERVER                , "set the irc server");
     serverpassword  = arg_str0("P"  , "serverpassword"  , "<password>"                 , "set the password for the server");
     channel         = arg_strn("C"  , "channel"         , CONFIG_CHANNEL ":<password>" , 0, MAX_CHANNELS, 
@@ -91,20 +148,45 @@ int arg_parseprimairy(int argc, char **argv)
 
         argtable[i++] = mode;
         argtable[i++] = port;
+        argtable[i++] = ssl;
+        argtable[i++] = ssl_noverify;
+        argtable[i++] = ssl_session;
         argtable[i++] = botname;
         argtable[i++] = timeout;
         argtable[i++] = output_flood;
+        argtable[i++] = dedup_window;
+        argtable[i++] = fragment_size;
+        argtable[i++] = queue_size;
+        argtable[i++] = spoolfile;
+        argtable[i++] = daemon_mode;
+        argtable[i++] = submit;
+        argtable[i++] = socketpath;
+        argtable[i++] = controlpath;
+        argtable[i++] = metrics_port;
+        argtable[i++] = metricspath;
+        argtable[i++] = tracefile;
+        argtable[i++] = recordfile;
+        argtable[i++] = replayfile;
+        argtable[i++] = replay_realtime;
+        argtable[i++] = followfile;
+        argtable[i++] = followstate;
+        argtable[i++] = send_nick;
+        argtable[i++] = receive_dir;
+        argtable[i++] = dcc_address;
         argtable[i++] = lines;
         argtable[i++] = noninteractive;
+        argtable[i++] = input_format;
         argtable[i++] = keepreading;
         argtable[i++] = showchannel;
         argtable[i++] = shownick;
         argtable[i++] = showjoins;
+        argtable[i++] = broadcast;
         argtable[i++] = server;
         argtable[i++] = serverpassword;
         argtable[i++] = channel;
         argtable[i++] = disable_plugins;
         argtable[i++] = retry_init_connect;
+        argtable[i++] = send_file;
 
         argtable[i++] = end;
     }
@@ -256,6 +338,27 @@ int arg_parsesecondary()
         }
     }
 
+    if (input_format->count > 0)
+    {
+        if (options.running)
+        {
+            const char *formats[] = { "line", "nul", "lp", "json", NULL };
+            int counter = 0;
+
+            while (formats[counter] != NULL && strcmp(formats[counter], input_format->sval[0]) != 0) counter++;
+            if (formats[counter] != NULL)
+            {
+                options.input_format = counter;
+                verbose("setting input format to %s\n", formats[counter]);
+            }
+            else
+            {
+                error("unknown input format %s\n", input_format->sval[0]);
+                exitcode = 1;
+            }
+        }
+    }
+
 	if (port->count > 0)
 	{
         if (options.running)
@@ -265,6 +368,33 @@ int arg_parsesecondary()
 		}
 	}
 	
+    if (ssl->count > 0)
+    {
+        if (options.running)
+        {
+            options.ssl = true;
+			verbose("using ssl\n");
+        }
+    }
+
+    if (ssl_noverify->count > 0)
+    {
+        if (options.running)
+        {
+            options.ssl_verify = false;
+			verbose("not verifying the server certificate\n");
+        }
+    }
+
+    if (ssl_session->count > 0)
+    {
+        if (options.running)
+        {
+            strncpy(options.ssl_session_file, ssl_session->filename[0], MAX_PATH_LEN -1);
+			verbose("keeping the tls session in %s\n", options.ssl_session_file);
+        }
+    }
+
 	if (server->count > 0)
 	{
         if (options.running)
@@ -344,6 +474,15 @@ int arg_parsesecondary()
         }
     }
 
+    if (broadcast->count > 0)
+    {
+        if (options.running)
+        {
+            options.broadcast = true;
+			verbose("a line starting with '* ' is send to every channel\n");
+        }
+    }
+
     if (noninteractive->count > 0)
     {
         if (options.running)
@@ -380,6 +519,186 @@ int arg_parsesecondary()
 		}
 	}
 
+	if (dedup_window->count > 0)
+	{
+        if (options.running)
+        {
+			options.dedup_window = dedup_window->ival[0];
+			verbose("suppressing repeated messages within %d msec\n", dedup_window->ival[0]);
+		}
+	}
+
+	if (fragment_size->count > 0)
+	{
+        if (options.running)
+        {
+			options.fragment_size = fragment_size->ival[0];
+			verbose("sending messages longer than %d bytes in fragments\n", fragment_size->ival[0]);
+		}
+	}
+
+	if (queue_size->count > 0)
+	{
+        if (options.running)
+        {
+			options.queue_size = queue_size->ival[0];
+			verbose("setting outgoing queue size to %d\n", queue_size->ival[0]);
+		}
+	}
+
+	if (spoolfile->count > 0)
+	{
+        if (options.running)
+        {
+            strncpy(options.spoolfile, spoolfile->filename[0], MAX_PATH_LEN -1);
+			verbose("setting spool file to %s\n", options.spoolfile);
+		}
+	}
+
+    if (daemon_mode->count > 0)
+    {
+        if (options.running)
+        {
+            options.daemon = true;
+			verbose("running as daemon\n");
+        }
+    }
+
+    if (submit->count > 0)
+    {
+        if (options.running)
+        {
+            options.submit = true;
+			verbose("submitting to daemon\n");
+        }
+    }
+
+	if (socketpath->count > 0)
+	{
+        if (options.running)
+        {
+            strncpy(options.socketpath, socketpath->filename[0], MAX_PATH_LEN -1);
+			verbose("setting socket to %s\n", options.socketpath);
+		}
+	}
+
+	if (controlpath->count > 0)
+	{
+        if (options.running)
+        {
+            strncpy(options.controlpath, controlpath->filename[0], MAX_PATH_LEN -1);
+			verbose("setting control socket to %s\n", options.controlpath);
+		}
+	}
+
+	if (metrics_port->count > 0)
+	{
+        if (options.running)
+        {
+            options.metrics_port = metrics_port->ival[0];
+			verbose("setting metrics port to %d\n", options.metrics_port);
+		}
+	}
+
+	if (metricspath->count > 0)
+	{
+        if (options.running)
+        {
+            strncpy(options.metricspath, metricspath->filename[0], MAX_PATH_LEN -1);
+			verbose("setting metrics socket to %s\n", options.metricspath);
+		}
+	}
+
+	if (tracefile->count > 0)
+	{
+        if (options.running)
+        {
+            strncpy(options.tracefile, tracefile->filename[0], MAX_PATH_LEN -1);
+			verbose("setting trace file to %s\n", options.tracefile);
+		}
+	}
+
+	if (recordfile->count > 0)
+	{
+        if (options.running)
+        {
+            strncpy(options.recordfile, recordfile->filename[0], MAX_PATH_LEN -1);
+			verbose("setting recording to %s\n", options.recordfile);
+		}
+	}
+
+	if (replayfile->count > 0)
+	{
+        if (options.running)
+        {
+            strncpy(options.replayfile, replayfile->filename[0], MAX_PATH_LEN -1);
+			verbose("replaying %s\n", options.replayfile);
+		}
+	}
+
+    if (replay_realtime->count > 0)
+    {
+        if (options.running)
+        {
+            options.replay_realtime = true;
+			verbose("replaying at the recorded pace\n");
+        }
+    }
+
+	if (followfile->count > 0)
+	{
+        if (options.running)
+        {
+            strncpy(options.followfile, followfile->filename[0], MAX_PATH_LEN -1);
+			verbose("following %s\n", options.followfile);
+		}
+	}
+
+	if (followstate->count > 0)
+	{
+        if (options.running)
+        {
+            strncpy(options.followstate, followstate->filename[0], MAX_PATH_LEN -1);
+			verbose("setting follow state file to %s\n", options.followstate);
+		}
+	}
+
+	if (send_nick->count > 0 || send_file->count > 0)
+	{
+        if (options.running)
+        {
+            if (send_nick->count == 0 || send_file->count == 0)
+            {
+                error("'--send_file' needs a nick and a file\n");
+                exitcode = 1;
+            }
+            else
+            {
+                strncpy(options.send_nick, send_nick->sval[0], MAX_NICK_LEN -1);
+                strncpy(options.send_file, send_file->filename[0], MAX_PATH_LEN -1);
+                verbose("sending %s to %s\n", options.send_file, options.send_nick);
+            }
+		}
+	}
+
+	if (receive_dir->count > 0)
+	{
+        if (options.running)
+        {
+            strncpy(options.receive_dir, receive_dir->filename[0], MAX_PATH_LEN -1);
+			verbose("accepting DCC files into %s\n", options.receive_dir);
+		}
+	}
+
+	if (dcc_address->count > 0)
+	{
+        if (options.running)
+        {
+            strncpy(options.dcc_address, dcc_address->sval[0], MAX_SERVER_NAMELEN -1);
+			verbose("offering DCC connections on %s\n", options.dcc_address);
+		}
+	}
+
 	if (lines->count > 0)
 	{
         if (options.running)
@@ -406,7 +725,6 @@ int arg_parsesecondary()
 			verbose("setting retry initial connect\n");
         }
     }
-    arg_clean();
 
     return exitcode;
 }
@@ -17,10 +17,16 @@ int arg_parseprimairy(int argc, char **argv);
 
 /** 
 * Parses the secondary arguments. This should be called after the defaults have
-* been set and the config file has been read.
+* been set and the config file has been read. It can be called again after the
+* config file has been reloaded, so the commandline keeps its priority.
 * 
 * @return zero on success; one if an error was encountered.
 */
 int arg_parsesecondary();
 
+/** 
+* Frees the argtable memory allocations.
+*/
+void arg_clean();
+
 #endif /* arguments_h_ */
@@ -0,0 +1,694 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/types.h>
+
+#include "main.h"
+#include "ircmod.h"
+#include "buffer.h"
+#include "trace.h"
+#include "metrics.h"
+
+/**
+* A single outbound message.
+*/
+struct buffer_entry
+{
+    char channel[BUFFER_TARGETS_LEN];
+    char *msg;
+    bool spooled;           /* True if the message was read from the spool file */
+    uint32_t trace_id;      /* 0 when the message is not traced */
+    uint64_t queued;        /* usec; when it entered the in-memory queue */
+    uint64_t arrival;       /* the order in which the messages were queued, over all queues */
+    unsigned long long sent;    /* msec; when it was written, while it waits for its echo */
+    struct buffer_entry *next;
+};
+
+/**
+* The messages waiting for a channel, in the order they were queued.
+*/
+struct buffer_queue
+{
+    char channel[BUFFER_TARGETS_LEN];       /* empty while the queue is not in use */
+    struct buffer_entry *head;
+    struct buffer_entry *tail;
+    size_t count;
+    int deficit;                            /* messages the queue may still send this round */
+};
+
+/**
+* The in-memory outbound queue holds at most options.queue_size messages, taken
+* from a pool of entries. Every channel has a queue of its own, and the queues are
+* served by deficit round robin: every round a queue may send as many messages as
+* its weight, so a busy channel cannot starve the quiet ones. The flood timeout is
+* per message, so a message costs the same whatever its length. Queues of a higher
+* priority are served first. When the pool is exhausted, messages are
+* appended to the spool file. As long as the spool file holds unsent messages,
+* new messages are appended to it as well so the original order is kept.
+*
+* When the server echoes our messages back, the messages which have been send but
+* not yet acknowledged are kept in the order they were send. They are put in front
+* of their queues again after a reconnect. The spool file is only truncated when
+* every message read from it has been acknowledged.
+*/
+static struct buffer_entry *entries = NULL;
+static struct buffer_entry *free_entries = NULL;
+static struct buffer_queue queues[BUFFER_QUEUES];
+static struct buffer_entry *inflight_head = NULL;
+static struct buffer_entry *inflight_tail = NULL;
+static size_t size = 0;
+static size_t count = 0;
+static size_t inflight = 0;
+
+static int current_queue = 0;          /* the queue which is served by the round robin */
+static bool quantum_given = false;     /* the current queue received its quantum for this round */
+
+static FILE *spool = NULL;
+static off_t spool_read_offset = 0;
+static off_t spool_write_offset = 0;
+static size_t spool_unacked = 0;
+
+static unsigned long dropped = 0;
+static uint64_t arrivals = 0;
+static uint64_t lost_arrival = UINT64_MAX;    /* the oldest message buffer_deinit() could not save */
+static unsigned long long next_send = 0;
+
+static unsigned long long now_msec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ( (unsigned long long) ts.tv_sec * 1000ULL) + (ts.tv_nsec / 1000000);
+}
+
+/**
+* Finds the queue of a channel, or a free queue for it. When every queue is in use,
+* the last one is shared by the channels which do not fit.
+*/
+static struct buffer_queue *queue_find(const char *channel)
+{
+    struct buffer_queue *free_queue = NULL;
+    int counter = 0;
+
+    for (counter = 0; counter < BUFFER_QUEUES; counter++)
+    {
+        if (strcasecmp(queues[counter].channel, channel) == 0) return &queues[counter];
+        if (free_queue == NULL && queues[counter].count == 0) free_queue = &queues[counter];
+    }
+    if (free_queue == NULL) return &queues[BUFFER_QUEUES -1];
+
+    memset(free_queue->channel, '\0', sizeof(free_queue->channel) );
+    strncpy(free_queue->channel, channel, sizeof(free_queue->channel) -1);
+    free_queue->deficit = 0;
+    return free_queue;
+}
+
+/**
+* Tells whether a channel is one of the comma separated targets of a message.
+*/
+static bool is_target(const char *targets, const char *channel)
+{
+    size_t len = strlen(channel);
+
+    while (targets != NULL)
+    {
+        if (strncasecmp(targets, channel, len) == 0 && (targets[len] == ',' || targets[len] == '\0') ) return true;
+        if ( (targets = strchr(targets, ',') ) != NULL) targets++;
+    }
+    return false;
+}
+
+/**
+* Looks up the weight and the priority of the channel of a queue; channels which
+* are not configured have a weight of 1 and a priority of 0. A queue for several
+* channels takes the highest weight and the highest priority among them.
+*/
+static void queue_settings(const struct buffer_queue *queue, int *weight, int *priority)
+{
+    bool found = false;
+    int counter = 0;
+
+    *weight = 1;
+    *priority = 0;
+    for (counter = 0; counter < options.no_channels; counter++)
+    {
+        if (is_target(queue->channel, options.channels[counter]) )
+        {
+            if (options.channelweights[counter] > *weight) *weight = options.channelweights[counter];
+            if (found == false || options.channelpriorities[counter] > *priority) *priority = options.channelpriorities[counter];
+            found = true;
+        }
+    }
+}
+
+static void queue_append(const char *channel, const char *msg, size_t len, bool spooled, uint32_t trace_id)
+{
+    struct buffer_queue *queue = queue_find(channel);
+    struct buffer_entry *entry = free_entries;
+
+    free_entries = entry->next;
+    memset(entry->channel, '\0', sizeof(entry->channel) );
+    strncpy(entry->channel, channel, sizeof(entry->channel) -1);
+    entry->msg = strndup(msg, len);
+    entry->spooled = spooled;
+    entry->trace_id = trace_id;
+    entry->queued = metrics_now();
+    entry->arrival = arrivals++;
+    entry->next = NULL;
+    if (spooled) spool_unacked++;
+    count++;
+
+    if (queue->tail != NULL) queue->tail->next = entry;
+    else queue->head = entry;
+    queue->tail = entry;
+    queue->count++;
+}
+
+/**
+* Takes the first message of a queue; it still counts as queued until it is released.
+*/
+static struct buffer_entry *queue_pop(struct buffer_queue *queue)
+{
+    struct buffer_entry *entry = queue->head;
+
+    queue->head = entry->next;
+    if (queue->head == NULL) queue->tail = NULL;
+    queue->count--;
+    entry->next = NULL;
+    return entry;
+}
+
+static void spool_truncate()
+{
+    if (spool == NULL) return;
+    if (spool_read_offset < spool_write_offset || spool_unacked > 0) return;
+    if (spool_write_offset == 0) return;
+
+    debug("spool file drained; truncating\n");
+    if (ftruncate(fileno(spool), 0) != 0) warning("could not truncate spool file %s\n", options.spoolfile);
+    spool_read_offset = 0;
+    spool_write_offset = 0;
+}
+
+/**
+* Returns a message which has been send, or dropped, to the pool.
+*/
+static void entry_release(struct buffer_entry *entry)
+{
+    if (entry->spooled) spool_unacked--;
+    free(entry->msg);
+    entry->msg = NULL;
+    entry->next = free_entries;
+    free_entries = entry;
+    count--;
+
+    spool_truncate();
+}
+
+/**
+* Releases the oldest message which is waiting for its echo.
+*/
+static void inflight_remove()
+{
+    struct buffer_entry *entry = inflight_head;
+
+    inflight_head = entry->next;
+    if (inflight_head == NULL) inflight_tail = NULL;
+    inflight--;
+    entry_release(entry);
+}
+
+/**
+* Releases the messages which have waited BUFFER_ACK_TIMEOUT msec for their echo.
+* A server may change the text of a message, so its echo does not match; the
+* message is taken for delivered, so it does not keep us from exiting and is not
+* send again after a reconnect.
+*/
+static void inflight_expire(unsigned long long now)
+{
+    while (inflight_head != NULL && now - inflight_head->sent >= BUFFER_ACK_TIMEOUT)
+    {
+        debug("no echo for message to %s within %d msec; taking it as delivered\n", inflight_head->channel, BUFFER_ACK_TIMEOUT);
+        inflight_remove();
+    }
+}
+
+/**
+* Picks the queue which may send next. Only the queues of the highest priority
+* which have messages take part. The current queue receives its quantum once per
+* round, and is served until its deficit is used up.
+*
+* @return the queue, or NULL when nothing is queued.
+*/
+static struct buffer_queue *queue_next()
+{
+    int weight = 0;
+    int priority = 0;
+    int highest = 0;
+    bool found = false;
+    int counter = 0;
+
+    for (counter = 0; counter < BUFFER_QUEUES; counter++)
+    {
+        if (queues[counter].count == 0) continue;
+
+        queue_settings(&queues[counter], &weight, &priority);
+        if (found == false || priority > highest) highest = priority;
+        found = true;
+    }
+    if (found == false) return NULL;
+
+    while (true)
+    {
+        struct buffer_queue *queue = &queues[current_queue];
+
+        if (queue->count == 0) queue->deficit = 0;
+        else
+        {
+            queue_settings(queue, &weight, &priority);
+            if (priority == highest)
+            {
+                if (quantum_given == false) queue->deficit += weight;
+                quantum_given = true;
+                if (queue->deficit > 0) return queue;
+            }
+        }
+
+        current_queue = (current_queue +1) % BUFFER_QUEUES;
+        quantum_given = false;
+    }
+}
+
+static bool spool_append(const char *channel, const char *msg, size_t len)
+{
+    int written = 0;
+
+    if (spool == NULL) return false;
+
+    /* switching from reading to writing requires a seek */
+    (void) fseeko(spool, 0, SEEK_END);
+    written = fprintf(spool, "%s\t%.*s\n", channel, (int) len, msg);
+    if (written < 0 || fflush(spool) != 0)
+    {
+        error("could not write to spool file %s\n", options.spoolfile);
+        return false;
+    }
+
+    spool_write_offset += written;
+    return true;
+}
+
+/**
+* Moves messages from the spool file into the in-memory queue, as long as there is room.
+*/
+static void spool_refill()
+{
+    char *line = NULL;
+    size_t linesize = 0;
+    ssize_t len = 0;
+
+    if (spool == NULL) return;
+    if (spool_read_offset >= spool_write_offset) return;
+    if (fseeko(spool, spool_read_offset, SEEK_SET) != 0) return;
+
+    while (count < size && spool_read_offset < spool_write_offset)
+    {
+        char *msg = NULL;
+
+        if ( (len = getline(&line, &linesize, spool) ) <= 0)
+        {
+            warning("spool file %s is shorter than expected\n", options.spoolfile);
+            spool_read_offset = spool_write_offset;
+            break;
+        }
+        spool_read_offset += len;
+
+        if (line[len -1] == '\n') line[len -1] = '\0';
+        if ( (msg = strchr(line, '\t') ) == NULL)
+        {
+            warning("ignoring malformed line in spool file: %s\n", line);
+            continue;
+        }
+        *msg = '\0';
+        msg++;
+
+        queue_append(line, msg, strlen(msg), true, 0);
+    }
+    free(line);
+
+    spool_truncate();
+}
+
+bool buffer_init()
+{
+    size_t index = 0;
+
+    size = (options.queue_size > 0) ? options.queue_size : 1;
+    entries = calloc(size, sizeof(struct buffer_entry) );
+    if (entries == NULL)
+    {
+        error("Bailing out! No memory for the outbound queue.\n");
+        return false;
+    }
+    free_entries = NULL;
+    for (index = size; index > 0; index--)
+    {
+        entries[index -1].next = free_entries;
+        free_entries = &entries[index -1];
+    }
+    memset(queues, 0, sizeof(queues) );
+    inflight_head = NULL;
+    inflight_tail = NULL;
+    count = 0;
+    inflight = 0;
+    current_queue = 0;
+    quantum_given = false;
+
+    if (strlen(options.spoolfile) > 0)
+    {
+        if ( (spool = fopen(options.spoolfile, "a+") ) == NULL)
+        {
+            warning("cannot open spool file %s; messages will be dropped when the queue is full\n", options.spoolfile);
+        }
+        else
+        {
+            (void) fseeko(spool, 0, SEEK_END);
+            spool_write_offset = ftello(spool);
+            spool_read_offset = 0;
+
+            if (spool_write_offset > 0) verbose("found %ld unsent bytes in spool file %s\n", (long) spool_write_offset, options.spoolfile);
+            spool_refill();
+        }
+    }
+
+    debug("outbound queue of %lu messages ready\n", (unsigned long) size);
+    return true;
+}
+
+void buffer_deinit()
+{
+    int counter = 0;
+
+    if (entries == NULL) return;
+
+    /* Messages which were send but not acknowledged are saved as well; they are send again */
+    buffer_requeue();
+    lost_arrival = buffer_oldest_unsaved();
+
+    if (spool != NULL && count > 0)
+    {
+        /* Rewrite the spool file with the queued messages in front of the unread part */
+        size_t pathlen = strlen(options.spoolfile) +5;
+        char tmppath[pathlen];
+        FILE *tmp = NULL;
+
+        (void) snprintf(tmppath, pathlen, "%s.tmp", options.spoolfile);
+        if ( (tmp = fopen(tmppath, "w") ) != NULL)
+        {
+            char chunk[4096];
+            size_t len = 0;
+
+            /* Every queue is in arrival order; they are merged so the spool file is as well */
+            while (count > 0)
+            {
+                struct buffer_queue *first = NULL;
+                struct buffer_entry *entry = NULL;
+
+                for (counter = 0; counter < BUFFER_QUEUES; counter++)
+                {
+                    if (queues[counter].count == 0) continue;
+                    if (first == NULL || queues[counter].head->arrival < first->head->arrival) first = &queues[counter];
+                }
+
+                entry = queue_pop(first);
+                fprintf(tmp, "%s\t%s\n", entry->channel, entry->msg);
+                entry_release(entry);
+            }
+
+            if (fseeko(spool, spool_read_offset, SEEK_SET) == 0)
+            {
+                while ( (len = fread(chunk, 1, sizeof(chunk), spool) ) > 0) (void) fwrite(chunk, 1, len, tmp);
+            }
+
+            if (fclose(tmp) != 0 || rename(tmppath, options.spoolfile) != 0)
+            {
+                error("could not save unsent messages to spool file %s\n", options.spoolfile);
+            }
+            else
+            {
+                verbose("saved unsent messages to spool file %s\n", options.spoolfile);
+                lost_arrival = UINT64_MAX;
+            }
+        }
+        else error("could not save unsent messages to spool file %s\n", options.spoolfile);
+    }
+    else if (count > 0)
+    {
+        warning("dropping %lu unsent messages\n", (unsigned long) count);
+    }
+
+    for (counter = 0; counter < BUFFER_QUEUES; counter++)
+    {
+        while (queues[counter].count > 0) entry_release(queue_pop(&queues[counter]) );
+    }
+    if (spool != NULL) fclose(spool);
+    spool = NULL;
+
+    free(entries);
+    entries = NULL;
+    free_entries = NULL;
+}
+
+bool buffer_push(const char *channel, const char *msg, size_t len, uint32_t trace_id)
+{
+    if (entries == NULL) return false;
+
+    if (count < size && spool_read_offset >= spool_write_offset)
+    {
+        queue_append(channel, msg, len, false, trace_id);
+        trace_stage(trace_id, trace_enqueued);
+        return true;
+    }
+
+    if (spool_append(channel, msg, len) )
+    {
+        trace_stage(trace_id, trace_enqueued);
+        return true;
+    }
+
+    dropped++;
+    warning("outbound queue is full; dropping message\n");
+    return false;
+}
+
+int buffer_flush()
+{
+    int sent = 0;
+
+    if (entries == NULL) return 0;
+
+    inflight_expire(now_msec() );
+
+    /* Protocol messages which are waiting for the connection go first */
+    if (irc_flush_control() == false) return 0;
+
+    spool_refill();
+    while (count > inflight && options.connected && is_irc_connected() )
+    {
+        unsigned long long now = now_msec();
+        struct buffer_queue *queue = NULL;
+        struct buffer_entry *entry = NULL;
+
+        if (options.output_flood_timeout > 0 && now < next_send) break;
+        if ( (queue = queue_next() ) == NULL) break;
+
+        entry = queue->head;
+        if (irc_send_raw_msg(entry->msg, entry->channel) != 0) break;
+        trace_stage(entry->trace_id, trace_written);
+        metric_observe(metric_data_lane, metrics_now() - entry->queued);
+
+        (void) queue_pop(queue);
+        queue->deficit--;
+
+        /* Keep the message until the server echoes it back, if it will */
+        if (irc_cap_enabled(cap_echo_message) )
+        {
+            entry->sent = now;
+            if (inflight_tail != NULL) inflight_tail->next = entry;
+            else inflight_head = entry;
+            inflight_tail = entry;
+            inflight++;
+        }
+        else entry_release(entry);
+        spool_refill();
+
+        next_send = now + options.output_flood_timeout;
+        sent++;
+    }
+
+    return sent;
+}
+
+void buffer_select_timeout(struct timeval *tv)
+{
+    unsigned long long now = now_msec();
+    unsigned long long wait = 0;
+
+    /* Wake up for the first message which waits for its echo in vain */
+    if (inflight_head != NULL && (count <= inflight || options.connected == false) )
+    {
+        if (inflight_head->sent + BUFFER_ACK_TIMEOUT > now) wait = inflight_head->sent + BUFFER_ACK_TIMEOUT - now;
+    }
+    else if (count <= inflight || options.connected == false) return;
+    else if (next_send > now) wait = next_send - now;
+    if ( ( (unsigned long long) tv->tv_sec * 1000ULL) + (tv->tv_usec / 1000) > wait)
+    {
+        tv->tv_sec = wait / 1000;
+        tv->tv_usec = (wait % 1000) * 1000;
+    }
+}
+
+bool buffer_ack(const char *channel, const char *msg)
+{
+    struct buffer_entry *entry = NULL;
+    size_t index = 0;
+
+    for (entry = inflight_head; entry != NULL; entry = entry->next, index++)
+    {
+        /* A message to several channels is acknowledged by the first echo */
+        if (is_target(entry->channel, channel) && strcmp(entry->msg, msg) == 0)
+        {
+            /* Messages send before this one were not echoed as they were send; the server changed them */
+            while (index > 0)
+            {
+                debug("message to %s was not echoed as it was send; taking it as delivered\n", inflight_head->channel);
+                inflight_remove();
+                index--;
+            }
+
+            debug("message to %s acknowledged\n", channel);
+            trace_stage(inflight_head->trace_id, trace_echoed);
+            inflight_remove();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool buffer_reject(const char *channel)
+{
+    struct buffer_entry *entry = NULL;
+    struct buffer_entry *previous = NULL;
+
+    for (entry = inflight_head; entry != NULL; previous = entry, entry = entry->next)
+    {
+        if (is_target(entry->channel, channel) == false) continue;
+
+        if (previous != NULL) previous->next = entry->next;
+        else inflight_head = entry->next;
+        if (inflight_tail == entry) inflight_tail = previous;
+        inflight--;
+
+        warning("%s refused a message; dropping it\n", channel);
+        dropped++;
+        entry_release(entry);
+        return true;
+    }
+    return false;
+}
+
+void buffer_requeue()
+{
+    struct buffer_entry *last[BUFFER_QUEUES];
+    int counter = 0;
+
+    if (inflight > 0) verbose("%lu messages were not acknowledged; sending them again\n", (unsigned long) inflight);
+
+    /* They go in front of their queues, in the order they were send */
+    for (counter = 0; counter < BUFFER_QUEUES; counter++) last[counter] = NULL;
+    while (inflight_head != NULL)
+    {
+        struct buffer_entry *entry = inflight_head;
+        struct buffer_queue *queue = queue_find(entry->channel);
+        int index = queue - queues;
+
+        inflight_head = entry->next;
+        if (last[index] == NULL)
+        {
+            entry->next = queue->head;
+            queue->head = entry;
+        }
+        else
+        {
+            entry->next = last[index]->next;
+            last[index]->next = entry;
+        }
+        if (entry->next == NULL) queue->tail = entry;
+        last[index] = entry;
+        queue->count++;
+    }
+    inflight_tail = NULL;
+    inflight = 0;
+}
+
+bool buffer_has_room()
+{
+    return (entries != NULL && count < size && spool_read_offset >= spool_write_offset);
+}
+
+bool buffer_is_empty()
+{
+    return (count == 0 && spool_read_offset >= spool_write_offset);
+}
+
+size_t buffer_depth()
+{
+    return count;
+}
+
+size_t buffer_channel_depth(const char *channel)
+{
+    int counter = 0;
+
+    for (counter = 0; counter < BUFFER_QUEUES; counter++)
+    {
+        if (strcasecmp(queues[counter].channel, channel) == 0) return queues[counter].count;
+    }
+    return 0;
+}
+
+size_t buffer_spooled_bytes()
+{
+    return (size_t) (spool_write_offset - spool_read_offset);
+}
+
+unsigned long buffer_dropped()
+{
+    return dropped;
+}
+
+uint64_t buffer_arrivals()
+{
+    return arrivals;
+}
+
+uint64_t buffer_oldest_unsaved()
+{
+    uint64_t oldest = (lost_arrival < arrivals) ? lost_arrival : arrivals;
+    int counter = 0;
+
+    for (counter = 0; counter < BUFFER_QUEUES; counter++)
+    {
+        struct buffer_entry *entry = NULL;
+
+        for (entry = queues[counter].head; entry != NULL; entry = entry->next)
+        {
+            if (entry->spooled == false && entry->arrival < oldest) oldest = entry->arrival;
+        }
+    }
+    return oldest;
+}
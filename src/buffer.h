@@ -0,0 +1,117 @@
+#ifndef buffer_h_
+#define buffer_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "main.h"
+
+#define BUFFER_QUEUES   (MAX_CHANNELS +1)   /* the last queue is shared when the others are in use */
+#define BUFFER_TARGETS_LEN  (MAX_CHANNELS * MAX_CHANNELS_NAMELEN)   /* a comma separated list of channels */
+#define BUFFER_ACK_TIMEOUT  (30000)     /* msec a message which was send waits for its echo */
+
+/**
+* Allocates the in-memory outbound queue and opens the spool file, when one is configured.
+* Lines left behind in the spool file by a previous run are queued for sending first.
+*
+* @return true on success, false when the queue could not be allocated.
+*/
+bool buffer_init();
+
+/**
+* Writes everything which has not been sent yet to the spool file (if any) and frees the queue.
+*/
+void buffer_deinit();
+
+/**
+* Queues a message for the given channel. Every channel has a queue of its own; the
+* queues share the in-memory space and take turns in proportion to their weights.
+* When the in-memory queue is full, the message
+* is appended to the spool file instead. Without a spool file the message is dropped.
+*
+* @param channel the channel the message is meant for, or a comma separated list of channels.
+* @param msg the message itself; it does not have to be terminated.
+* @param len the length of the message.
+* @param trace_id the trace id of the message, or 0 when it is not traced.
+*
+* @return true when the message was queued or spooled, false when it was dropped.
+*/
+bool buffer_push(const char *channel, const char *msg, size_t len, uint32_t trace_id);
+
+/**
+* Sends queued messages to the irc server, honouring the output flood timeout.
+* Nothing is send as long as we have not joined a channel.
+*
+* @return the number of messages send.
+*/
+int buffer_flush();
+
+/**
+* Acknowledges a message which the server has echoed back to us. Only then is
+* the message removed from the queue. Earlier messages without an echo were changed
+* by the server and are taken for delivered, like messages which are not echoed
+* within BUFFER_ACK_TIMEOUT msec.
+*
+* @param channel the channel the message was send to.
+* @param msg the message itself.
+*
+* @return true if the message was waiting for an acknowledgement.
+*/
+bool buffer_ack(const char *channel, const char *msg);
+
+/**
+* Drops the oldest message waiting for its echo which was send to a channel that
+* refused it, like with ERR_CANNOTSENDTOCHAN.
+*
+* @param channel the channel named in the error.
+* @return true if a message was waiting for that channel.
+*/
+bool buffer_reject(const char *channel);
+
+/**
+* Marks all unacknowledged messages as unsent, so they are send again after a reconnect.
+*/
+void buffer_requeue();
+
+/**
+* Lowers the given select timeout to the moment the next queued message may be send.
+*
+* @param tv the timeout which will be handed to select.
+*/
+void buffer_select_timeout(struct timeval *tv);
+
+/**
+* Tells whether a message can be queued in memory, so producers which can wait
+* do not have to go through the spool file or be dropped.
+*
+* @return true when the in-memory queue has room and nothing is spooled.
+*/
+bool buffer_has_room();
+
+bool buffer_is_empty();
+size_t buffer_depth();
+
+/**
+* @return the number of messages waiting in the queue of a channel.
+*/
+size_t buffer_channel_depth(const char *channel);
+size_t buffer_spooled_bytes();
+unsigned long buffer_dropped();
+
+/**
+* @return the number of messages which were queued in memory so far.
+*/
+uint64_t buffer_arrivals();
+
+/**
+* Tells up to where the queued messages are safe: written to the server, or kept
+* in the spool file. Messages which buffer_deinit() could not save stay unsafe.
+*
+* @return the arrival of the oldest message which is not safe, or buffer_arrivals()
+* when every message is.
+*/
+uint64_t buffer_oldest_unsaved();
+
+#endif /*buffer_h_*/
@@ -1,7 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
+#include <ctype.h>
 
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -11,6 +14,10 @@
 #include "ircmod.h"
 #include "input.h"
 #include "commands.h"
+#include "buffer.h"
+#include "listener.h"
+#include "line.h"
+#include "config.h"
 
 static bool com_help(char *arg);
 static bool com_exit(char *arg);
@@ -18,49 +25,457 @@ static bool com_join(char *arg);
 static bool com_list(char *arg);
 static bool com_channel(char *arg);
 static bool com_leave(char *arg);
+static bool com_queue(char *arg);
+static bool com_status(char *arg);
+static bool com_reload(char *arg);
+static void command_free(struct commands *command);
 
 struct commands commands[] = {
-     { "/help"      , com_help     , "displays this help"                  , false } , 
-     { "/exit"      , com_exit     , "quits the application"               , false } , 
-     { "/quit"      , com_exit     , "quits the application"               , false } , 
-     { "/join"      , com_join     , "joins a given channel"               , true  } , 
-     { "/list"      , com_list     , "lists all joined channels"           , false } , 
-     { "/channel"   , com_channel  , "switch to channel"                   , true  } , 
-     { "/leave"     , com_leave    , "leaves the current or given channel" , false } , 
-     { (char *)NULL , (void *)NULL , (char *)NULL                          , false }
+     { "/help"      , com_help     , "displays this help"                  , false , NULL         } , 
+     { "/exit"      , com_exit     , "quits the application"               , false , NULL         } , 
+     { "/quit"      , com_exit     , "quits the application"               , false , NULL         } , 
+     { "/join"      , com_join     , "joins a given channel"               , true  , NULL         } , 
+     { "/list"      , com_list     , "lists all joined channels"           , false , NULL         } , 
+     { "/channel"   , com_channel  , "switch to channel"                   , true  , NULL         } , 
+     { "/leave"     , com_leave    , "leaves the current or given channel" , false , NULL         } , 
+     { "/queue"     , com_queue    , "shows the outgoing queue"            , false , NULL         } , 
+     { "/status"    , com_status   , "shows the state of the connection"   , false , NULL         } , 
+     { "/reload"    , com_reload   , "reloads the config files"            , false , NULL         } , 
+     { (char *)NULL , (void *)NULL , (char *)NULL                          , false , (char *)NULL }
 };
 
+/* The control client the running command replies to; NULL for the terminal */
+static struct client *reply_client = NULL;
+static char reply_error[200];
+
+/** 
+* Prints a line of command output, either to the terminal or to the control client.
+* Empty lines are only printed on the terminal.
+*/
+static void command_reply(const char *format, ...)
+{
+    char line[LISTENER_BUFSIZE];
+    va_list args;
+
+    va_start(args, format);
+    (void) vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (reply_client != NULL)
+    {
+        if (strcmp(line, "\n") != 0) client_printf(reply_client, "%s", line);
+    }
+    else nsilent("%s", line);
+}
+
+/** 
+* Reports a failed command, either as a warning on the terminal or as an ERR reply to the control client.
+*/
+static void command_fail(const char *format, ...)
+{
+    char line[sizeof(reply_error)];
+    va_list args;
+
+    va_start(args, format);
+    (void) vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (reply_client != NULL) strncpy(reply_error, line, sizeof(reply_error) -1);
+    else warning("%s\n", line);
+}
+
+/* Every known command, sorted by name for help and completion */
+static struct commands **sorted = NULL;
+static int no_commands = 0;
+
+/* An open addressing hash of the same commands; its size is a power of two and at least twice the number of commands */
+static struct commands **hashed = NULL;
+static size_t hash_size = 0;
+
+/** 
+* Hashes a command name without its leading '/', using FNV-1a.
+*/
+static size_t command_hash(const char *name, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    size_t counter = 0;
+
+    for (counter = 0; counter < len; counter++)
+    {
+        hash ^= (unsigned char) name[counter];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int compare_commands(const void *a, const void *b)
+{
+    return strcmp( (*(struct commands * const *) a)->name, (*(struct commands * const *) b)->name);
+}
+
+/** 
+* Sorts the commands and rebuilds the hash. This only happens when commands
+* are registered, so lookups and completion never walk the whole table.
+* 
+* @return true on success, false when out of memory.
+*/
+static bool command_index()
+{
+    size_t new_size = COMMAND_HASH_MIN;
+    struct commands **new_hashed = NULL;
+    int counter = 0;
+
+    while (new_size < (size_t) no_commands * 2) new_size *= 2;
+    if ( (new_hashed = calloc(new_size, sizeof(*new_hashed) ) ) == NULL)
+    {
+        error("could not index the commands: out of memory\n");
+        return false;
+    }
+
+    qsort(sorted, no_commands, sizeof(*sorted), compare_commands);
+    for (counter = 0; counter < no_commands; counter++)
+    {
+        const char *name = sorted[counter]->name +1;
+        size_t slot = command_hash(name, strlen(name) ) & (new_size -1);
+
+        while (new_hashed[slot] != NULL) slot = (slot +1) & (new_size -1);
+        new_hashed[slot] = sorted[counter];
+    }
+
+    free(hashed);
+    hashed = new_hashed;
+    hash_size = new_size;
+    return true;
+}
+
+/** 
+* Indexes the built-in commands, on first use.
+* 
+* @return true on success, false when out of memory.
+*/
+static bool command_init()
+{
+    int counter = 0;
+
+    if (sorted != NULL) return true;
+
+    while (commands[no_commands].name) no_commands++;
+    if ( (sorted = malloc(no_commands * sizeof(*sorted) ) ) == NULL)
+    {
+        no_commands = 0;
+        error("could not index the commands: out of memory\n");
+        return false;
+    }
+    for (counter = 0; counter < no_commands; counter++) sorted[counter] = &commands[counter];
+
+    if (command_index() == false)
+    {
+        free(sorted);
+        sorted = NULL;
+        no_commands = 0;
+        return false;
+    }
+    return true;
+}
+
+/** 
+* Adds a command to the registry.
+* 
+* @return true on success, false when the name is taken or out of memory.
+*/
+static bool command_add(struct commands *command)
+{
+    struct commands **new_sorted = NULL;
+
+    if (command_init() == false) return false;
+    if (command_find(command->name, strlen(command->name) ) != NULL)
+    {
+        warning("command %s is already registered\n", command->name);
+        return false;
+    }
+
+    if ( (new_sorted = realloc(sorted, (no_commands +1) * sizeof(*sorted) ) ) == NULL)
+    {
+        error("could not register command %s: out of memory\n", command->name);
+        return false;
+    }
+    sorted = new_sorted;
+    sorted[no_commands++] = command;
+
+    return command_index();
+}
+
+/** 
+* Allocates a command which is registered at runtime; the name always starts with a '/'.
+*/
+static struct commands *command_new(const char *name, bool (*func)(char *), const char *doc, bool req_args, const char *plugin)
+{
+    struct commands *command = NULL;
+    size_t len = strlen(name);
+
+    if (*name == '/')
+    {
+        name++;
+        len--;
+    }
+
+    if (len == 0 || len >= COMMAND_MAX_NAMELEN || strpbrk(name, " \t\r\n") != NULL)
+    {
+        warning("invalid command name \"%s\"\n", name);
+        return NULL;
+    }
+
+    if ( (command = calloc(1, sizeof(*command) ) ) == NULL) return NULL;
+    if ( (command->name = malloc(len +2) ) != NULL)
+    {
+        command->name[0] = '/';
+        memcpy(&command->name[1], name, len +1);
+    }
+    command->doc = strdup( (doc != NULL) ? doc : "");
+    command->plugin = (plugin != NULL) ? strdup(plugin) : NULL;
+    command->func = func;
+    command->req_args = req_args;
+
+    if (command->name == NULL || command->doc == NULL || (plugin != NULL && command->plugin == NULL) )
+    {
+        command_free(command);
+        return NULL;
+    }
+    return command;
+}
+
+static void command_free(struct commands *command)
+{
+    free(command->name);
+    free(command->doc);
+    free(command->plugin);
+    free(command);
+}
+
+bool command_register(const char *name, bool (*func)(char *), const char *doc, bool req_args)
+{
+    struct commands *command = command_new(name, func, doc, req_args, NULL);
+
+    if (command == NULL) return false;
+    if (command_add(command) == false)
+    {
+        command_free(command);
+        return false;
+    }
+
+    debug("registered command %s\n", command->name);
+    return true;
+}
+
+bool command_register_plugin(const char *name, const char *doc, bool req_args, const char *plugin)
+{
+    struct commands *command = command_new(name, NULL, doc, req_args, plugin);
+
+    if (command == NULL) return false;
+    if (command_add(command) == false)
+    {
+        command_free(command);
+        return false;
+    }
+
+    debug("registered command %s of plugin %s\n", command->name, plugin);
+    return true;
+}
+
+void command_unregister_plugins()
+{
+    int counter = 0;
+    int kept = 0;
+
+    for (counter = 0; counter < no_commands; counter++)
+    {
+        if (sorted[counter]->plugin != NULL) command_free(sorted[counter]);
+        else sorted[kept++] = sorted[counter];
+    }
+
+    if (kept != no_commands)
+    {
+        no_commands = kept;
+        (void) command_index();
+    }
+}
+
+struct commands *command_find(const char *name, size_t len)
+{
+    size_t slot = 0;
+
+    if (command_init() == false) return NULL;
+
+    if (len > 0 && name[0] == '/')
+    {
+        name++;
+        len--;
+    }
+
+    for (slot = command_hash(name, len) & (hash_size -1); hashed[slot] != NULL; slot = (slot +1) & (hash_size -1) )
+    {
+        /* The names in the registry start with a '/' */
+        const char *command = hashed[slot]->name +1;
+        if (strncmp(name, command, len) == 0 && command[len] == '\0') return hashed[slot];
+    }
+    return NULL;
+}
+
+struct commands *command_next(const char *prefix, size_t len, int *state)
+{
+    if (command_init() == false) return NULL;
+
+    /* The first call looks up the first command with the prefix */
+    if (*state == 0)
+    {
+        int low = 0;
+        int high = no_commands;
+
+        while (low < high)
+        {
+            int middle = (low + high) / 2;
+            if (strncmp(sorted[middle]->name, prefix, len) < 0) low = middle +1;
+            else high = middle;
+        }
+        *state = low +1;
+    }
+
+    if (*state > no_commands || strncmp(sorted[*state -1]->name, prefix, len) != 0) return NULL;
+    return sorted[(*state)++ -1];
+}
+
+bool command_execute(struct commands *command, char *arguments)
+{
+    char reply[LISTENER_BUFSIZE];
+
+    if (command->plugin == NULL) return command->func(arguments);
+
+    /* A failing plugin command is reported, but does not stop irccmd like a failing built-in command */
+    if (execute_lua_command_plugin(command->plugin, command->name, arguments, reply, sizeof(reply) ) == false)
+    {
+        command_fail("%s: %s", command->name, (strlen(reply) > 0) ? reply : "failed");
+    }
+    else if (strlen(reply) > 0) command_reply("%s\n", reply);
+
+    return true;
+}
+
+void command_client_handler(struct client *client, char *line)
+{
+    struct commands *command = NULL;
+    struct line_tokens tokens;
+    char *arguments = NULL;
+    const char *name = NULL;
+    int name_len = 0;
+
+    tokenize_command(line, strlen(line), &tokens);
+    name = tokens.command.start;
+    name_len = tokens.command.len;
+    if (name_len > 0 && *name == '/')
+    {
+        name++;
+        name_len--;
+    }
+
+    /* The commands take terminated arguments; the line is only written to when white-space follows them */
+    if (tokens.args.len > 0)
+    {
+        arguments = (char *) tokens.args.start;
+        arguments[tokens.args.len] = '\0';
+    }
+
+    debug("control command /%.*s\n", name_len, name);
+    if ( (command = command_find(name, name_len) ) == NULL)
+    {
+        client_printf(client, "ERR unknown command /%.*s\n", name_len, name);
+        return;
+    }
+
+    if (command->req_args && arguments == NULL)
+    {
+        client_printf(client, "ERR %s requires an argument\n", command->name);
+        return;
+    }
+
+    reply_client = client;
+    memset(reply_error, '\0', sizeof(reply_error) );
+
+    if (command_execute(command, arguments) == false)
+    {
+        options.running = false;
+        error("error occured in %s\n", command->name);
+    }
+
+    if (strlen(reply_error) > 0) client_printf(client, "ERR %s\n", reply_error);
+    else client_printf(client, "OK\n");
+    reply_client = NULL;
+}
+
 /* Commands */
 static bool com_help(char *arg)
 {
-    int index = 0;
-    nsilent("This is the commands overview of %s\n\n", PROG_STRING);
+    struct commands *command = NULL;
+    int state = 0;
+    command_reply("This is the commands overview of %s\n\n", PROG_STRING);
     
-    while (commands[index].name)
+    while ( (command = command_next("", 0, &state) ) != NULL)
     {
-        nsilent("%s\t\t%s\n", commands[index].name, commands[index].doc);
-        index++;
+        command_reply("%s\t\t%s\n", command->name, command->doc);
     }
-    nsilent("\n");
+    command_reply("\n");
 
     return true;
 }
 
+static bool com_queue(char *arg)
+{
+    int counter = 0;
+
+    command_reply("queued %lu\n", (unsigned long) buffer_depth() );
+    for (counter = 0; counter < options.no_channels; counter++)
+    {
+        command_reply("queued %s %lu\n", options.channels[counter], (unsigned long) buffer_channel_depth(options.channels[counter]) );
+    }
+    command_reply("spooled_bytes %lu\n", (unsigned long) buffer_spooled_bytes() );
+    command_reply("dropped %lu\n", buffer_dropped() );
+    command_reply("\n");
+
+    return true;
+}
+
+static bool com_status(char *arg)
+{
+    command_reply("connected %d\n", (options.connected && is_irc_connected() ) ? 1 : 0);
+    command_reply("server %s:%d\n", options.server, options.port);
+    command_reply("nick %s\n", options.botname);
+    command_reply("channels %d\n", options.no_channels);
+    command_reply("current %s\n", options.channels[options.current_channel_id]);
+    command_reply("pings %llu\n", (unsigned long long) options.ping_count);
+
+    return com_queue(arg);
+}
+
 static bool com_exit(char *arg)
 {
     options.running = false;
     return true;
 }
 
+static bool com_reload(char *arg)
+{
+    options.reload = true;
+    return true;
+}
+
 static bool com_list(char *arg)
 {
     int counter = 0;
 
     for (counter = 0; counter < options.no_channels; counter++)
     {
-        nsilent("%s\n", options.channels[counter]);
+        command_reply("%s\n", options.channels[counter]);
     }
-    nsilent("\n");
+    command_reply("\n");
 
     return true;
 }
@@ -78,7 +493,7 @@ static bool com_channel(char *arg)
             return true;
         }
     }
-    warning("channel %s not found\n", arg);
+    command_fail("channel %s not found", arg);
 
     return true;
 }
@@ -104,7 +519,7 @@ static bool com_join(char *arg)
     {
         if (strncmp(options.channels[counter], channel, MAX_CHANNELS_NAMELEN) == 0)
         {
-            warning("Allready joined channel %s\n", channel);
+            command_fail("Allready joined channel %s", channel);
             return true;
         }
     }
@@ -115,10 +530,12 @@ static bool com_join(char *arg)
     {
         memset(options.channels[options.no_channels], '\0', MAX_CHANNELS_NAMELEN);
         memset(options.channelpasswords[options.no_channels], '\0', MAX_CHANNELS_NAMELEN);
+        options.channelweights[options.no_channels] = 0;
+        options.channelpriorities[options.no_channels] = 0;
     }
     else
     {
-        error("Channel list if full\n");
+        command_fail("Channel list if full");
         return true;
     }
 
@@ -130,7 +547,7 @@ static bool com_join(char *arg)
     /* Join the channel */
     if (join_irc_channel(options.channels[index], options.channelpasswords[index]) == false)
     {
-        warning("unable to join %s\n", options.channels[index]);
+        command_fail("unable to join %s", options.channels[index]);
         return true;
     }
     else
@@ -169,7 +586,7 @@ static bool com_leave(char *arg)
 
     if (options.no_channels == 1)
     {
-        error("Cannot close last channel!\n");
+        command_fail("Cannot close last channel!");
         return true;
     }
 
@@ -190,6 +607,8 @@ static bool com_leave(char *arg)
         /* Copy last channel to current channel position */
         strncpy(options.channels[cc_id], options.channels[lc_id], MAX_CHANNELS_NAMELEN);
         memset(options.channelpasswords[cc_id], '\0', MAX_CHANNELS_NAMELEN);
+        options.channelweights[cc_id] = options.channelweights[lc_id];
+        options.channelpriorities[cc_id] = options.channelpriorities[lc_id];
 
         if (strlen(options.channelpasswords[lc_id]) > 0)
         {
@@ -202,6 +621,8 @@ static bool com_leave(char *arg)
     debug("clearing last channel\n");
     memset(options.channels[options.no_channels -1], '\0', MAX_CHANNELS_NAMELEN);
     memset(options.channelpasswords[options.no_channels -1], '\0', MAX_CHANNELS_NAMELEN);
+    options.channelweights[options.no_channels -1] = 0;
+    options.channelpriorities[options.no_channels -1] = 0;
 
     debug("number of channels lowered to %d\n", options.no_channels);
     options.no_channels--;
@@ -1,6 +1,9 @@
 #ifndef commands_h_
 #define commands_h_
 
+#define COMMAND_HASH_MIN    (32)
+#define COMMAND_MAX_NAMELEN (50)
+
 /* Command definitions*/
 struct commands
 {
@@ -8,9 +11,77 @@ struct commands
     bool (*func)(char *);   /* Function to call to do the job. */
     char *doc;              /* Documentation for this function.  */
     bool req_args;          /* True if the commands expects arguments */
+    char *plugin;           /* The lua plugin which implements the command, NULL for others */
 };
 
 extern struct commands commands[];
 
+struct client;
+
+/** 
+* Finds a command by its name, with or without the leading '/'.
+* 
+* @param name the name, which does not need to be terminated.
+* @param len the length of the name.
+* @return the command, or NULL when it does not exist.
+*/
+struct commands *command_find(const char *name, size_t len);
+
+/** 
+* Iterates over the commands starting with a prefix, in alphabetical order.
+* 
+* @param prefix the prefix, including the '/'.
+* @param len the length of the prefix; 0 iterates over all commands.
+* @param state 0 on the first call; it is updated by every call.
+* @return the next command, or NULL when there are no more.
+*/
+struct commands *command_next(const char *prefix, size_t len, int *state);
+
+/** 
+* Registers a command which is implemented in C.
+* 
+* @param name the name, with or without the leading '/'.
+* @param func the function which executes the command; returning false stops irccmd.
+* @param doc the description shown by /help.
+* @param req_args true if the command requires arguments.
+* @return true on success, false when the name is invalid or already taken.
+*/
+bool command_register(const char *name, bool (*func)(char *), const char *doc, bool req_args);
+
+/** 
+* Registers a command which is implemented by a lua plugin.
+* 
+* @param name the name, with or without the leading '/'.
+* @param doc the description shown by /help.
+* @param req_args true if the command requires arguments.
+* @param plugin the path of the plugin.
+* @return true on success, false when the name is invalid or already taken.
+*/
+bool command_register_plugin(const char *name, const char *doc, bool req_args, const char *plugin);
+
+/** 
+* Removes the commands of all lua plugins, before the plugins are loaded again.
+*/
+void command_unregister_plugins();
+
+/** 
+* Executes a command, either its function or its lua plugin.
+* 
+* @param command the command.
+* @param arguments the arguments, or NULL.
+* @return false when a built-in command failed and irccmd should stop.
+*/
+bool command_execute(struct commands *command, char *arguments);
+
+/** 
+* Handles a line on the control socket. The line holds a command, with or without
+* the leading '/', and its arguments. The output of the command is send back to
+* the client, followed by a line "OK" or a line "ERR <reason>".
+* 
+* @param client the control client.
+* @param line the command line.
+*/
+void command_client_handler(struct client *client, char *line);
+
 #endif /*commands_h_*/
 
@@ -6,132 +6,462 @@
 
 #include "config.h"
 #include "configdefaults.h"
+#include "metrics.h"
+#include "commands.h"
+
+/**
+* The type of the value a setting expects.
+*/
+enum setting_types
+{
+    setting_bool,
+    setting_int,
+    setting_time,
+    setting_string,
+    setting_channels,
+    setting_stringlist,
+    setting_inputs,
+    setting_groups,
+};
+
+/**
+* Describes a single key of the settings table and where its value is stored.
+* For string lists, 'value' is the first element, 'len' the length of an element,
+* 'max' the number of elements and 'counter' the number of elements in use.
+*/
+struct setting
+{
+    const char *key;
+    enum setting_types type;
+    void *value;
+    size_t len;
+    int max;
+    int *counter;
+};
+
+static struct setting settings[] =
+{
+    { "silent"         , setting_bool      , &options.silent               , 0                    , 0            , NULL                    },
+    { "verbose"        , setting_bool      , &options.verbose              , 0                    , 0            , NULL                    },
+    { "debug"          , setting_bool      , &options.debug                , 0                    , 0            , NULL                    },
+    { "interactive"    , setting_bool      , &options.interactive          , 0                    , 0            , NULL                    },
+    { "showchannel"    , setting_bool      , &options.showchannel          , 0                    , 0            , NULL                    },
+    { "shownick"       , setting_bool      , &options.shownick             , 0                    , 0            , NULL                    },
+    { "showjoins"      , setting_bool      , &options.showjoins            , 0                    , 0            , NULL                    },
+    { "broadcast"      , setting_bool      , &options.broadcast            , 0                    , 0            , NULL                    },
+    { "plugins"        , setting_bool      , &options.enableplugins        , 0                    , 0            , NULL                    },
+    { "ssl"            , setting_bool      , &options.ssl                  , 0                    , 0            , NULL                    },
+    { "ssl_verify"     , setting_bool      , &options.ssl_verify           , 0                    , 0            , NULL                    },
+    { "port"           , setting_int       , &options.port                 , 0                    , 0            , NULL                    },
+    { "oflood"         , setting_int       , &options.output_flood_timeout , 0                    , 0            , NULL                    },
+    { "dedup"          , setting_int       , &options.dedup_window         , 0                    , 0            , NULL                    },
+    { "fragment"       , setting_int       , &options.fragment_size        , 0                    , 0            , NULL                    },
+    { "timeout"        , setting_time      , &options.connection_timeout   , 0                    , 0            , NULL                    },
+    { "queue_size"     , setting_int       , &options.queue_size           , 0                    , 0            , NULL                    },
+    { "dns_ttl"        , setting_int       , &options.dns_ttl              , 0                    , 0            , NULL                    },
+    { "metrics_port"   , setting_int       , &options.metrics_port         , 0                    , 0            , NULL                    },
+    { "server"         , setting_string    , options.server                , MAX_SERVER_NAMELEN   , 0            , NULL                    },
+    { "name"           , setting_string    , options.botname               , MAX_BOT_NAMELEN      , 0            , NULL                    },
+    { "serverpassword" , setting_string    , options.serverpassword        , MAX_PASSWD_LEN       , 0            , NULL                    },
+    { "spool"          , setting_string    , options.spoolfile             , MAX_PATH_LEN         , 0            , NULL                    },
+    { "socket"         , setting_string    , options.socketpath            , MAX_PATH_LEN         , 0            , NULL                    },
+    { "control"        , setting_string    , options.controlpath           , MAX_PATH_LEN         , 0            , NULL                    },
+    { "metrics_socket" , setting_string    , options.metricspath           , MAX_PATH_LEN         , 0            , NULL                    },
+    { "trace"          , setting_string    , options.tracefile             , MAX_PATH_LEN         , 0            , NULL                    },
+    { "record"         , setting_string    , options.recordfile            , MAX_PATH_LEN         , 0            , NULL                    },
+    { "follow"         , setting_string    , options.followfile            , MAX_PATH_LEN         , 0            , NULL                    },
+    { "follow_state"   , setting_string    , options.followstate           , MAX_PATH_LEN         , 0            , NULL                    },
+    { "receive_dir"    , setting_string    , options.receive_dir           , MAX_PATH_LEN         , 0            , NULL                    },
+    { "dcc_address"    , setting_string    , options.dcc_address           , MAX_SERVER_NAMELEN   , 0            , NULL                    },
+    { "ssl_session_file", setting_string   , options.ssl_session_file      , MAX_PATH_LEN         , 0            , NULL                    },
+    { "channels"       , setting_channels  , options.channels              , MAX_CHANNELS_NAMELEN , MAX_CHANNELS , &options.no_channels    },
+    { "plugin_path"    , setting_stringlist, options.pluginpaths           , MAX_PATH_LEN         , MAX_CHANNELS , &options.no_pluginpaths },
+    { "plugin"         , setting_stringlist, options.plugins               , MAX_CHANNELS_NAMELEN , MAX_CHANNELS , &options.no_plugins     },
+    { "inputs"         , setting_inputs    , options.inputs                , 0                    , MAX_INPUTS   , &options.no_inputs      },
+    { "groups"         , setting_groups    , options.groups                , 0                    , MAX_GROUPS   , &options.no_groups      },
+    { NULL             , setting_bool      , NULL                          , 0                    , 0            , NULL                    },
+};
 
 /** 
-* Evaluates a Lua expression and returns the string result. 
-* If an error occurs or the result is not string, def is returned. 
+* Copies the string on top of the Lua stack into dest.
 * 
-* @param L the lua_State in which the string resides.
-* @param expr the lua expression to retreive the string
-* @param def the default string should the State not contain the expression given
+* @param L the lua_State with the string on top.
+* @param path the key path of the value, used for error reporting.
+* @param dest the storage for the string.
+* @param len the size of the storage.
 * 
-* @return a pointer towards the asked string.
+* @return true on succes, false when the value is not a string.
 */
-static const char* lua_stringexpr(lua_State *L, const char *expr, const char *def)
+static bool lua_copystring(lua_State *L, const char *path, char *dest, size_t len)
 {
-    const char* r = (const char *) def;
-    char buf[256] = "";
+    if (lua_type(L, -1) != LUA_TSTRING)
+    {
+        error("%s: expected a string, got %s\n", path, lua_typename(L, lua_type(L, -1) ) );
+        return false;
+    }
+
+    if (strlen(lua_tostring(L, -1) ) >= len) warning("%s: too long; truncated to %lu characters\n", path, (unsigned long) len -1);
 
-    /* Assign the Lua expression to a Lua global variable. */
-    (void) snprintf(buf, 255, "evalExpr=%s", expr);
+    memset(dest, '\0', len);
+    strncpy(dest, lua_tostring(L, -1), len -1);
+    return true;
+}
 
-    if (luaL_dostring(L, buf) == 0)
+/** 
+* Reads the list of channel tables on top of the Lua stack.
+* Each channel has a name and optionally a password, a weight and a priority.
+* 
+* @param L the lua_State with the channel list on top.
+* @param path the key path of the list, used for error reporting.
+* 
+* @return the number of errors encountered.
+*/
+static int read_channels(lua_State *L, const char *path)
+{
+    int errors = 0;
+    int counter = 0;
+    int length = lua_objlen(L, -1);
+
+    if (length > MAX_CHANNELS)
     {
-        /* Get the value of the global varibable */
-        lua_getglobal(L, "evalExpr");
+        error("%s: only %d channels are supported, ignoring the rest\n", path, MAX_CHANNELS);
+        length = MAX_CHANNELS;
+        errors++;
+    }
 
-        if (lua_isstring(L, -1) == 1)
+    for (counter = 0; counter < length; counter++)
+    {
+        char keypath[strlen(path) +20];
+
+        lua_rawgeti(L, -1, counter +1);
+        (void) snprintf(keypath, sizeof(keypath), "%s[%d]", path, counter +1);
+
+        if (lua_type(L, -1) != LUA_TTABLE)
         {
-            r = lua_tostring(L, -1);
+            error("%s: expected a table, got %s\n", keypath, lua_typename(L, lua_type(L, -1) ) );
+            errors++;
         }
+        else
+        {
+            lua_getfield(L, -1, "name");
+            if (lua_copystring(L, keypath, options.channels[counter], MAX_CHANNELS_NAMELEN) == false) errors++;
+            lua_pop(L, 1);
 
-        /* remove lua_getglobal value */
+            memset(options.channelpasswords[counter], '\0', MAX_PASSWD_LEN);
+            lua_getfield(L, -1, "password");
+            if (lua_isnil(L, -1) == false)
+            {
+                if (lua_copystring(L, keypath, options.channelpasswords[counter], MAX_PASSWD_LEN) == false) errors++;
+            }
+            lua_pop(L, 1);
+
+            options.channelweights[counter] = 0;
+            lua_getfield(L, -1, "weight");
+            if (lua_isnil(L, -1) == false)
+            {
+                if (lua_type(L, -1) != LUA_TNUMBER || lua_tonumber(L, -1) < 1)
+                {
+                    error("%s: expected a weight of at least 1\n", keypath);
+                    errors++;
+                }
+                else options.channelweights[counter] = (int) lua_tonumber(L, -1);
+            }
+            lua_pop(L, 1);
+
+            options.channelpriorities[counter] = 0;
+            lua_getfield(L, -1, "priority");
+            if (lua_isnil(L, -1) == false)
+            {
+                if (lua_type(L, -1) != LUA_TNUMBER)
+                {
+                    error("%s: expected a priority\n", keypath);
+                    errors++;
+                }
+                else options.channelpriorities[counter] = (int) lua_tonumber(L, -1);
+            }
+            lua_pop(L, 1);
+
+            debug("fetching %s: %s\n", keypath, options.channels[counter]);
+        }
         lua_pop(L, 1);
     }
-    return r;
-}  
+
+    if (length > 0) options.no_channels = length;
+    return errors;
+}
 
 /** 
-* Evaluates a Lua expression and returns the number result. 
+* Reads the list of input tables on top of the Lua stack. Each input has a type,
+* being "fifo", "file", "unix" or "tcp", a path or a port, and optionally a channel.
 * 
-* @param L the lua_State in which the number resides.
-* @param expr the lua expression to retreive the number
-* @param out the result of the expression.
+* @param L the lua_State with the input list on top.
+* @param path the key path of the list, used for error reporting.
 * 
-* @return zero on succes, otherwise 1.
+* @return the number of errors encountered.
 */
-static int lua_numberexpr(lua_State *L, const char *expr, double *out)
+static int read_inputs(lua_State *L, const char *path)
 {
-    int ok = 0;
-    char buf[256] = "";
+    const char *types[] = { "fifo", "file", "unix", "tcp", NULL };
+    int errors = 0;
+    int counter = 0;
+    int length = lua_objlen(L, -1);
 
-    /* Assign the Lua expression to a Lua global variable. */
-    (void) snprintf(buf, 255, "evalExpr=%s", expr);
+    if (length > MAX_INPUTS)
+    {
+        error("%s: only %d inputs are supported, ignoring the rest\n", path, MAX_INPUTS);
+        length = MAX_INPUTS;
+        errors++;
+    }
 
-    if (luaL_dostring(L, buf) == 0)
+    options.no_inputs = 0;
+    for (counter = 0; counter < length; counter++)
     {
-        /* Get the value of the global varibable */
-        lua_getglobal(L, "evalExpr");
+        struct input_source *source = &options.inputs[options.no_inputs];
+        char keypath[strlen(path) +20];
+        char type[10] = "";
+        int type_counter = 0;
+        int source_errors = 0;
+
+        lua_rawgeti(L, -1, counter +1);
+        (void) snprintf(keypath, sizeof(keypath), "%s[%d]", path, counter +1);
+
+        if (lua_type(L, -1) != LUA_TTABLE)
+        {
+            error("%s: expected a table, got %s\n", keypath, lua_typename(L, lua_type(L, -1) ) );
+            lua_pop(L, 1);
+            errors++;
+            continue;
+        }
+
+        memset(source, 0, sizeof(*source) );
+        lua_getfield(L, -1, "type");
+        if (lua_copystring(L, keypath, type, sizeof(type) ) == false) source_errors++;
+        lua_pop(L, 1);
 
-        if (lua_isnumber(L, -1) == 1)
+        while (types[type_counter] != NULL && strcmp(types[type_counter], type) != 0) type_counter++;
+        if (types[type_counter] == NULL)
         {
-            *out = lua_tonumber(L, -1);
-            ok = 1;
+            if (source_errors == 0) error("%s: unknown type %s\n", keypath, type);
+            source_errors++;
         }
+        source->type = type_counter;
 
-        /* remove lua_getglobal value */
+        if (source->type == input_tcp)
+        {
+            lua_getfield(L, -1, "port");
+            if (lua_type(L, -1) != LUA_TNUMBER)
+            {
+                error("%s: expected a port\n", keypath);
+                source_errors++;
+            }
+            else source->port = (int) lua_tonumber(L, -1);
+        }
+        else
+        {
+            lua_getfield(L, -1, "path");
+            if (lua_copystring(L, keypath, source->path, MAX_PATH_LEN) == false) source_errors++;
+        }
         lua_pop(L, 1);
+
+        lua_getfield(L, -1, "channel");
+        if (lua_isnil(L, -1) == false)
+        {
+            if (lua_copystring(L, keypath, source->channel, MAX_CHANNELS_NAMELEN) == false) source_errors++;
+        }
+        lua_pop(L, 2);
+
+        if (source_errors == 0)
+        {
+            debug("fetching %s: %s %s\n", keypath, type, source->channel);
+            options.no_inputs++;
+        }
+        errors += source_errors;
     }
 
-    return ok;
+    return errors;
 }
 
 /** 
-* Evaluates a Lua expression and returns the int result. 
-* This uses lua_numberexpr underwater.
+* Reads the list of group tables on top of the Lua stack. Each group has a name
+* and a list of channels.
 * 
-* @param L the lua_State in which the int resides.
-* @param expr the lua expression to retreive the int
-* @param out the result of the expression
+* @param L the lua_State with the group list on top.
+* @param path the key path of the list, used for error reporting.
 * 
-* @return zero on succes, otherwise 1.
+* @return the number of errors encountered.
 */
-static int lua_intexpr(lua_State* L, const char* expr, int* out)
+static int read_groups(lua_State *L, const char *path)
 {
-    double d = 0;
-    int ok = lua_numberexpr(L, expr, &d);
+    int errors = 0;
+    int counter = 0;
+    int length = lua_objlen(L, -1);
 
-    if (ok == 1)
+    if (length > MAX_GROUPS)
     {
-        *out = (int) d;
+        error("%s: only %d groups are supported, ignoring the rest\n", path, MAX_GROUPS);
+        length = MAX_GROUPS;
+        errors++;
     }
 
-    return ok;
+    options.no_groups = 0;
+    for (counter = 0; counter < length; counter++)
+    {
+        struct channel_group *group = &options.groups[options.no_groups];
+        char keypath[strlen(path) +20];
+        int group_errors = 0;
+        int channel_counter = 0;
+        int channels = 0;
+
+        lua_rawgeti(L, -1, counter +1);
+        (void) snprintf(keypath, sizeof(keypath), "%s[%d]", path, counter +1);
+
+        if (lua_type(L, -1) != LUA_TTABLE)
+        {
+            error("%s: expected a table, got %s\n", keypath, lua_typename(L, lua_type(L, -1) ) );
+            lua_pop(L, 1);
+            errors++;
+            continue;
+        }
+
+        memset(group, 0, sizeof(*group) );
+        lua_getfield(L, -1, "name");
+        if (lua_copystring(L, keypath, group->name, MAX_CHANNELS_NAMELEN) == false) group_errors++;
+        lua_pop(L, 1);
+
+        lua_getfield(L, -1, "channels");
+        if (lua_type(L, -1) != LUA_TTABLE)
+        {
+            error("%s: expected a list of channels\n", keypath);
+            group_errors++;
+        }
+        else
+        {
+            channels = lua_objlen(L, -1);
+            if (channels > MAX_CHANNELS)
+            {
+                error("%s: only %d channels are supported, ignoring the rest\n", keypath, MAX_CHANNELS);
+                channels = MAX_CHANNELS;
+                group_errors++;
+            }
+
+            for (channel_counter = 0; channel_counter < channels; channel_counter++)
+            {
+                lua_rawgeti(L, -1, channel_counter +1);
+                if (lua_copystring(L, keypath, group->channels[group->no_channels], MAX_CHANNELS_NAMELEN) ) group->no_channels++;
+                else group_errors++;
+                lua_pop(L, 1);
+            }
+        }
+        lua_pop(L, 2);
+
+        if (group_errors == 0)
+        {
+            debug("fetching %s: %s with %d channels\n", keypath, group->name, group->no_channels);
+            options.no_groups++;
+        }
+        errors += group_errors;
+    }
+
+    return errors;
 }
 
 /** 
-* Evaluates a Lua expression and returns the bool result. 
-* If an error occurs or the result is not bool, def is returned. 
+* Appends the list of strings on top of the Lua stack to the given setting.
 * 
-* @param L the lua_State in which the bool resides.
-* @param expr the lua expression to retreive the bool
-* @param def the default bool should the State not contain the expression given
+* @param L the lua_State with the string list on top.
+* @param path the key path of the list, used for error reporting.
+* @param setting the setting the strings are appended to.
 * 
-* @return the bool retreived from lua via the expression
+* @return the number of errors encountered.
 */
-static bool lua_boolexpr(lua_State* L, const char* expr, bool def)
+static int read_stringlist(lua_State *L, const char *path, struct setting *setting)
 {
-    bool ok = def;
-    char buf[256] = "";
+    int errors = 0;
+    int counter = 0;
+    int length = lua_objlen(L, -1);
 
-    /* Assign the Lua expression to a Lua global variable. */
-    (void) snprintf(buf, 255, "evalExpr=%s", expr);
-
-    if (luaL_dostring(L, buf) == 0)
+    for (counter = 0; counter < length; counter++)
     {
-        /* Get the value of the global varibable */
-        lua_getglobal(L, "evalExpr");
+        char keypath[strlen(path) +20];
+        char *dest = ( (char *) setting->value) + (*setting->counter * setting->len);
 
-        if (lua_isboolean(L, -1) == true)
+        (void) snprintf(keypath, sizeof(keypath), "%s[%d]", path, counter +1);
+        if (*setting->counter >= setting->max)
         {
-            ok = (bool) lua_toboolean(L, -1);
+            error("%s: only %d entries are supported, ignoring the rest\n", keypath, setting->max);
+            errors++;
+            break;
         }
 
-        /* remove lua_getglobal value */
+        lua_rawgeti(L, -1, counter +1);
+        if (lua_copystring(L, keypath, dest, setting->len) )
+        {
+            (*setting->counter)++;
+            debug("fetching %s: %s\n", keypath, dest);
+        }
+        else errors++;
         lua_pop(L, 1);
     }
 
-    return ok;
+    return errors;
+}
+
+/** 
+* Stores the value on top of the Lua stack in the given setting.
+* 
+* @param L the lua_State with the value on top.
+* @param path the key path of the value, used for error reporting.
+* @param setting the setting the value belongs to.
+* 
+* @return the number of errors encountered.
+*/
+static int read_setting(lua_State *L, const char *path, struct setting *setting)
+{
+    int type = lua_type(L, -1);
+
+    switch (setting->type)
+    {
+        case setting_bool:
+            if (type != LUA_TBOOLEAN) break;
+
+            /* silent, verbose and debug given on the commandline cannot be turned off */
+            if ( (setting->value == &options.silent || setting->value == &options.verbose || setting->value == &options.debug) 
+                 && *( (bool *) setting->value) ) return 0;
+            *( (bool *) setting->value) = (bool) lua_toboolean(L, -1);
+            return 0;
+
+        case setting_int:
+            if (type != LUA_TNUMBER) break;
+            *( (int *) setting->value) = (int) lua_tonumber(L, -1);
+            return 0;
+
+        case setting_time:
+            if (type != LUA_TNUMBER) break;
+            *( (time_t *) setting->value) = (time_t) lua_tonumber(L, -1);
+            return 0;
+
+        case setting_string:
+            return (lua_copystring(L, path, setting->value, setting->len) ) ? 0 : 1;
+
+        case setting_channels:
+            if (type != LUA_TTABLE) break;
+            return read_channels(L, path);
+
+        case setting_stringlist:
+            if (type != LUA_TTABLE) break;
+            return read_stringlist(L, path, setting);
+
+        case setting_inputs:
+            if (type != LUA_TTABLE) break;
+            return read_inputs(L, path);
+
+        case setting_groups:
+            if (type != LUA_TTABLE) break;
+            return read_groups(L, path);
+    }
+
+    error("%s: unexpected %s\n", path, lua_typename(L, type) );
+    return 1;
 }
 
 /** 
@@ -210,6 +540,9 @@ static lua_State *conf_open(const char *file)
 /** 
 * This reads the default config file, or the system default if the first is not found.
 * When either is read, the application settings are read from file or their defaults are used.
+*
+* The settings table is walked once; unknown keys and values of the wrong type
+* are reported with their key path.
 * 
 * @return returns 0 on succes or 1 on failure.
 */
@@ -220,87 +553,59 @@ int read_config_file(const char *path)
     
     if (L != NULL)
     {
-        int counter = 0;
-        const char *str = NULL;
-        char *basestr = "settings.channels[%d].%s";
-        char *namestr = "name";
-        char *passwdstr = "password";
+        int errors = 0;
 
         verbose("found the config file %s\n", path);
 
-        if (!options.silent)  options.silent    = lua_boolexpr(L , "settings.silent"         , options.silent);
-        if (!options.verbose) options.verbose   = lua_boolexpr(L , "settings.verbose"        , options.verbose);
-        if (!options.debug)   options.debug     = lua_boolexpr(L , "settings.debug"          , options.debug);
-
-        options.interactive                 = lua_boolexpr(L     , "settings.interactive"    , options.interactive);
-        options.showchannel                 = lua_boolexpr(L     , "settings.showchannel"    , options.showchannel);
-        options.shownick                    = lua_boolexpr(L     , "settings.shownick"       , options.shownick);
-        options.showjoins                   = lua_boolexpr(L     , "settings.showjoins"      , options.showjoins);
-        options.enableplugins               = lua_boolexpr(L     , "settings.plugins"        , options.enableplugins);
-        (void) lua_intexpr(L                                     , "settings.port"           , &options.port);
-        (void) lua_intexpr(L                                     , "settings.oflood"         , &options.output_flood_timeout);
-        (void) lua_intexpr(L                                     , "settings.timeout"        , (int *) &options.connection_timeout);
-        strncpy(options.serverpassword      , lua_stringexpr(L   , "settings.serverpassword" , options.serverpassword) , MAX_PASSWD_LEN);
-
-        if ( (str = (const char *) lua_stringexpr(L, "settings.server",          options.server)  )        != options.server)         strncpy(options.server,         str, MAX_SERVER_NAMELEN);
-        if ( (str = (const char *) lua_stringexpr(L, "settings.name",            options.botname) )        != options.botname)        strncpy(options.botname,        str, MAX_BOT_NAMELEN);
-        if ( (str = (const char *) lua_stringexpr(L, "settings.serverpassword" , options.serverpassword) ) != options.serverpassword) strncpy(options.serverpassword, str, MAX_PASSWD_LEN);
-
-        options.botname[MAX_BOT_NAMELEN -1] = '\0';
-
-        /*channels and channel passwords*/
-        for (counter = 0; counter < MAX_CHANNELS; counter++)
+        lua_getglobal(L, "settings");
+        if (lua_type(L, -1) == LUA_TTABLE)
         {
-            char name_buff[strlen(basestr) + strlen(namestr) +2];
-            char passwd_buff[strlen(basestr) + strlen(passwdstr) +2];
-
-            (void) snprintf(name_buff, sizeof(name_buff) -1, basestr, counter +1, namestr);
-            (void) snprintf(passwd_buff, sizeof(passwd_buff) -1, basestr, counter +1, passwdstr);
-
-            if ( (str = (const char *) lua_stringexpr(L, name_buff,   options.channels[counter]) )         != options.channels[counter])         strncpy(options.channels[counter],         str, MAX_CHANNELS_NAMELEN);
-            if ( (str = (const char *) lua_stringexpr(L, passwd_buff, options.channelpasswords[counter]) ) != options.channelpasswords[counter]) strncpy(options.channelpasswords[counter], str, MAX_PASSWD_LEN);
-
-            if (strlen(options.channels[counter]) == 0) counter = MAX_CHANNELS;
-            else
+            lua_pushnil(L);
+            while (lua_next(L, -2) != 0)
             {
-                options.no_channels = counter +1;
-                debug("fetching %s: %s\n", name_buff, options.channels[counter]);
-                debug("fetching %s: %s\n", passwd_buff, options.channelpasswords[counter]);
+                /* key at -2, value at -1 */
+                if (lua_type(L, -2) != LUA_TSTRING)
+                {
+                    error("%s: settings contains a key which is not a name\n", path);
+                    errors++;
+                }
+                else
+                {
+                    const char *key = lua_tostring(L, -2);
+                    char keypath[strlen(key) +10];
+                    int counter = 0;
+
+                    (void) snprintf(keypath, sizeof(keypath), "settings.%s", key);
+                    for (counter = 0; settings[counter].key != NULL; counter++)
+                    {
+                        if (strcmp(settings[counter].key, key) == 0) break;
+                    }
+
+                    if (settings[counter].key != NULL) errors += read_setting(L, keypath, &settings[counter]);
+                    else
+                    {
+                        error("%s: unknown setting %s\n", path, keypath);
+                        errors++;
+                    }
+                }
+
+                /* remove the value, keep the key for the next iteration */
+                lua_pop(L, 1);
             }
         }
-
-        debug("creating plugin paths\n");
-        /* plugin paths */
-        basestr = "settings.plugin_path[%d]";
-        for (counter = options.no_pluginpaths; counter < MAX_CHANNELS; counter++)
+        else if (lua_isnil(L, -1) == false)
         {
-            char pluginpath[strlen(basestr) +10];
-            (void) snprintf(pluginpath, sizeof(pluginpath) -1, basestr, counter +1);
-            if ( (str = (const char *) lua_stringexpr(L, pluginpath, options.pluginpaths[counter]) ) != options.pluginpaths[counter]) strncpy(options.pluginpaths[counter], str, MAX_PATH_LEN);
-
-            if (strlen(options.pluginpaths[counter]) == 0) counter = MAX_CHANNELS;
-            else
-            {
-                options.no_pluginpaths = counter +1;
-                debug("fetching %s: %s\n", pluginpath, options.pluginpaths[counter]);
-            }
+            error("%s: settings: expected a table, got %s\n", path, lua_typename(L, lua_type(L, -1) ) );
+            errors++;
         }
+        lua_pop(L, 1);
 
-        debug("creating plugins\n");
-        /* plugins */
-        basestr = "settings.plugin[%d]";
-        for (counter = options.no_plugins; counter < MAX_CHANNELS; counter++)
-        {
-            char plugin[strlen(basestr) +10];
-            (void) snprintf(plugin, sizeof(plugin) -1, basestr, counter +1);
-            if ( ( str = (const char *) lua_stringexpr(L, plugin, options.plugins[counter]) ) != options.plugins[counter]) strncpy(options.plugins[counter], str, MAX_CHANNELS_NAMELEN);
+        options.botname[MAX_BOT_NAMELEN -1] = '\0';
 
-            if (strlen(options.plugins[counter]) == 0) counter = MAX_CHANNELS;
-            else
-            {
-                options.no_plugins = counter +1;
-                debug("fetching %s: %s\n", plugin, options.plugins[counter]);
-            }
+        if (errors > 0)
+        {
+            error("%d errors in config file %s\n", errors, path);
+            errorcode = 1;
         }
 
         debug("number of channels to join: %d\n", options.no_channels);
@@ -346,34 +651,142 @@ static char *execute_lua_string_plugin(const char *file, char *string)
     return retstr;
 }
 
+/** 
+* Looks up a plugin in the plugin paths.
+* 
+* @param name the name of the plugin, without '.lua'.
+* @param path receives the path of the plugin.
+* @param size the size of path.
+* @return true when the plugin exists.
+*/
+static bool find_plugin(const char *name, char *path, size_t size)
+{
+    int pathcounter;
+
+    for (pathcounter = 0; pathcounter < options.no_pluginpaths; pathcounter++)
+    {
+        struct stat sts;
+
+        (void) snprintf(path, size, "%s/%s.lua", options.pluginpaths[pathcounter], name);
+        debug("testing: %s\n", path);
+        if (!(stat(path, &sts) == -1 && errno == ENOENT)) return true;
+    }
+    return false;
+}
+
 char *execute_str_plugins(char *string)
 {
     int plugincounter;
-    int pathcounter;
     char *retstr = string;
 
     if (options.enableplugins)
     {
         for (plugincounter = 0; plugincounter < options.no_plugins; plugincounter++)
         {
-            char *basestr = "%s/%s.lua";
-            for (pathcounter = 0; pathcounter < options.no_pluginpaths; pathcounter++)
-            {
-                char plugin[strlen(options.pluginpaths[pathcounter]) + strlen(options.plugins[plugincounter]) +strlen(basestr) +2];
-                (void) snprintf(plugin, sizeof(plugin) -1, basestr, options.pluginpaths[pathcounter], options.plugins[plugincounter]);
+            char plugin[MAX_PATH_LEN + MAX_CHANNELS_NAMELEN +6];
 
-                debug("testing: %s\n", plugin);
-                struct stat sts;
-                if (!(stat(plugin, &sts) == -1 && errno == ENOENT))
-                {
-                    /*plugin file exists*/
-                    retstr = execute_lua_string_plugin(plugin, retstr);
-                    pathcounter = options.no_pluginpaths;
-                }
+            if (find_plugin(options.plugins[plugincounter], plugin, sizeof(plugin) ) )
+            {
+                /*plugin file exists*/
+                uint64_t start = metrics_now();
+                retstr = execute_lua_string_plugin(plugin, retstr);
+                metric_plugin(options.plugins[plugincounter], metrics_now() - start);
             }
         }
     }
     return retstr;
 }
 
+/** 
+* Registers the commands a plugin offers in its table plugin_commands, for example
+* plugin_commands = { { name = "/crc", doc = "shows the crc of a packet", args = true } }.
+* 
+* @param L the lua_State of the plugin.
+* @param file the path of the plugin.
+*/
+static void register_lua_commands(lua_State *L, const char *file)
+{
+    int counter = 0;
+
+    lua_getglobal(L, "plugin_commands");
+    if (lua_istable(L, -1) == 0)
+    {
+        lua_pop(L, 1);
+        return;
+    }
+
+    for (counter = 1; ; counter++)
+    {
+        lua_rawgeti(L, -1, counter);
+        if (lua_istable(L, -1) == 0)
+        {
+            lua_pop(L, 1);
+            break;
+        }
+
+        lua_getfield(L, -1, "name");
+        lua_getfield(L, -2, "doc");
+        lua_getfield(L, -3, "args");
+        if (lua_isstring(L, -3) ) (void) command_register_plugin(lua_tostring(L, -3), lua_tostring(L, -2), lua_toboolean(L, -1), file);
+        else warning("%s: command %d has no name\n", file, counter);
+        lua_pop(L, 4);
+    }
+    lua_pop(L, 1);
+}
+
+void register_plugin_commands()
+{
+    int plugincounter;
+
+    command_unregister_plugins();
+    if (options.enableplugins == false) return;
+
+    for (plugincounter = 0; plugincounter < options.no_plugins; plugincounter++)
+    {
+        char plugin[MAX_PATH_LEN + MAX_CHANNELS_NAMELEN +6];
+        lua_State *L = NULL;
+
+        if (find_plugin(options.plugins[plugincounter], plugin, sizeof(plugin) ) == false) continue;
+        if ( (L = luaL_newstate() ) == NULL) continue;
+
+        luaL_openlibs(L);
+        if (luaL_dofile(L, plugin) == 0) register_lua_commands(L, plugin);
+        else warning("could not load plugin %s: %s\n", plugin, lua_tostring(L, -1) );
+        lua_close(L);
+    }
+}
+
+bool execute_lua_command_plugin(const char *file, const char *name, const char *arguments, char *reply, size_t size)
+{
+    lua_State *L = luaL_newstate();
+    bool success = false;
+
+    reply[0] = '\0';
+    if (L == NULL) return false;
 
+    debug("giving %s the command %s %s\n", file, name, (arguments != NULL) ? arguments : "");
+    luaL_openlibs(L);
+    if (luaL_dofile(L, file) != 0)
+    {
+        (void) snprintf(reply, size, "%s", lua_tostring(L, -1) );
+        lua_close(L);
+        return false;
+    }
+
+    /* plugin_command_exec(name, arguments) returns the text to print, or false and a reason */
+    lua_getglobal(L, "plugin_command_exec");
+    lua_pushstring(L, name);
+    if (arguments != NULL) lua_pushstring(L, arguments);
+    else lua_pushnil(L);
+
+    if (lua_pcall(L, 2, 2, 0) != 0) (void) snprintf(reply, size, "%s", lua_tostring(L, -1) );
+    else
+    {
+        success = (lua_isboolean(L, -2) == 0 || lua_toboolean(L, -2) != 0);
+        if (lua_isstring(L, -2) ) (void) snprintf(reply, size, "%s", lua_tostring(L, -2) );
+        else if (success == false && lua_isstring(L, -1) ) (void) snprintf(reply, size, "%s", lua_tostring(L, -1) );
+    }
+
+    lua_close(L);
+    return success;
+}
@@ -21,4 +21,21 @@
 int read_config_file(const char *path);
 char *execute_str_plugins(char *string);
 
+/** 
+* Registers the commands of the enabled plugins, replacing those registered before.
+*/
+void register_plugin_commands();
+
+/** 
+* Executes a command of a lua plugin, through its function plugin_command_exec.
+* 
+* @param file the path of the plugin.
+* @param name the name of the command, including the '/'.
+* @param arguments the arguments, or NULL.
+* @param reply receives the text the plugin returned, or the reason it failed.
+* @param size the size of reply.
+* @return true on success, false when the plugin failed.
+*/
+bool execute_lua_command_plugin(const char *file, const char *name, const char *arguments, char *reply, size_t size);
+
 #endif /* config_h_ */
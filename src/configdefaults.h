@@ -19,11 +19,16 @@
 #define CONFIG_SHOWCHANNEL  false
 #define CONFIG_SHOWNICK     false
 #define CONFIG_SHOWJOINS    false
+#define CONFIG_BROADCAST    false
 
 #define CONFIG_KEEPREADING  false
+#define CONFIG_INPUT_FORMAT format_line
 
 #define CONFIG_MODE     both
 #define CONFIG_PORT     6667
+#define CONFIG_SSL      false
+#define CONFIG_SSL_VERIFY true
+#define CONFIG_SSL_SESSION_FILE ""
 #define CONFIG_SERVER   "irc.incas3.nl"
 #define CONFIG_BOTNAME  "omega"
 #define CONFIG_CHANNEL  "#spam"
@@ -33,6 +38,27 @@
 #define CONFIG_MAXLINES  0
 
 #define CONFIG_CONNECTION_TIMEOUT 200
+#define CONFIG_DNS_TTL 300
 #define CONFIG_OUTGOING_FLOOD_TIMEOUT 0
+#define CONFIG_DEDUP_WINDOW 0
+#define CONFIG_FRAGMENT_SIZE 0
+
+#define CONFIG_QUEUE_SIZE 256
+#define CONFIG_SPOOLFILE ""
+
+#define CONFIG_SOCKET "/tmp/irccmd.sock"
+#define CONFIG_CONTROL ""
+
+#define CONFIG_METRICS_PORT 0
+#define CONFIG_METRICS_SOCKET ""
+
+#define CONFIG_TRACEFILE ""
+#define CONFIG_RECORDFILE ""
+
+#define CONFIG_FOLLOWFILE ""
+#define CONFIG_FOLLOWSTATE ""
+
+#define CONFIG_RECEIVE_DIR ""
+#define CONFIG_DCC_ADDRESS ""
 
 #endif /* configdefaults_h_ */
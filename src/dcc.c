@@ -0,0 +1,736 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "main.h"
+#include "ircmod.h"
+#include "metrics.h"
+#include "dcc.h"
+
+enum dcc_states
+{
+    dcc_free,
+    dcc_offered,        /* waiting for the receiver to connect */
+    dcc_authenticating, /* waiting for the token of the receiver */
+    dcc_sending,
+    dcc_finishing,      /* all data is written; waiting for the receiver to confirm it */
+    dcc_resuming,       /* waiting for the sender to accept our resume */
+    dcc_connecting,
+    dcc_receiving,
+};
+
+/**
+* A file which is send or received over a direct connection.
+*/
+struct dcc_transfer
+{
+    enum dcc_states state;
+    bool sending;
+    char nick[MAX_NICK_LEN];
+    char name[DCC_NAMELEN];             /* the name of the file in the negotiation */
+    char path[MAX_PATH_LEN];
+    int listen_fd;
+    int fd;
+    int file_fd;
+    int pipe_fds[2];                    /* splice() moves the received data through a pipe */
+    struct in_addr address;
+    int port;
+    unsigned long long size;
+    unsigned long long offset;
+    unsigned long long start;           /* the offset the transfer was resumed at */
+    uint32_t ack;                       /* the acknowledgement which is being read */
+    uint32_t acked;                     /* the last complete acknowledgement */
+    unsigned int ack_len;
+    char token[DCC_TOKEN_LEN +1];
+    char token_read[DCC_TOKEN_LEN];     /* the token which is being read from a receiver */
+    unsigned int token_len;
+    time_t last_activity;
+    uint64_t started;                   /* usec */
+};
+
+static struct dcc_transfer transfers[DCC_MAX_TRANSFERS];
+static int failures = 0;
+
+/**
+* Takes a free transfer.
+*
+* @return the transfer, or NULL when all transfers are in use.
+*/
+static struct dcc_transfer *transfer_take(enum dcc_states state)
+{
+    int counter = 0;
+
+    for (counter = 0; counter < DCC_MAX_TRANSFERS; counter++)
+    {
+        struct dcc_transfer *transfer = &transfers[counter];
+
+        if (transfer->state == dcc_free)
+        {
+            memset(transfer, 0, sizeof(*transfer) );
+            transfer->state = state;
+            transfer->listen_fd = -1;
+            transfer->fd = -1;
+            transfer->file_fd = -1;
+            transfer->pipe_fds[0] = -1;
+            transfer->pipe_fds[1] = -1;
+            transfer->last_activity = time(NULL);
+            return transfer;
+        }
+    }
+    return NULL;
+}
+
+static void transfer_close(struct dcc_transfer *transfer)
+{
+    if (transfer->listen_fd >= 0) close(transfer->listen_fd);
+    if (transfer->fd >= 0) close(transfer->fd);
+    if (transfer->file_fd >= 0) close(transfer->file_fd);
+    if (transfer->pipe_fds[0] >= 0) close(transfer->pipe_fds[0]);
+    if (transfer->pipe_fds[1] >= 0) close(transfer->pipe_fds[1]);
+    memset(transfer, 0, sizeof(*transfer) );
+}
+
+static void transfer_fail(struct dcc_transfer *transfer, const char *reason)
+{
+    error("%s %s %s %s failed after %llu of %llu bytes: %s\n", (transfer->sending) ? "sending" : "receiving", transfer->name,
+            (transfer->sending) ? "to" : "from", transfer->nick, transfer->offset, transfer->size, reason);
+    failures++;
+    transfer_close(transfer);
+}
+
+static void transfer_done(struct dcc_transfer *transfer)
+{
+    unsigned long long bytes = transfer->offset - transfer->start;
+    double elapsed = (metrics_now() - transfer->started) / 1000000.0;
+
+    verbose("%s %s %s %s: %llu bytes in %.3f seconds (%.1f MB/s)\n", (transfer->sending) ? "sent" : "received", transfer->name,
+            (transfer->sending) ? "to" : "from", transfer->nick, bytes, elapsed, (elapsed > 0.0) ? bytes / elapsed / 1000000.0 : 0.0);
+    transfer_close(transfer);
+}
+
+/**
+* Makes a file name which is safe to offer, or to create in the receive directory:
+* only the last part of the path, without spaces, control characters or a leading dot.
+*/
+static void dcc_name(char *name, const char *path)
+{
+    const char *base = strrchr(path, '/');
+    size_t counter = 0;
+
+    base = (base != NULL) ? base +1 : path;
+    strncpy(name, base, DCC_NAMELEN -1);
+    name[DCC_NAMELEN -1] = '\0';
+
+    for (counter = 0; name[counter] != '\0'; counter++)
+    {
+        if ( (unsigned char) name[counter] <= ' ' || name[counter] == 0x7f) name[counter] = '_';
+    }
+    if (name[0] == '.') name[0] = '_';
+    if (name[0] == '\0') strcpy(name, "file");
+}
+
+bool dcc_send_file(const char *nick, const char *path)
+{
+    struct dcc_transfer *transfer = transfer_take(dcc_offered);
+    unsigned char random[DCC_TOKEN_LEN /2];
+    struct stat st;
+    int fd = -1;
+    int counter = 0;
+
+    if (transfer == NULL)
+    {
+        error("too many DCC transfers; cannot send %s\n", path);
+        return false;
+    }
+
+    transfer->sending = true;
+    strncpy(transfer->nick, nick, MAX_NICK_LEN -1);
+    strncpy(transfer->path, path, MAX_PATH_LEN -1);
+    dcc_name(transfer->name, path);
+
+    if ( (transfer->file_fd = open(path, O_RDONLY) ) < 0 || fstat(transfer->file_fd, &st) != 0)
+    {
+        error("cannot read %s: %s\n", path, strerror(errno) );
+        transfer_close(transfer);
+        return false;
+    }
+    if (S_ISREG(st.st_mode) == 0)
+    {
+        error("cannot send %s: not a regular file\n", path);
+        transfer_close(transfer);
+        return false;
+    }
+    transfer->size = st.st_size;
+
+    if ( (fd = open("/dev/urandom", O_RDONLY) ) < 0 || read(fd, random, sizeof(random) ) != (ssize_t) sizeof(random) )
+    {
+        error("cannot make a token for the offer of %s: %s\n", path, strerror(errno) );
+        if (fd >= 0) close(fd);
+        transfer_close(transfer);
+        return false;
+    }
+    close(fd);
+    for (counter = 0; counter < (int) sizeof(random); counter++) (void) sprintf(&transfer->token[counter *2], "%02x", random[counter]);
+
+    verbose("offering %s (%llu bytes) to %s\n", transfer->name, transfer->size, transfer->nick);
+    return true;
+}
+
+/**
+* Listens for the receiver on the address which is offered; the port is picked by
+* the kernel. An address which is not ours, like the public address of a NAT, is
+* forwarded to us, so then every address is listened on.
+*/
+static bool send_listen(struct dcc_transfer *transfer, struct in_addr address)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    memset(&addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr = address;
+    addr.sin_port = 0;
+
+    if ( (transfer->listen_fd = socket(AF_INET, SOCK_STREAM, 0) ) < 0) return false;
+    if (bind(transfer->listen_fd, (struct sockaddr *) &addr, sizeof(addr) ) != 0)
+    {
+        if (errno != EADDRNOTAVAIL) return false;
+
+        debug("%s is not a local address; listening on all addresses for %s\n", inet_ntoa(address), transfer->name);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (bind(transfer->listen_fd, (struct sockaddr *) &addr, sizeof(addr) ) != 0) return false;
+    }
+    if (listen(transfer->listen_fd, 1) != 0 || getsockname(transfer->listen_fd, (struct sockaddr *) &addr, &len) != 0) return false;
+
+    (void) fcntl(transfer->listen_fd, F_SETFL, O_NONBLOCK);
+    transfer->port = ntohs(addr.sin_port);
+    return true;
+}
+
+void dcc_offer()
+{
+    struct in_addr address;
+    int counter = 0;
+
+    for (counter = 0; counter < DCC_MAX_TRANSFERS; counter++)
+    {
+        struct dcc_transfer *transfer = &transfers[counter];
+
+        if (transfer->state != dcc_offered) continue;
+
+        if (strlen(options.dcc_address) > 0)
+        {
+            if (inet_pton(AF_INET, options.dcc_address, &address) != 1)
+            {
+                transfer_fail(transfer, "dcc_address is not an IPv4 address");
+                continue;
+            }
+        }
+        else if (irc_local_address(&address) == false)
+        {
+            transfer_fail(transfer, "the irc connection is not over IPv4; set dcc_address");
+            continue;
+        }
+
+        if (transfer->listen_fd < 0 && send_listen(transfer, address) == false)
+        {
+            transfer_fail(transfer, strerror(errno) );
+            continue;
+        }
+
+        if (irc_send_ctcp(transfer->nick, DCC_CTCP " SEND %s %lu %d %llu %s", transfer->name, (unsigned long) ntohl(address.s_addr), transfer->port,
+                    transfer->size, transfer->token) == 0)
+        {
+            debug("offered %s to %s on port %d\n", transfer->name, transfer->nick, transfer->port);
+            transfer->last_activity = time(NULL);
+        }
+    }
+}
+
+/**
+* Finds the transfer of a nick in the given state, by the port it is offered on.
+*/
+static struct dcc_transfer *transfer_find(const char *nick, int port, enum dcc_states state)
+{
+    int counter = 0;
+
+    for (counter = 0; counter < DCC_MAX_TRANSFERS; counter++)
+    {
+        struct dcc_transfer *transfer = &transfers[counter];
+
+        if (transfer->state == state && transfer->port == port && strcasecmp(transfer->nick, nick) == 0) return transfer;
+    }
+    return NULL;
+}
+
+static void receive_connect(struct dcc_transfer *transfer)
+{
+    struct sockaddr_in addr;
+
+    if ( (transfer->file_fd = open(transfer->path, O_WRONLY | O_CREAT | ( (transfer->offset == 0) ? O_TRUNC : 0), 0644) ) < 0)
+    {
+        transfer_fail(transfer, strerror(errno) );
+        return;
+    }
+    if (pipe(transfer->pipe_fds) != 0)
+    {
+        transfer_fail(transfer, strerror(errno) );
+        return;
+    }
+    /* A larger pipe lets a single splice() take more of the socket buffer */
+    (void) fcntl(transfer->pipe_fds[1], F_SETPIPE_SZ, DCC_CHUNK);
+
+    memset(&addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr = transfer->address;
+    addr.sin_port = htons(transfer->port);
+
+    if ( (transfer->fd = socket(AF_INET, SOCK_STREAM, 0) ) < 0)
+    {
+        transfer_fail(transfer, strerror(errno) );
+        return;
+    }
+    (void) fcntl(transfer->fd, F_SETFL, O_NONBLOCK);
+    if (connect(transfer->fd, (struct sockaddr *) &addr, sizeof(addr) ) != 0 && errno != EINPROGRESS)
+    {
+        transfer_fail(transfer, strerror(errno) );
+        return;
+    }
+
+    transfer->state = dcc_connecting;
+    transfer->start = transfer->offset;
+    transfer->last_activity = time(NULL);
+    verbose("receiving %s (%llu bytes) from %s into %s\n", transfer->name, transfer->size, transfer->nick, transfer->path);
+}
+
+/**
+* Accepts an offer into options.receive_dir. A smaller file of the same name is resumed,
+* and a file of the same size is resumed at its end, so the sender is done at once. A
+* larger file is another file, and the offer is ignored.
+*/
+static void receive_offer(const char *nick, const char *name, unsigned long address, int port, unsigned long long size, const char *token)
+{
+    struct dcc_transfer *transfer = NULL;
+    char safe_name[DCC_NAMELEN];
+    char path[MAX_PATH_LEN];
+    struct stat st;
+    bool exists = false;
+
+    if (strlen(options.receive_dir) == 0)
+    {
+        verbose("%s offers %s; set a receive directory to accept it\n", nick, name);
+        return;
+    }
+    if (address == 0 || port <= 0 || port > 65535 || strlen(token) != DCC_TOKEN_LEN)
+    {
+        warning("invalid DCC offer of %s from %s\n", name, nick);
+        return;
+    }
+
+    dcc_name(safe_name, name);
+    if (snprintf(path, sizeof(path), "%s/%s", options.receive_dir, safe_name) >= (int) sizeof(path) )
+    {
+        warning("the path of %s is too long; refusing it\n", safe_name);
+        return;
+    }
+
+    exists = (stat(path, &st) == 0);
+    if (exists && (unsigned long long) st.st_size > size)
+    {
+        warning("%s is larger than the offer of %s; ignoring it\n", path, nick);
+        return;
+    }
+
+    if ( (transfer = transfer_take(dcc_connecting) ) == NULL)
+    {
+        warning("too many DCC transfers; refusing %s from %s\n", name, nick);
+        return;
+    }
+    strncpy(transfer->nick, nick, MAX_NICK_LEN -1);
+    strncpy(transfer->name, name, DCC_NAMELEN -1);
+    strncpy(transfer->path, path, MAX_PATH_LEN -1);
+    strncpy(transfer->token, token, DCC_TOKEN_LEN);
+    transfer->address.s_addr = htonl(address);
+    transfer->port = port;
+    transfer->size = size;
+
+    if (exists && st.st_size > 0)
+    {
+        transfer->offset = st.st_size;
+        transfer->state = dcc_resuming;
+        verbose("asking %s to resume %s at %llu bytes\n", nick, name, transfer->offset);
+        (void) irc_send_ctcp(nick, DCC_CTCP " RESUME %s %d %llu", name, port, transfer->offset);
+        return;
+    }
+    receive_connect(transfer);
+}
+
+bool dcc_request(const char *nick, const char *request)
+{
+    struct dcc_transfer *transfer = NULL;
+    char name[DCC_NAMELEN];
+    char token[DCC_TOKEN_LEN +2];
+    unsigned long address = 0;
+    unsigned long long value = 0;
+    size_t prefix = strlen(DCC_CTCP);
+    int port = 0;
+
+    if (strncmp(request, DCC_CTCP, prefix) != 0 || request[prefix] != ' ') return false;
+    request += prefix +1;
+
+    /* The widths match DCC_NAMELEN and DCC_TOKEN_LEN; a longer token is refused */
+    if (sscanf(request, "SEND %255s %lu %d %llu %33s", name, &address, &port, &value, token) == 5)
+    {
+        receive_offer(nick, name, address, port, value, token);
+    }
+    else if (sscanf(request, "RESUME %255s %d %llu", name, &port, &value) == 3)
+    {
+        if ( (transfer = transfer_find(nick, port, dcc_offered) ) == NULL || value > transfer->size)
+        {
+            warning("%s asks to resume %s, which is not offered\n", nick, name);
+            return true;
+        }
+
+        verbose("resuming %s for %s at %llu bytes\n", transfer->name, nick, value);
+        transfer->offset = value;
+        transfer->start = value;
+        transfer->last_activity = time(NULL);
+        (void) irc_send_ctcp(nick, DCC_CTCP " ACCEPT %s %d %llu", name, port, value);
+    }
+    else if (sscanf(request, "ACCEPT %255s %d %llu", name, &port, &value) == 3)
+    {
+        if ( (transfer = transfer_find(nick, port, dcc_resuming) ) == NULL)
+        {
+            warning("%s accepts a resume of %s which was not asked for\n", nick, name);
+        }
+        else if (value != transfer->offset) transfer_fail(transfer, "the sender resumes at another offset");
+        else receive_connect(transfer);
+    }
+    else warning("unknown DCC request from %s: %s\n", nick, request);
+
+    return true;
+}
+
+static void send_accept(struct dcc_transfer *transfer)
+{
+    int fd = accept(transfer->listen_fd, NULL, NULL);
+
+    if (fd < 0)
+    {
+        if (errno != EAGAIN && errno != EINTR) transfer_fail(transfer, strerror(errno) );
+        return;
+    }
+    (void) fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    transfer->fd = fd;
+    transfer->token_len = 0;
+    transfer->state = dcc_authenticating;
+}
+
+/**
+* Reads the token of the receiver which connected. Someone else is disconnected,
+* and the offer waits for the receiver again.
+*/
+static void send_authenticate(struct dcc_transfer *transfer)
+{
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    ssize_t result = read(transfer->fd, &transfer->token_read[transfer->token_len], DCC_TOKEN_LEN - transfer->token_len);
+
+    if (result < 0 && (errno == EAGAIN || errno == EINTR) ) return;
+    if (result > 0) transfer->token_len += result;
+    if (result > 0 && transfer->token_len < DCC_TOKEN_LEN) return;
+
+    if (result <= 0 || memcmp(transfer->token_read, transfer->token, DCC_TOKEN_LEN) != 0)
+    {
+        if (getpeername(transfer->fd, (struct sockaddr *) &peer, &len) != 0) peer.sin_addr.s_addr = 0;
+        warning("refused a connection from %s for %s, which did not send the token of the offer\n", inet_ntoa(peer.sin_addr), transfer->name);
+        close(transfer->fd);
+        transfer->fd = -1;
+        transfer->state = dcc_offered;
+        return;
+    }
+
+    /* The offer is for a single receiver */
+    close(transfer->listen_fd);
+    transfer->listen_fd = -1;
+
+    transfer->state = dcc_sending;
+    transfer->started = metrics_now();
+    transfer->last_activity = time(NULL);
+    verbose("sending %s to %s from byte %llu\n", transfer->name, transfer->nick, transfer->offset);
+}
+
+static void send_data(struct dcc_transfer *transfer)
+{
+    off_t offset = transfer->offset;
+    size_t len = (transfer->size - transfer->offset < DCC_CHUNK) ? transfer->size - transfer->offset : DCC_CHUNK;
+    ssize_t sent = 0;
+
+    if (len > 0)
+    {
+        if ( (sent = sendfile(transfer->fd, transfer->file_fd, &offset, len) ) < 0)
+        {
+            if (errno != EAGAIN && errno != EINTR) transfer_fail(transfer, strerror(errno) );
+            return;
+        }
+        if (sent == 0)
+        {
+            transfer_fail(transfer, "the file was truncated");
+            return;
+        }
+    }
+
+    transfer->offset = offset;
+    transfer->last_activity = time(NULL);
+    metric_add(metric_dcc_bytes_sent, sent);
+
+    if (transfer->offset == transfer->size)
+    {
+        /* The receiver closes the connection, or acknowledges the last byte, once it has everything */
+        (void) shutdown(transfer->fd, SHUT_WR);
+        transfer->state = dcc_finishing;
+    }
+}
+
+/**
+* Reads the acknowledgements of the receiver: the number of bytes it has, 32 bits in network order.
+*
+* @return false when the transfer has ended.
+*/
+static bool send_acks(struct dcc_transfer *transfer)
+{
+    unsigned char buf[64];
+    ssize_t len = read(transfer->fd, buf, sizeof(buf) );
+    ssize_t counter = 0;
+
+    if (len < 0)
+    {
+        if (errno == EAGAIN || errno == EINTR) return true;
+        transfer_fail(transfer, strerror(errno) );
+        return false;
+    }
+    if (len == 0)
+    {
+        if (transfer->offset == transfer->size) transfer_done(transfer);
+        else transfer_fail(transfer, "the receiver closed the connection");
+        return false;
+    }
+
+    for (counter = 0; counter < len; counter++)
+    {
+        transfer->ack = (transfer->ack << 8) | buf[counter];
+        if (++transfer->ack_len % 4 == 0) transfer->acked = transfer->ack;
+    }
+
+    if (transfer->state == dcc_finishing && transfer->ack_len >= 4 && transfer->acked == (uint32_t) transfer->size)
+    {
+        transfer_done(transfer);
+        return false;
+    }
+    return true;
+}
+
+static void receive_connected(struct dcc_transfer *transfer)
+{
+    socklen_t len = sizeof(int);
+    int result = 0;
+
+    if (getsockopt(transfer->fd, SOL_SOCKET, SO_ERROR, &result, &len) != 0) result = errno;
+    if (result != 0)
+    {
+        transfer_fail(transfer, strerror(result) );
+        return;
+    }
+
+    /* The token is the first thing on a new connection, so it always fits in the socket buffer */
+    if (write(transfer->fd, transfer->token, DCC_TOKEN_LEN) != DCC_TOKEN_LEN)
+    {
+        transfer_fail(transfer, "cannot send the token of the offer");
+        return;
+    }
+
+    transfer->state = dcc_receiving;
+    transfer->started = metrics_now();
+    transfer->last_activity = time(NULL);
+    debug("connected to %s for %s\n", transfer->nick, transfer->name);
+
+    if (transfer->offset == transfer->size) transfer_done(transfer);
+}
+
+static void receive_data(struct dcc_transfer *transfer)
+{
+    loff_t offset = transfer->offset;
+    size_t len = (transfer->size - transfer->offset < DCC_CHUNK) ? transfer->size - transfer->offset : DCC_CHUNK;
+    ssize_t moved = 0;
+    uint32_t ack = 0;
+
+    /* splice() only moves data to or from a pipe: from the socket into the pipe, then on into the file */
+    if ( (moved = splice(transfer->fd, NULL, transfer->pipe_fds[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK) ) < 0)
+    {
+        if (errno != EAGAIN && errno != EINTR) transfer_fail(transfer, strerror(errno) );
+        return;
+    }
+    if (moved == 0)
+    {
+        transfer_fail(transfer, "the sender closed the connection");
+        return;
+    }
+
+    while (moved > 0)
+    {
+        ssize_t written = splice(transfer->pipe_fds[0], NULL, transfer->file_fd, &offset, moved, SPLICE_F_MOVE);
+
+        if (written <= 0)
+        {
+            transfer_fail(transfer, (written < 0) ? strerror(errno) : "cannot write the file");
+            return;
+        }
+        moved -= written;
+    }
+
+    metric_add(metric_dcc_bytes_received, offset - transfer->offset);
+    transfer->offset = offset;
+    transfer->last_activity = time(NULL);
+
+    ack = htonl( (uint32_t) transfer->offset);
+    if (send(transfer->fd, &ack, sizeof(ack), MSG_NOSIGNAL) != sizeof(ack) ) debug("could not acknowledge %llu bytes of %s\n", transfer->offset, transfer->name);
+
+    if (transfer->offset == transfer->size) transfer_done(transfer);
+}
+
+void dcc_add_descriptors(fd_set *in_set, fd_set *out_set, int *maxfd)
+{
+    int counter = 0;
+
+    for (counter = 0; counter < DCC_MAX_TRANSFERS; counter++)
+    {
+        struct dcc_transfer *transfer = &transfers[counter];
+        int fd = -1;
+
+        switch (transfer->state)
+        {
+            case dcc_offered:
+                if ( (fd = transfer->listen_fd) >= 0) FD_SET(fd, in_set);
+                break;
+            case dcc_authenticating:
+                fd = transfer->fd;
+                FD_SET(fd, in_set);
+                break;
+            case dcc_sending:
+                fd = transfer->fd;
+                FD_SET(fd, in_set);
+                FD_SET(fd, out_set);
+                break;
+            case dcc_finishing:
+            case dcc_receiving:
+                fd = transfer->fd;
+                FD_SET(fd, in_set);
+                break;
+            case dcc_connecting:
+                fd = transfer->fd;
+                FD_SET(fd, out_set);
+                break;
+            default:
+                break;
+        }
+
+        if (fd > *maxfd) *maxfd = fd;
+    }
+}
+
+void dcc_process(fd_set *in_set, fd_set *out_set)
+{
+    int counter = 0;
+
+    for (counter = 0; counter < DCC_MAX_TRANSFERS; counter++)
+    {
+        struct dcc_transfer *transfer = &transfers[counter];
+
+        switch (transfer->state)
+        {
+            case dcc_offered:
+                if (transfer->listen_fd >= 0 && FD_ISSET(transfer->listen_fd, in_set) ) send_accept(transfer);
+                break;
+            case dcc_authenticating:
+                if (FD_ISSET(transfer->fd, in_set) ) send_authenticate(transfer);
+                break;
+            case dcc_sending:
+                if (FD_ISSET(transfer->fd, in_set) && send_acks(transfer) == false) break;
+                if (FD_ISSET(transfer->fd, out_set) ) send_data(transfer);
+                break;
+            case dcc_finishing:
+                if (FD_ISSET(transfer->fd, in_set) ) (void) send_acks(transfer);
+                break;
+            case dcc_connecting:
+                if (FD_ISSET(transfer->fd, out_set) ) receive_connected(transfer);
+                break;
+            case dcc_receiving:
+                if (FD_ISSET(transfer->fd, in_set) ) receive_data(transfer);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void dcc_expire()
+{
+    time_t now = time(NULL);
+    int counter = 0;
+
+    for (counter = 0; counter < DCC_MAX_TRANSFERS; counter++)
+    {
+        struct dcc_transfer *transfer = &transfers[counter];
+
+        if (transfer->state == dcc_free || (now - transfer->last_activity) <= DCC_TIMEOUT_SECS) continue;
+
+        /* An offer can only be taken while we are connected; it is made again after a reconnect */
+        if (transfer->state == dcc_offered && is_irc_connected() == false) continue;
+
+        transfer_fail(transfer, (transfer->state == dcc_offered || transfer->state == dcc_authenticating || transfer->state == dcc_resuming) ? "no answer" : "no progress");
+    }
+}
+
+bool dcc_is_busy()
+{
+    int counter = 0;
+
+    for (counter = 0; counter < DCC_MAX_TRANSFERS; counter++)
+    {
+        if (transfers[counter].state != dcc_free) return true;
+    }
+    return false;
+}
+
+int dcc_failures()
+{
+    return failures;
+}
+
+void dcc_close_all()
+{
+    int counter = 0;
+
+    for (counter = 0; counter < DCC_MAX_TRANSFERS; counter++)
+    {
+        struct dcc_transfer *transfer = &transfers[counter];
+
+        if (transfer->state == dcc_free) continue;
+
+        warning("stopping the transfer of %s after %llu of %llu bytes\n", transfer->name, transfer->offset, transfer->size);
+        transfer_close(transfer);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef dcc_h_
+#define dcc_h_
+
+#include <stdbool.h>
+#include <sys/select.h>
+
+#define DCC_CTCP            "IRCCMD"        /* the CTCP request which carries the DCC negotiation */
+#define DCC_MAX_TRANSFERS   (8)
+#define DCC_NAMELEN         (256)
+#define DCC_CHUNK           (1024 * 1024)   /* the bytes moved by a single sendfile or splice */
+#define DCC_TIMEOUT_SECS    (120)
+#define DCC_TOKEN_LEN       (32)            /* hex digits of the token which proves a receiver was offered the file */
+
+/**
+* Offers a file to a nick. The file is send over a direct TCP connection once the
+* nick connects to us; the offer is made, or made again, by dcc_offer().
+*
+* The port only listens on the offered address. Anyone may connect to it, so the
+* offer carries a random token, and only a receiver which sends it first gets the file.
+*
+* A receiver which already has a part of the file asks to resume it, and only the
+* rest is send. The data is moved from the file to the socket with sendfile(), so
+* the transfer is bound by the network and not by the flood limits of the server.
+*
+* @param nick the receiver.
+* @param path the file.
+* @return false when the file cannot be read.
+*/
+bool dcc_send_file(const char *nick, const char *path);
+
+/**
+* Sends the offers of the files which are waiting for their receiver, and listens
+* for them on the offered address. Called once we are connected to the server.
+*/
+void dcc_offer();
+
+/**
+* Handles a DCC request of another irccmd: an offer, which is accepted into
+* options.receive_dir when that is set, a request to resume, or its acceptance.
+* The received data is moved from the socket to the file with splice().
+*
+* @param nick the sender of the request.
+* @param request the text of the CTCP request.
+* @return false when the request is not a DCC request.
+*/
+bool dcc_request(const char *nick, const char *request);
+
+void dcc_add_descriptors(fd_set *in_set, fd_set *out_set, int *maxfd);
+void dcc_process(fd_set *in_set, fd_set *out_set);
+
+/**
+* Drops the transfers which have not made progress within DCC_TIMEOUT_SECS.
+*/
+void dcc_expire();
+
+/**
+* @return true while a transfer is offered or in progress.
+*/
+bool dcc_is_busy();
+
+/**
+* @return the number of transfers which have failed.
+*/
+int dcc_failures();
+
+/**
+* Stops all transfers; a partial file is kept, so it can be resumed.
+*/
+void dcc_close_all();
+
+#endif /*dcc_h_*/
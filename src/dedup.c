@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "main.h"
+#include "input.h"
+#include "metrics.h"
+#include "dedup.h"
+
+/**
+* A message which was send recently, and the number of copies which were suppressed since.
+*/
+struct dedup_entry
+{
+    uint64_t hash;
+    uint64_t first;                     /* usec; 0 for a free slot */
+    size_t len;
+    unsigned long repeats;
+    char text[DEDUP_SUMMARY_LEN];       /* the start of the message, for the summary */
+};
+
+/**
+* The slots of a channel. They are found by the name of the channel, since its id
+* changes when a channel is left or the configuration is reloaded.
+*/
+struct dedup_channel
+{
+    char name[MAX_CHANNELS_NAMELEN];    /* empty while no slot is taken */
+    size_t used;
+    struct dedup_entry slots[DEDUP_SLOTS];
+};
+
+static struct dedup_channel channels[MAX_CHANNELS];
+static size_t used = 0;                 /* slots which are not free */
+static uint64_t next_expiry = 0;        /* usec; the earliest end of a window with repeats */
+
+static uint64_t hash_message(const char *msg, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    size_t counter = 0;
+
+    for (counter = 0; counter < len; counter++)
+    {
+        hash ^= (unsigned char) msg[counter];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t window_usec()
+{
+    return (uint64_t) options.dedup_window * 1000;
+}
+
+static bool is_our_channel(const char *name)
+{
+    int channel_id = 0;
+
+    for (channel_id = 0; channel_id < options.no_channels; channel_id++)
+    {
+        if (strcasecmp(options.channels[channel_id], name) == 0) return true;
+    }
+    return false;
+}
+
+/**
+* Frees a slot, submitting the summary of its repeats when there are any. The summary
+* is not send to a channel which has been left since.
+*/
+static void expire(struct dedup_channel *channel, struct dedup_entry *entry)
+{
+    if (entry->repeats > 0)
+    {
+        char summary[DEDUP_SUMMARY_LEN +40];
+        size_t text_len = (entry->len < DEDUP_SUMMARY_LEN) ? entry->len : DEDUP_SUMMARY_LEN;
+        int len = snprintf(summary, sizeof(summary), "%.*s%s (repeated %lu time%s)",
+                            (int) text_len, entry->text, (entry->len > text_len) ? "..." : "", entry->repeats, (entry->repeats == 1) ? "" : "s");
+
+        debug("%s: suppressed %lu repeats of %.*s\n", channel->name, entry->repeats, (int) text_len, entry->text);
+        if (is_our_channel(channel->name) ) submit_summary(channel->name, summary, (len < (int) sizeof(summary) ) ? (size_t) len : sizeof(summary) -1);
+        else debug("%s has been left; dropping the summary\n", channel->name);
+    }
+
+    memset(entry, 0, sizeof(*entry) );
+    used--;
+    if (--channel->used == 0) memset(channel->name, '\0', sizeof(channel->name) );
+}
+
+/**
+* @return the slots of the channel; a channel without slots takes free ones, or
+*         those of a channel which has been left. NULL when there are none.
+*/
+static struct dedup_channel *find_channel(const char *name)
+{
+    struct dedup_channel *free_channel = NULL;
+    struct dedup_channel *left_channel = NULL;
+    int counter = 0;
+
+    for (counter = 0; counter < MAX_CHANNELS; counter++)
+    {
+        struct dedup_channel *channel = &channels[counter];
+
+        if (channel->used == 0)
+        {
+            if (free_channel == NULL) free_channel = channel;
+        }
+        else if (strcasecmp(channel->name, name) == 0) return channel;
+        else if (left_channel == NULL && is_our_channel(channel->name) == false) left_channel = channel;
+    }
+
+    if (free_channel == NULL && left_channel != NULL)
+    {
+        for (counter = 0; counter < DEDUP_SLOTS; counter++)
+        {
+            if (left_channel->slots[counter].first != 0) expire(left_channel, &left_channel->slots[counter]);
+        }
+        free_channel = left_channel;
+    }
+
+    if (free_channel != NULL) strncpy(free_channel->name, name, sizeof(free_channel->name) -1);
+    return free_channel;
+}
+
+bool dedup_check(const char *name, const char *msg, size_t len)
+{
+    struct dedup_channel *channel = NULL;
+    struct dedup_entry *slot = NULL;
+    uint64_t hash = hash_message(msg, len);
+    uint64_t now = metrics_now();
+    size_t text_len = (len < DEDUP_SUMMARY_LEN) ? len : DEDUP_SUMMARY_LEN;
+    int probe = 0;
+
+    if (options.dedup_window <= 0 || (channel = find_channel(name) ) == NULL) return true;
+
+    for (probe = 0; probe < DEDUP_PROBES; probe++)
+    {
+        struct dedup_entry *entry = &channel->slots[(hash + probe) & (DEDUP_SLOTS -1)];
+
+        if (entry->first != 0 && now - entry->first >= window_usec() ) expire(channel, entry);
+
+        /* A free slot is taken over the oldest live one */
+        if (entry->first == 0)
+        {
+            if (slot == NULL || slot->first != 0) slot = entry;
+        }
+        else if (entry->hash == hash && entry->len == len && memcmp(entry->text, msg, text_len) == 0)
+        {
+            if (entry->repeats++ == 0 && (next_expiry == 0 || entry->first + window_usec() < next_expiry) )
+            {
+                next_expiry = entry->first + window_usec();
+            }
+            return false;
+        }
+        else if (slot == NULL || (slot->first != 0 && entry->first < slot->first) ) slot = entry;
+    }
+
+    /* All slots are taken by live windows; the oldest one is summarised early */
+    if (slot->first != 0) expire(channel, slot);
+
+    /* The channel may have given up its last slot above */
+    if (channel->used == 0) strncpy(channel->name, name, sizeof(channel->name) -1);
+
+    slot->hash = hash;
+    slot->first = now;
+    slot->len = len;
+    slot->repeats = 0;
+    memcpy(slot->text, msg, text_len);
+    channel->used++;
+    used++;
+    return true;
+}
+
+void dedup_flush(bool all)
+{
+    uint64_t now = 0;
+    int row = 0;
+    int counter = 0;
+
+    if (used == 0 || (all == false && (next_expiry == 0 || metrics_now() < next_expiry) ) ) return;
+
+    now = metrics_now();
+    next_expiry = 0;
+    for (row = 0; row < MAX_CHANNELS; row++)
+    {
+        for (counter = 0; counter < DEDUP_SLOTS; counter++)
+        {
+            struct dedup_entry *entry = &channels[row].slots[counter];
+
+            if (entry->first == 0) continue;
+            if (all || now - entry->first >= window_usec() ) expire(&channels[row], entry);
+            else if (entry->repeats > 0 && (next_expiry == 0 || entry->first + window_usec() < next_expiry) )
+            {
+                next_expiry = entry->first + window_usec();
+            }
+        }
+    }
+}
+
+void dedup_select_timeout(struct timeval *tv)
+{
+    uint64_t now = 0;
+    uint64_t wait = 0;
+
+    if (next_expiry == 0) return;
+
+    now = metrics_now();
+    if (next_expiry > now) wait = next_expiry - now;
+    if ( ( (uint64_t) tv->tv_sec * 1000000ULL) + tv->tv_usec > wait)
+    {
+        tv->tv_sec = wait / 1000000;
+        tv->tv_usec = wait % 1000000;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef dedup_h_
+#define dedup_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+#define DEDUP_SLOTS         (128)   /* per channel, a power of two */
+#define DEDUP_PROBES        (8)
+#define DEDUP_SUMMARY_LEN   (80)
+
+/**
+* Tells whether a message should be send, or is a repeat which is suppressed.
+*
+* The first copy of a message is send. Identical messages to the same channel within
+* options.dedup_window msec of it are only counted; once the window has passed, a
+* single "<message> (repeated N times)" summary is submitted in their place, which runs
+* through the plugins like any other message. Every channel has a fixed number of slots;
+* when they are taken, the oldest one is summarised early.
+*
+* @param channel the name of the channel the message is meant for.
+* @param msg the message; it does not have to be terminated.
+* @param len the length of the message.
+* @return true when the message should be send, false when it is suppressed.
+*/
+bool dedup_check(const char *channel, const char *msg, size_t len);
+
+/**
+* Submits the summaries of the windows which have passed.
+*
+* @param all true to summarise all windows now, like when the input has ended.
+*/
+void dedup_flush(bool all);
+
+/**
+* Lowers the given select timeout to the end of the first window which has a summary pending.
+*
+* @param tv the timeout which will be handed to select.
+*/
+void dedup_select_timeout(struct timeval *tv);
+
+#endif /*dedup_h_*/
@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "def.h"
+#include "main.h"
+#include "listener.h"
+#include "input.h"
+#include "buffer.h"
+#include "follow.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+static int fd = -1;                 /* The followed file; -1 while it does not exist */
+static int notify_fd = -1;
+static int file_watch = -1;
+static int dir_watch = -1;
+static char path[MAX_PATH_LEN];
+static char statepath[MAX_PATH_LEN + sizeof(FOLLOW_STATE_SUFFIX)];
+static const char *name = NULL;     /* The name of the file within its directory */
+
+static ino_t inode = 0;
+static dev_t device = 0;
+static off_t offset = 0;            /* Of the first byte which was not handed on yet */
+static char buf[LISTENER_BUFSIZE];
+static size_t len = 0;
+
+/**
+* The offset the lines before it were handed on at, and the number of messages
+* which were queued by then.
+*/
+struct follow_mark
+{
+    uint64_t arrivals;
+    off_t offset;
+};
+
+static struct follow_mark marks[FOLLOW_MARKS];
+static int first_mark = 0;
+static int no_marks = 0;
+static off_t safe_offset = 0;       /* Of the first byte whose messages may still be lost */
+
+static ino_t saved_inode = 0;
+static off_t saved_offset = -1;
+static time_t saved = 0;
+static bool save_failed = false;
+
+/**
+* Forgets the lines which were handed on; the file is read from offset.
+*/
+static void reset_marks()
+{
+    first_mark = 0;
+    no_marks = 0;
+    safe_offset = offset;
+}
+
+/**
+* Remembers up to where the file was handed on. When all marks are in use, the
+* last one is moved on; it only becomes safe a little later.
+*/
+static void add_mark()
+{
+    struct follow_mark *mark = NULL;
+
+    if (no_marks == FOLLOW_MARKS) mark = &marks[(first_mark + no_marks -1) % FOLLOW_MARKS];
+    else mark = &marks[(first_mark + no_marks++) % FOLLOW_MARKS];
+
+    mark->arrivals = buffer_arrivals();
+    mark->offset = offset;
+}
+
+/**
+* Moves the safe offset past the lines whose messages were all written to the
+* server or spooled. A message which went to the spool file directly is safe at once.
+*/
+static void update_safe_offset()
+{
+    uint64_t oldest = buffer_oldest_unsaved();
+
+    while (no_marks > 0 && marks[first_mark].arrivals <= oldest)
+    {
+        safe_offset = marks[first_mark].offset;
+        first_mark = (first_mark +1) % FOLLOW_MARKS;
+        no_marks--;
+    }
+}
+
+/**
+* Writes the safe offset and the inode of the file to the state file. The state is
+* written to a temporary file first, so a crash never leaves half a state behind.
+*
+* @param force true to write it now, false to write it at most every FOLLOW_CHECKPOINT_SECS.
+*/
+static void checkpoint(bool force)
+{
+    char tmppath[sizeof(statepath) +4];
+    time_t now = time(NULL);
+    FILE *fp = NULL;
+    bool success = false;
+
+    if (fd < 0) return;
+    update_safe_offset();
+    if (safe_offset == saved_offset && inode == saved_inode) return;
+    if (force == false && (now - saved) < FOLLOW_CHECKPOINT_SECS) return;
+
+    (void) snprintf(tmppath, sizeof(tmppath), "%s.new", statepath);
+    if ( (fp = fopen(tmppath, "w") ) != NULL)
+    {
+        success = (fprintf(fp, "%lu %lu %lld\n", (unsigned long) inode, (unsigned long) device, (long long) safe_offset) > 0);
+        if (fclose(fp) != 0) success = false;
+        if (success && rename(tmppath, statepath) != 0) success = false;
+    }
+
+    if (success == false)
+    {
+        if (save_failed == false) warning("could not write the offset of %s to %s: %s\n", path, statepath, strerror(errno) );
+        save_failed = true;
+        return;
+    }
+
+    save_failed = false;
+    saved_inode = inode;
+    saved_offset = safe_offset;
+    saved = now;
+}
+
+/**
+* Sets the offset to resume at from the state file. A checkpoint of another inode
+* means the file was rotated while irccmd was not running; the new file is read
+* from its start. Without a checkpoint, the file is followed from its end.
+*/
+static void load_state(const struct stat *sts)
+{
+    unsigned long state_inode = 0;
+    unsigned long state_device = 0;
+    long long state_offset = 0;
+    FILE *fp = fopen(statepath, "r");
+
+    offset = sts->st_size;
+    if (fp == NULL)
+    {
+        verbose("no checkpoint in %s; following %s from its end\n", statepath, path);
+        return;
+    }
+
+    if (fscanf(fp, "%lu %lu %lld", &state_inode, &state_device, &state_offset) != 3)
+    {
+        warning("%s is not a checkpoint; following %s from its end\n", statepath, path);
+    }
+    else if (state_inode != (unsigned long) sts->st_ino || state_device != (unsigned long) sts->st_dev)
+    {
+        verbose("%s was rotated; following it from its start\n", path);
+        offset = 0;
+    }
+    else if (state_offset > sts->st_size)
+    {
+        verbose("%s was truncated; following it from its start\n", path);
+        offset = 0;
+    }
+    else
+    {
+        verbose("resuming %s at offset %lld\n", path, state_offset);
+        offset = state_offset;
+    }
+    fclose(fp);
+}
+
+/**
+* Hands the complete lines in the buffer on to the outbound queue.
+*
+* @param eof true when the file has ended; the last partial line is then handed on as well.
+*/
+static void hand_lines(bool eof)
+{
+    size_t start = 0;
+    size_t counter = 0;
+    char line[LISTENER_BUFSIZE];
+
+    for (counter = 0; counter < len; counter++)
+    {
+        if (buf[counter] == '\n')
+        {
+            size_t line_len = counter - start;
+            if (line_len > 0 && buf[counter -1] == '\r') line_len--;
+
+            memcpy(line, &buf[start], line_len);
+            line[line_len] = '\0';
+            if (line_len > 0 && options.running) submit_message(line, NULL);
+            start = counter +1;
+        }
+    }
+
+    /* A line which fills the whole buffer is handed on as is */
+    if (len > start && (eof || (start == 0 && len == sizeof(buf) -1) ) )
+    {
+        memcpy(line, &buf[start], len - start);
+        line[len - start] = '\0';
+        if (options.running) submit_message(line, NULL);
+        start = len;
+    }
+
+    memmove(buf, &buf[start], len - start);
+    len -= start;
+    offset += start;
+    if (start > 0) add_mark();
+}
+
+/**
+* Reads everything which was appended to the file.
+*/
+static void read_lines()
+{
+    struct stat sts;
+    ssize_t result = 0;
+
+    if (fd < 0) return;
+
+    /* A file which shrunk was truncated, it is followed from its start */
+    if (fstat(fd, &sts) == 0 && sts.st_size < offset + (off_t) len)
+    {
+        verbose("%s was truncated; following it from its start\n", path);
+        offset = 0;
+        len = 0;
+        reset_marks();
+        (void) lseek(fd, 0, SEEK_SET);
+    }
+
+    while ( (result = read(fd, &buf[len], sizeof(buf) - len -1) ) > 0)
+    {
+        len += result;
+        hand_lines(false);
+    }
+}
+
+/**
+* Opens the file at path and starts watching it.
+*
+* @param resume true to resume at the checkpoint, false to start at the beginning.
+* @return true on success, false when the file does not exist (yet).
+*/
+static bool open_file(bool resume)
+{
+    struct stat sts;
+    int new_fd = open(path, O_RDONLY | O_NONBLOCK);
+
+    if (new_fd < 0)
+    {
+        if (errno == ENOENT)
+        {
+            verbose("waiting for %s to appear\n", path);
+        }
+        else warning("could not open %s: %s\n", path, strerror(errno) );
+        return false;
+    }
+    if (fstat(new_fd, &sts) != 0)
+    {
+        close(new_fd);
+        return false;
+    }
+
+    fd = new_fd;
+    inode = sts.st_ino;
+    device = sts.st_dev;
+    len = 0;
+    if (resume) load_state(&sts);
+    else offset = 0;
+    reset_marks();
+    (void) lseek(fd, offset, SEEK_SET);
+
+#ifdef HAVE_SYS_INOTIFY_H
+    file_watch = inotify_add_watch(notify_fd, path, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+    if (file_watch < 0) warning("could not watch %s: %s\n", path, strerror(errno) );
+#endif
+
+    read_lines();
+    checkpoint(true);
+    return true;
+}
+
+/**
+* Switches to the new file when the followed file was replaced. A file which was
+* only moved away is read until the new file appears, since its writer may still
+* append to it; it is then read up to its end before the new file is followed.
+*/
+static void check_rotated()
+{
+    struct stat sts;
+
+    if (fd >= 0)
+    {
+        if (stat(path, &sts) != 0)
+        {
+            debug("%s was moved; waiting for the new file\n", path);
+            return;
+        }
+        if (sts.st_ino == inode && sts.st_dev == device) return;
+
+        verbose("%s was rotated\n", path);
+        read_lines();
+        hand_lines(true);
+        close(fd);
+        fd = -1;
+#ifdef HAVE_SYS_INOTIFY_H
+        if (file_watch >= 0) (void) inotify_rm_watch(notify_fd, file_watch);
+#endif
+        file_watch = -1;
+    }
+
+    (void) open_file(false);
+}
+
+bool follow_open(const char *follow_path, const char *follow_statepath)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    char dir[MAX_PATH_LEN];
+    char *slash = NULL;
+
+    memset(path, '\0', sizeof(path) );
+    strncpy(path, follow_path, sizeof(path) -1);
+    if (strlen(follow_statepath) > 0) (void) snprintf(statepath, sizeof(statepath), "%s", follow_statepath);
+    else (void) snprintf(statepath, sizeof(statepath), "%s%s", path, FOLLOW_STATE_SUFFIX);
+
+    /* New files are noticed through the directory of the file */
+    strncpy(dir, path, sizeof(dir) );
+    if ( (slash = strrchr(dir, '/') ) != NULL)
+    {
+        name = &path[slash - dir +1];
+        if (slash == dir) slash++;
+        *slash = '\0';
+    }
+    else
+    {
+        name = path;
+        strcpy(dir, ".");
+    }
+
+    if ( (notify_fd = inotify_init() ) < 0)
+    {
+        error("could not initialise inotify: %s\n", strerror(errno) );
+        return false;
+    }
+    (void) fcntl(notify_fd, F_SETFL, O_NONBLOCK);
+
+    if ( (dir_watch = inotify_add_watch(notify_fd, dir, IN_CREATE | IN_MOVED_TO) ) < 0)
+    {
+        error("could not watch %s: %s\n", dir, strerror(errno) );
+        follow_close();
+        return false;
+    }
+
+    verbose("following %s, checkpointing to %s\n", path, statepath);
+    (void) open_file(true);
+    return true;
+#else
+    error("following %s needs inotify, which this system lacks\n", follow_path);
+    return false;
+#endif
+}
+
+void follow_close()
+{
+    if (fd >= 0)
+    {
+        checkpoint(true);
+        close(fd);
+        fd = -1;
+    }
+    if (notify_fd >= 0) close(notify_fd);
+    notify_fd = -1;
+    file_watch = -1;
+    dir_watch = -1;
+}
+
+void follow_add_descriptors(fd_set *in_set, int *maxfd)
+{
+    if (notify_fd < 0) return;
+
+    /* The offset is checkpointed here too, so it is written when the file goes quiet */
+    checkpoint(false);
+
+    FD_SET(notify_fd, in_set);
+    if (notify_fd > *maxfd) *maxfd = notify_fd;
+}
+
+void follow_process(fd_set *in_set)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    union
+    {
+        struct inotify_event event;
+        char buf[4096];
+    } events;
+    bool modified = false;
+    bool rotated = false;
+    ssize_t result = 0;
+    char *p = NULL;
+
+    if (notify_fd < 0 || FD_ISSET(notify_fd, in_set) == 0) return;
+    if ( (result = read(notify_fd, events.buf, sizeof(events.buf) ) ) <= 0) return;
+
+    /* The events are coalesced; the file is read once however many writes were reported */
+    for (p = events.buf; p < events.buf + result; p += sizeof(struct inotify_event) + ( (struct inotify_event *) p)->len)
+    {
+        const struct inotify_event *event = (const struct inotify_event *) p;
+
+        if (event->wd == file_watch)
+        {
+            if (event->mask & IN_MODIFY) modified = true;
+            if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF) ) rotated = true;
+            if (event->mask & IN_IGNORED) file_watch = -1;
+        }
+        else if (event->wd == dir_watch && event->len > 0 && strcmp(event->name, name) == 0) rotated = true;
+    }
+
+    if (modified) read_lines();
+    if (rotated) check_rotated();
+#endif
+}
@@ -0,0 +1,35 @@
+#ifndef follow_h_
+#define follow_h_
+
+#include <stdbool.h>
+#include <sys/select.h>
+
+#define FOLLOW_STATE_SUFFIX     ".irccmd-offset"
+#define FOLLOW_CHECKPOINT_SECS  (1)
+#define FOLLOW_MARKS            (64)
+
+/**
+* Starts following a file, like tail -F. Appended lines are queued as they are
+* written, using inotify. A rotated file is read up to its end before the new
+* file is followed from its start, and a truncated file is followed from its start.
+*
+* The offset and the inode of the file are checkpointed to a state file, so a
+* restart resumes after the last line which is safe: written to the server, or
+* kept in the spool file. Lines which were only queued in memory are read again.
+* Without a checkpoint of the same file, following starts at the end of the file.
+*
+* @param path the file to follow.
+* @param statepath the state file, or an empty string for path + FOLLOW_STATE_SUFFIX.
+* @return true on success, otherwise false.
+*/
+bool follow_open(const char *path, const char *statepath);
+
+/**
+* Checkpoints the offset one last time and stops following.
+*/
+void follow_close();
+
+void follow_add_descriptors(fd_set *in_set, int *maxfd);
+void follow_process(fd_set *in_set);
+
+#endif /*follow_h_*/
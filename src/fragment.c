@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "main.h"
+#include "fragment.h"
+
+/**
+* A record which is being reassembled.
+*/
+struct fragment_slot
+{
+    char nick[100];
+    char channel[MAX_CHANNELS_NAMELEN];
+    uint32_t id;
+    int next;                   /* the sequence number which is expected; 0 for a free slot */
+    int count;
+    char *buf;
+    size_t len;
+    time_t started;
+};
+
+static struct fragment_slot slots[FRAGMENT_SLOTS];
+static char *completed = NULL;  /* the last record which was completed */
+static uint32_t next_id = 0;
+
+static uint32_t crc_table[256];
+static bool crc_initialised = false;
+
+static uint32_t crc32(const char *data, size_t len)
+{
+    uint32_t crc = 0xffffffff;
+    size_t counter = 0;
+
+    if (crc_initialised == false)
+    {
+        uint32_t value = 0;
+        int bit = 0;
+
+        for (counter = 0; counter < 256; counter++)
+        {
+            value = counter;
+            for (bit = 0; bit < 8; bit++) value = (value & 1) ? (value >> 1) ^ 0xedb88320 : (value >> 1);
+            crc_table[counter] = value;
+        }
+        crc_initialised = true;
+    }
+
+    for (counter = 0; counter < len; counter++)
+    {
+        crc = crc_table[(crc ^ (unsigned char) data[counter]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+}
+
+/**
+* @return the length of the next fragment of data, which does not end within a UTF-8 character.
+*/
+static size_t fragment_cut(const struct fragment_state *state, size_t offset)
+{
+    size_t remaining = state->len - offset;
+    size_t cut = (remaining < state->data_size) ? remaining : state->data_size;
+
+    if (cut < remaining)
+    {
+        while (cut > 0 && (state->msg[offset + cut] & 0xc0) == 0x80) cut--;
+        if (cut == 0) cut = state->data_size;
+    }
+    return cut;
+}
+
+static void slot_free(struct fragment_slot *slot)
+{
+    free(slot->buf);
+    memset(slot, 0, sizeof(*slot) );
+}
+
+bool fragment_needed(const char *msg, size_t len, int size)
+{
+    if (size < FRAGMENT_MIN_SIZE) size = FRAGMENT_MIN_SIZE;
+    if (size > FRAGMENT_MAX_SIZE) size = FRAGMENT_MAX_SIZE;
+
+    return (len > (size_t) size || (len >= strlen(FRAGMENT_PREFIX) && strncmp(msg, FRAGMENT_PREFIX, strlen(FRAGMENT_PREFIX) ) == 0) );
+}
+
+void fragment_begin(struct fragment_state *state, const char *msg, size_t len, int size)
+{
+    size_t offset = 0;
+
+    if (size < FRAGMENT_MIN_SIZE) size = FRAGMENT_MIN_SIZE;
+    if (size > FRAGMENT_MAX_SIZE) size = FRAGMENT_MAX_SIZE;
+
+    /* Records of different runs should not be mixed up by a receiver */
+    if (next_id == 0) next_id = ( (uint32_t) time(NULL) << 8) ^ (uint32_t) getpid();
+
+    memset(state, 0, sizeof(*state) );
+    state->msg = msg;
+    state->len = (len < FRAGMENT_MAX_RECORD) ? len : FRAGMENT_MAX_RECORD;
+    state->data_size = size - FRAGMENT_HEADER_MAX;
+    state->id = next_id++;
+
+    while (offset < state->len)
+    {
+        offset += fragment_cut(state, offset);
+        state->count++;
+    }
+    if (state->count == 0) state->count = 1;
+}
+
+bool fragment_next(struct fragment_state *state, char *fragment, size_t *len)
+{
+    size_t cut = 0;
+    int header = 0;
+
+    if (state->seq >= state->count) return false;
+
+    cut = fragment_cut(state, state->offset);
+    header = sprintf(fragment, FRAGMENT_PREFIX "%08x %d/%d %08x ", state->id, state->seq +1, state->count, crc32(&state->msg[state->offset], cut) );
+    memcpy(&fragment[header], &state->msg[state->offset], cut);
+    fragment[header + cut] = '\0';
+    *len = header + cut;
+
+    state->offset += cut;
+    state->seq++;
+    return true;
+}
+
+enum fragment_results fragment_receive(const char *nick, const char *channel, const char *text, const char **record)
+{
+    struct fragment_slot *slot = NULL;
+    const char *data = NULL;
+    unsigned int id = 0;
+    unsigned int crc = 0;
+    size_t data_len = 0;
+    int seq = 0;
+    int count = 0;
+    int header = 0;
+    int counter = 0;
+
+    if (strncmp(text, FRAGMENT_PREFIX, strlen(FRAGMENT_PREFIX) ) != 0) return fragment_none;
+    if (sscanf(&text[strlen(FRAGMENT_PREFIX)], "%8x %d/%d %8x%n", &id, &seq, &count, &crc, &header) != 4) return fragment_none;
+    if (seq < 1 || seq > count || text[strlen(FRAGMENT_PREFIX) + header] != ' ') return fragment_none;
+
+    data = &text[strlen(FRAGMENT_PREFIX) + header +1];
+    data_len = strlen(data);
+
+    for (counter = 0; counter < FRAGMENT_SLOTS; counter++)
+    {
+        if (slots[counter].next > 0 && slots[counter].id == id && strcasecmp(slots[counter].nick, nick) == 0
+            && strcasecmp(slots[counter].channel, channel) == 0) slot = &slots[counter];
+    }
+
+    if (crc32(data, data_len) != crc)
+    {
+        warning("fragment %d/%d of %s in %s failed its checksum; dropping the record\n", seq, count, nick, channel);
+        if (slot != NULL) slot_free(slot);
+        return fragment_partial;
+    }
+
+    if (seq == 1)
+    {
+        if (slot != NULL) slot_free(slot);
+
+        /* A new record takes a free slot, or the one which was started first */
+        for (counter = 0; counter < FRAGMENT_SLOTS; counter++)
+        {
+            if (slot == NULL || slots[counter].next == 0 || (slot->next > 0 && slots[counter].started < slot->started) ) slot = &slots[counter];
+            if (slot->next == 0) break;
+        }
+        if (slot->next > 0)
+        {
+            warning("too many records are being reassembled; dropping the one from %s in %s\n", slot->nick, slot->channel);
+            slot_free(slot);
+        }
+
+        strncpy(slot->nick, nick, sizeof(slot->nick) -1);
+        strncpy(slot->channel, channel, sizeof(slot->channel) -1);
+        slot->id = id;
+        slot->next = 1;
+        slot->count = count;
+        slot->started = time(NULL);
+    }
+    else if (slot == NULL || seq != slot->next || count != slot->count)
+    {
+        warning("fragment %d/%d of %s in %s arrived out of order; dropping the record\n", seq, count, nick, channel);
+        if (slot != NULL) slot_free(slot);
+        return fragment_partial;
+    }
+
+    if (slot->len + data_len > FRAGMENT_MAX_RECORD)
+    {
+        warning("record of %s in %s is larger than %d bytes; dropping it\n", nick, channel, FRAGMENT_MAX_RECORD);
+        slot_free(slot);
+        return fragment_partial;
+    }
+    if (slot->buf == NULL) slot->buf = malloc(FRAGMENT_MAX_RECORD +1);
+    if (slot->buf == NULL)
+    {
+        error("no memory to reassemble a record of %s in %s\n", nick, channel);
+        slot_free(slot);
+        return fragment_partial;
+    }
+
+    memcpy(&slot->buf[slot->len], data, data_len);
+    slot->len += data_len;
+    slot->buf[slot->len] = '\0';
+    slot->next++;
+    if (seq < count) return fragment_partial;
+
+    debug("reassembled a record of %lu bytes from %d fragments\n", (unsigned long) slot->len, count);
+    free(completed);
+    completed = slot->buf;
+    slot->buf = NULL;
+    slot_free(slot);
+
+    *record = completed;
+    return fragment_complete;
+}
+
+void fragment_expire()
+{
+    time_t now = time(NULL);
+    int counter = 0;
+
+    for (counter = 0; counter < FRAGMENT_SLOTS; counter++)
+    {
+        struct fragment_slot *slot = &slots[counter];
+
+        if (slot->next > 0 && (now - slot->started) > FRAGMENT_TIMEOUT_SECS)
+        {
+            warning("record of %s in %s was not completed within %d seconds; dropping it\n", slot->nick, slot->channel, FRAGMENT_TIMEOUT_SECS);
+            slot_free(slot);
+        }
+    }
+}
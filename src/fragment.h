@@ -0,0 +1,88 @@
+#ifndef fragment_h_
+#define fragment_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FRAGMENT_PREFIX         "~f "
+#define FRAGMENT_HEADER_MAX     (33)            /* "~f <id> <seq>/<count> <crc> " */
+#define FRAGMENT_MIN_SIZE       (64)
+#define FRAGMENT_MAX_SIZE       (450)           /* the line budget of the targets usually makes a fragment smaller */
+#define FRAGMENT_MAX_RECORD     (64 * 1024)
+#define FRAGMENT_SLOTS          (8)
+#define FRAGMENT_TIMEOUT_SECS   (30)
+
+/**
+* Splits a record in fragments, which are returned one by one by fragment_next().
+*/
+struct fragment_state
+{
+    const char *msg;
+    size_t len;
+    size_t offset;
+    size_t data_size;       /* the bytes of the record per fragment, at most */
+    uint32_t id;
+    int seq;
+    int count;
+};
+
+/**
+* The outcome of fragment_receive().
+*/
+enum fragment_results
+{
+    fragment_none,          /* the message is not a fragment */
+    fragment_partial,       /* the fragment was taken; the record is not complete yet, or was dropped */
+    fragment_complete,      /* the fragment completed its record */
+};
+
+/**
+* Tells whether a record has to be send in fragments: when it is longer than size,
+* or when it would be taken for a fragment itself.
+*
+* @param size the length of a message, at most.
+*/
+bool fragment_needed(const char *msg, size_t len, int size);
+
+/**
+* Starts splitting a record in fragments of at most size bytes. A fragment looks like
+* "~f <id> <seq>/<count> <crc> <data>", where id identifies the record, seq counts
+* from 1 and crc is the CRC-32 of the data, in hexadecimal. Multi-byte UTF-8
+* characters are never split over two fragments.
+*
+* @param state receives the state of the split.
+* @param msg the record; it does not have to be terminated.
+* @param len the length of the record, at most FRAGMENT_MAX_RECORD; a longer record is cut.
+* @param size the length of a fragment, between FRAGMENT_MIN_SIZE and FRAGMENT_MAX_SIZE.
+*/
+void fragment_begin(struct fragment_state *state, const char *msg, size_t len, int size);
+
+/**
+* Writes the next fragment of a record.
+*
+* @param fragment receives the fragment, which is terminated; it holds FRAGMENT_MAX_SIZE +1 bytes.
+* @param len receives the length of the fragment.
+* @return false when all fragments have been written.
+*/
+bool fragment_next(struct fragment_state *state, char *fragment, size_t *len);
+
+/**
+* Collects a fragment received in a channel. The fragments of a record must arrive
+* in order; a record with a lost or damaged fragment is dropped. At most
+* FRAGMENT_SLOTS records of FRAGMENT_MAX_RECORD bytes are collected at once.
+*
+* @param nick the sender.
+* @param channel the channel.
+* @param text the message.
+* @param record receives the record when it is complete; it is valid until the next call.
+* @return whether the message was a fragment, and whether it completed its record.
+*/
+enum fragment_results fragment_receive(const char *nick, const char *channel, const char *text, const char **record);
+
+/**
+* Drops the records which have not been completed within FRAGMENT_TIMEOUT_SECS.
+*/
+void fragment_expire();
+
+#endif /*fragment_h_*/
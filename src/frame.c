@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "main.h"
+#include "input.h"
+#include "frame.h"
+
+/* The rest of a length prefixed frame which is too large, and is skipped */
+static size_t skip = 0;
+
+/* The text of a JSON object, once its escapes are decoded */
+static char json_text[INPUT_BUFSIZE];
+
+/**
+* Finds a record which ends in the delimiter. Records are cut at INPUT_BUFSIZE.
+*
+* @param record_len receives the length of the record, without its delimiter.
+* @param used receives the number of bytes the record takes.
+* @return true when a record was found.
+*/
+static bool find_record(const char *data, size_t len, char delimiter, bool eof, size_t *record_len, size_t *used)
+{
+    size_t max = (len < INPUT_BUFSIZE -1) ? len : INPUT_BUFSIZE -1;
+    const char *end = memchr(data, delimiter, max);
+
+    if (end != NULL)
+    {
+        *record_len = end - data;
+        *used = *record_len +1;
+        return true;
+    }
+
+    if (len >= INPUT_BUFSIZE -1 || (eof && len > 0) )
+    {
+        *record_len = max;
+        *used = max;
+        return true;
+    }
+    return false;
+}
+
+static const char *json_space(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') ) p++;
+    return p;
+}
+
+/**
+* @return the value of the 4 hex digits at p, or -1 when they are not hex digits.
+*/
+static long json_hex(const char *p, const char *end)
+{
+    long value = 0;
+    int counter = 0;
+
+    if (end - p < 4) return -1;
+    for (counter = 0; counter < 4; counter++)
+    {
+        char c = p[counter];
+
+        value <<= 4;
+        if (c >= '0' && c <= '9') value |= c - '0';
+        else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+        else return -1;
+    }
+    return value;
+}
+
+/**
+* Encodes a code point in UTF-8; surrogates which are not part of a pair become U+FFFD.
+*
+* @return the number of bytes written to out.
+*/
+static size_t utf8_encode(long cp, char *out)
+{
+    if (cp >= 0xd800 && cp < 0xe000) cp = 0xfffd;
+
+    if (cp < 0x80)
+    {
+        out[0] = cp;
+        return 1;
+    }
+    if (cp < 0x800)
+    {
+        out[0] = 0xc0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3f);
+        return 2;
+    }
+    if (cp < 0x10000)
+    {
+        out[0] = 0xe0 | (cp >> 12);
+        out[1] = 0x80 | ( (cp >> 6) & 0x3f);
+        out[2] = 0x80 | (cp & 0x3f);
+        return 3;
+    }
+    out[0] = 0xf0 | (cp >> 18);
+    out[1] = 0x80 | ( (cp >> 12) & 0x3f);
+    out[2] = 0x80 | ( (cp >> 6) & 0x3f);
+    out[3] = 0x80 | (cp & 0x3f);
+    return 4;
+}
+
+/**
+* Decodes a JSON string into out, which is terminated. A string which does not fit
+* is cut. Without out, the string is only skipped.
+*
+* @param p the character after the opening quote.
+* @param len receives the length of the decoded string.
+* @return the character after the closing quote, or NULL when the string is malformed.
+*/
+static const char *json_string(const char *p, const char *end, char *out, size_t size, size_t *len)
+{
+    size_t used = 0;
+
+    while (p < end && *p != '"')
+    {
+        char decoded[4];
+        size_t decoded_len = 1;
+
+        if ( (unsigned char) *p < 0x20) return NULL;
+        if (*p != '\\') decoded[0] = *p++;
+        else
+        {
+            long cp = 0;
+
+            if (++p >= end) return NULL;
+            switch (*p++)
+            {
+                case '"':  decoded[0] = '"'; break;
+                case '\\': decoded[0] = '\\'; break;
+                case '/':  decoded[0] = '/'; break;
+                case 'b':  decoded[0] = '\b'; break;
+                case 'f':  decoded[0] = '\f'; break;
+                case 'n':  decoded[0] = '\n'; break;
+                case 'r':  decoded[0] = '\r'; break;
+                case 't':  decoded[0] = '\t'; break;
+                case 'u':
+                    if ( (cp = json_hex(p, end) ) < 0) return NULL;
+                    p += 4;
+
+                    /* A character outside the basic plane is written as a pair of surrogates */
+                    if (cp >= 0xd800 && cp < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u')
+                    {
+                        long low = json_hex(&p[2], end);
+                        if (low >= 0xdc00 && low < 0xe000)
+                        {
+                            cp = 0x10000 + ( (cp - 0xd800) << 10) + (low - 0xdc00);
+                            p += 6;
+                        }
+                    }
+                    decoded_len = utf8_encode(cp, decoded);
+                    break;
+                default:
+                    return NULL;
+            }
+        }
+
+        if (out != NULL && used + decoded_len < size)
+        {
+            memcpy(&out[used], decoded, decoded_len);
+            used += decoded_len;
+        }
+    }
+
+    if (p >= end) return NULL;
+    if (out != NULL)
+    {
+        out[used] = '\0';
+        *len = used;
+    }
+    return p +1;
+}
+
+/**
+* Skips a number, true, false or null.
+*
+* @return the character after the value, or NULL when there is no value.
+*/
+static const char *json_scalar(const char *p, const char *end)
+{
+    const char *start = p;
+
+    while (p < end && strchr(",} \t\r\n", *p) == NULL) p++;
+    return (p > start) ? p : NULL;
+}
+
+/**
+* Hands a message to the handler, unless it holds a NUL character; the message
+* would be cut there without notice once it is treated as a string.
+*/
+static void deliver(frame_handler handler, const char *target, size_t target_len, const char *text, size_t text_len)
+{
+    if (memchr(target, '\0', target_len) != NULL || memchr(text, '\0', text_len) != NULL)
+    {
+        warning("message holds a NUL character; skipping it\n");
+        return;
+    }
+    handler(target, target_len, text, text_len);
+}
+
+/**
+* Decodes a JSON object with the keys target and text; other keys are ignored.
+*
+* @return true on success, false when the object is malformed or has no text.
+*/
+static bool decode_json(const char *p, size_t len, frame_handler handler)
+{
+    const char *end = p + len;
+    char target[FRAME_MAX_TARGET] = "";
+    char key[16];
+    size_t target_len = 0;
+    size_t text_len = 0;
+    size_t key_len = 0;
+    bool has_text = false;
+
+    p = json_space(p, end);
+    if (p >= end || *p++ != '{') return false;
+    p = json_space(p, end);
+
+    if (p < end && *p == '}') p++;
+    else while (true)
+    {
+        if (p >= end || *p++ != '"' || (p = json_string(p, end, key, sizeof(key), &key_len) ) == NULL) return false;
+        p = json_space(p, end);
+        if (p >= end || *p++ != ':') return false;
+        p = json_space(p, end);
+        if (p >= end) return false;
+
+        if (*p == '"')
+        {
+            if (strcmp(key, "target") == 0) p = json_string(p +1, end, target, sizeof(target), &target_len);
+            else if (strcmp(key, "text") == 0)
+            {
+                p = json_string(p +1, end, json_text, sizeof(json_text), &text_len);
+                has_text = true;
+            }
+            else p = json_string(p +1, end, NULL, 0, NULL);
+        }
+        else if (*p == '{' || *p == '[') return false;
+        else p = json_scalar(p, end);
+
+        if (p == NULL) return false;
+        p = json_space(p, end);
+        if (p < end && *p == ',')
+        {
+            p = json_space(p +1, end);
+            continue;
+        }
+        if (p < end && *p == '}')
+        {
+            p++;
+            break;
+        }
+        return false;
+    }
+
+    if (json_space(p, end) != end || has_text == false) return false;
+
+    deliver(handler, target, target_len, json_text, text_len);
+    return true;
+}
+
+static size_t decode_lp(const char *data, size_t len, bool eof, frame_handler handler)
+{
+    const unsigned char *header = (const unsigned char *) data;
+    size_t target_len = 0;
+    size_t text_len = 0;
+    size_t total = 0;
+
+    if (len < FRAME_LP_HEADER)
+    {
+        if (eof && len > 0)
+        {
+            warning("truncated frame at the end of the input\n");
+            return len;
+        }
+        return 0;
+    }
+
+    target_len = ( (size_t) header[0] << 8) | header[1];
+    text_len = ( (size_t) header[2] << 24) | ( (size_t) header[3] << 16) | ( (size_t) header[4] << 8) | header[5];
+    total = FRAME_LP_HEADER + target_len + text_len;
+
+    if (total > FRAME_MAX)
+    {
+        warning("frame of %lu bytes is larger than %d bytes; skipping it\n", (unsigned long) total, FRAME_MAX);
+        skip = total - ( (len < total) ? len : total);
+        return (len < total) ? len : total;
+    }
+
+    if (len < total)
+    {
+        if (eof)
+        {
+            warning("truncated frame at the end of the input\n");
+            return len;
+        }
+        return 0;
+    }
+
+    deliver(handler, &data[FRAME_LP_HEADER], target_len, &data[FRAME_LP_HEADER + target_len], text_len);
+    return total;
+}
+
+size_t frame_decode(enum input_formats format, const char *data, size_t len, bool eof, frame_handler handler)
+{
+    size_t record_len = 0;
+    size_t used = 0;
+
+    if (skip > 0)
+    {
+        used = (len < skip) ? len : skip;
+        skip -= used;
+        return used;
+    }
+
+    switch (format)
+    {
+        case format_line:
+            if (find_record(data, len, '\n', eof, &record_len, &used) == false) return 0;
+            if (record_len > 0 && data[record_len -1] == '\r') record_len--;
+            deliver(handler, "", 0, data, record_len);
+            return used;
+
+        case format_nul:
+            if (find_record(data, len, '\0', eof, &record_len, &used) == false) return 0;
+            deliver(handler, "", 0, data, record_len);
+            return used;
+
+        case format_lp:
+            return decode_lp(data, len, eof, handler);
+
+        case format_json:
+            if (find_record(data, len, '\n', eof, &record_len, &used) == false) return 0;
+            if (json_space(data, data + record_len) != data + record_len && decode_json(data, record_len, handler) == false)
+            {
+                warning("invalid JSON message; ignoring %.*s\n", (int) ( (record_len > 60) ? 60 : record_len), data);
+            }
+            return used;
+    }
+
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef frame_h_
+#define frame_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "main.h"
+
+#define FRAME_MAX           (64 * 1024)
+#define FRAME_LP_HEADER     (6)
+#define FRAME_MAX_TARGET    (64)
+
+/**
+* Receives a decoded message. The target is empty when the frame does not name one.
+* Lines are handed on as they are; they may still start with a '#channel'.
+*/
+typedef void (*frame_handler)(const char *target, size_t target_len, const char *text, size_t text_len);
+
+/**
+* Decodes the first frame in data and hands its message to the handler.
+*
+* The formats are:
+* - line: a message per line; a line ending in "\r\n" loses the '\r' as well.
+* - nul: a message terminated by a NUL character; it may span several lines.
+* - lp: a 16 bit target length and a 32 bit text length, both in network byte order,
+*   followed by the target and the text.
+* - json: a line with an object like {"target":"#channel","text":"message"}.
+*
+* Lines, NUL terminated messages and JSON objects are cut at INPUT_BUFSIZE. A message
+* which holds a NUL character, like a JSON "\u0000" or a NUL in a length prefixed
+* frame, is skipped.
+*
+* @param format the framing of data.
+* @param data the data.
+* @param len the length of data.
+* @param eof true when no more data will follow; a partial frame is then handed on as well.
+* @param handler the function which receives the message.
+* @return the number of bytes used, or 0 when data does not hold a complete frame.
+*/
+size_t frame_decode(enum input_formats format, const char *data, size_t len, bool eof, frame_handler handler);
+
+#endif /*frame_h_*/
@@ -2,6 +2,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -12,6 +17,12 @@
 #include "commands.h"
 #include "input.h"
 #include "buffer.h"
+#include "metrics.h"
+#include "line.h"
+#include "trace.h"
+#include "frame.h"
+#include "dedup.h"
+#include "fragment.h"
 
 #include "config.h"
 
@@ -19,28 +30,23 @@
 static char *prompt = NULL;
 static int completion_index = 0;
 
+/* stdin, when it is a regular file */
+static char *mapped = NULL;
+static size_t mapped_size = 0;
+static size_t mapped_offset = 0;
+
+/* The frames of stdin which have been read, but not decoded yet */
+static char frame_buf[FRAME_MAX];
+static size_t frame_len = 0;
+
 /* Helper functions */
 static void process_command(char *line);
-static void send_irc_message(char *msg);
-static size_t sgets(int fd, char *line, size_t size);
-static int get_channel(char *channel);
+static void send_irc_message(struct line_tokens *tokens, const char *target, uint32_t suppressed, uint32_t trace_id);
+static uint32_t message_channels(struct line_tokens *tokens, const char *target);
+static bool is_repeat(struct line_tokens *tokens, const char *target, uint32_t *suppressed);
 static char **irccmd_completion(char *text, int start, int end);
-static bool valid_argument(char *caller, char *arg, bool req_args);
-
-static char* ltrim(char* s) 
-{
-    char* newstart = s;
-
-    debug("before trimming |%s|\n", s);
-
-    while (isspace( *newstart) ) ++newstart;                                  /* newstart points to first non-whitespace char (which might be '\0') */
-    memmove(s, newstart, strlen(newstart) + 1);                               /* don't forget to move the '\0' terminator */
-    while (isspace(s[strlen(s) -1]) && strlen(s) > 0) s[strlen(s) -1] = '\0'; /* Remove trailing spaces */
-
-    debug("after trimming |%s|\n", s);
-
-    return s;
-}
+static bool valid_argument(const char *caller, char *arg, bool req_args);
+static void map_input();
 
 void init_readline()
 {
@@ -72,6 +78,208 @@ void init_readline()
         options.shownick = true;
         options.mode = both;
     }
+    else if ( (options.mode & input) > 0) map_input();
+}
+
+/** 
+* Maps stdin in memory when it is a regular file, from the current offset on.
+*/
+static void map_input()
+{
+    struct stat sts;
+    off_t start = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    void *map = NULL;
+
+    if (fstat(STDIN_FILENO, &sts) != 0 || S_ISREG(sts.st_mode) == 0 || start < 0 || sts.st_size <= start) return;
+
+    /* The mapping starts at the beginning of the file, since its offset has to be page aligned */
+    if ( (map = mmap(NULL, sts.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0) ) == MAP_FAILED)
+    {
+        debug("could not map stdin; reading it instead\n");
+        return;
+    }
+    (void) madvise(map, sts.st_size, MADV_SEQUENTIAL);
+
+    mapped = map;
+    mapped_size = sts.st_size;
+    mapped_offset = start;
+    verbose("stdin is a file of %lu bytes; mapped it in memory\n", (unsigned long) mapped_size);
+}
+
+/** 
+* The writing end of stdin has closed, or the file has been read.
+* We either switch to output only or stop the application once the
+* outbound queue has been send.
+*/
+static void input_ended()
+{
+    options.mode = output;
+    if (options.keepreading == false && options.no_inputs == 0 && strlen(options.followfile) == 0)
+    {
+        options.input_closed = true;
+    }
+}
+
+/** 
+* Queues a line which is not terminated. Without plugins, it is tokenized and queued
+* where it lies; plugins rewrite the message in place, so they are handed a copy.
+*/
+static void submit_view(const char *msg, size_t len)
+{
+    struct line_tokens tokens;
+    uint32_t suppressed = 0;
+    uint32_t id = 0;
+
+    if (options.enableplugins && options.no_plugins > 0)
+    {
+        char copy[INPUT_BUFSIZE];
+
+        memcpy(copy, msg, len);
+        copy[len] = '\0';
+        submit_message(copy, NULL);
+        return;
+    }
+
+    id = trace_begin();
+    metric_add(metric_lines_read, 1);
+    tokenize_message(msg, len, &tokens);
+    if (is_repeat(&tokens, NULL, &suppressed) ) return;
+    trace_stage(id, trace_plugins);
+
+    send_irc_message(&tokens, NULL, suppressed, id);
+}
+
+/** 
+* Queues a message for an explicit target; a leading '#channel' in the message is
+* not looked at. Plugins are handed a copy, since they rewrite the message in place.
+*/
+static void submit_target(const char *target, size_t target_len, const char *msg, size_t len)
+{
+    struct line_tokens tokens;
+    char copy[INPUT_BUFSIZE];
+    uint32_t suppressed = 0;
+    uint32_t id = trace_begin();
+
+    memset(&tokens, 0, sizeof(tokens) );
+    tokens.target.start = target;
+    tokens.target.len = target_len;
+    tokens.body.start = msg;
+    tokens.body.len = len;
+
+    metric_add(metric_lines_read, 1);
+    if (is_repeat(&tokens, NULL, &suppressed) ) return;
+    if (options.enableplugins && options.no_plugins > 0)
+    {
+        if (len > sizeof(copy) -1) len = sizeof(copy) -1;
+        memcpy(copy, msg, len);
+        copy[len] = '\0';
+        msg = execute_str_plugins(copy);
+        len = strlen(msg);
+    }
+    trace_stage(id, trace_plugins);
+
+    tokens.body.start = msg;
+    tokens.body.len = len;
+    send_irc_message(&tokens, NULL, suppressed, id);
+}
+
+void submit_summary(const char *channel, const char *msg, size_t len)
+{
+    struct line_tokens tokens;
+    char copy[INPUT_BUFSIZE];
+
+    memset(&tokens, 0, sizeof(tokens) );
+    tokens.target.start = channel;
+    tokens.target.len = strlen(channel);
+
+    if (options.enableplugins && options.no_plugins > 0)
+    {
+        if (len > sizeof(copy) -1) len = sizeof(copy) -1;
+        memcpy(copy, msg, len);
+        copy[len] = '\0';
+        msg = execute_str_plugins(copy);
+        len = strlen(msg);
+    }
+
+    /* A summary was not read, so it is not traced */
+    tokens.body.start = msg;
+    tokens.body.len = len;
+    send_irc_message(&tokens, NULL, 0, 0);
+}
+
+/** 
+* Queues a decoded frame of stdin. Lines are routed by their '#channel'; the messages
+* of the other formats go to their target, or the current channel, a line at a time
+* since an irc message cannot hold a line break. A bare '\r' ends a line as well;
+* many servers take it for the end of the message, and the rest for a command.
+*/
+static void submit_frame(const char *target, size_t target_len, const char *text, size_t text_len)
+{
+    if (options.running == false) return;
+
+    if (options.input_format == format_line)
+    {
+        if (text_len > 0) submit_view(text, text_len);
+        return;
+    }
+
+    while (text_len > 0)
+    {
+        size_t len = 0;
+
+        while (len < text_len && text[len] != '\n' && text[len] != '\r') len++;
+        if (len > 0) submit_target(target, target_len, text, len);
+        if (len == text_len) break;
+
+        text += len +1;
+        text_len -= len +1;
+    }
+}
+
+/** 
+* Reads stdin and queues the frames it holds, for all formats but lines.
+*/
+static void read_frames()
+{
+    ssize_t result = read(STDIN_FILENO, &frame_buf[frame_len], sizeof(frame_buf) - frame_len);
+    size_t start = 0;
+    size_t used = 0;
+
+    if (result < 0 && (errno == EINTR || errno == EAGAIN) ) return;
+    if (result > 0) frame_len += result;
+
+    while (start < frame_len && (used = frame_decode(options.input_format, &frame_buf[start], frame_len - start, result <= 0, submit_frame) ) > 0)
+    {
+        start += used;
+    }
+    memmove(frame_buf, &frame_buf[start], frame_len - start);
+    frame_len -= start;
+
+    if (result <= 0) input_ended();
+}
+
+bool input_is_mapped()
+{
+    return (mapped != NULL);
+}
+
+void process_mapped_input()
+{
+    while (mapped != NULL && mapped_offset < mapped_size && options.running && buffer_has_room() )
+    {
+        size_t used = frame_decode(options.input_format, &mapped[mapped_offset], mapped_size - mapped_offset, true, submit_frame);
+
+        if (used == 0) used = mapped_size - mapped_offset;
+        mapped_offset += used;
+    }
+
+    if (mapped != NULL && mapped_offset >= mapped_size)
+    {
+        debug("mapped stdin has been read\n");
+        (void) munmap(mapped, mapped_size);
+        mapped = NULL;
+        input_ended();
+    }
 }
 
 void deinit_readline()
@@ -91,37 +299,27 @@ void process_input()
     {
         rl_callback_read_char();
     }
-    else if (options.connected)
+    else if (options.input_format != format_line)
+    {
+        read_frames();
+    }
+    else
     {
         int result = 0;
-        char buff[9000];
+        char buff[INPUT_BUFSIZE];
 
         //memset(buff, 0, sizeof(buff) );
         result = sgets(STDIN_FILENO, buff, sizeof(buff) );
 
         if (result == 0)
         {
-            /*
-               The writing end has closed.
-               We either switch to output only
-               or stop the application.
-             */
-            if (options.keepreading)
-            {
-                options.mode = output;
-            }
-            else
-            {
-                options.running = false;
-            }
-            
+            input_ended();
         }
         else if (result > 0)
         {
             if (options.running)
             {
-                usleep(options.output_flood_timeout * 1000);
-                send_irc_message(execute_str_plugins(buff) );
+                submit_message(buff, NULL);
             }
         }
     }
@@ -144,187 +342,284 @@ void change_prompt()
 
 static void process_command(char *line)
 {
-    if (line[0] == '/')
+    struct line_tokens tokens;
+
+    tokenize_line(line, strlen(line), &tokens);
+
+    if (tokens.command.len > 0)
     {
-        int index = -1;
-        int counter = 0;
-        char *command = NULL;
+        struct commands *entry = command_find(tokens.command.start, tokens.command.len);
+        char copy[tokens.args.len +1];
         char *arguments = NULL;
 
         debug("received %s as an command\n", line);
 
-        /* Fetch command */
-        command = strchr(line, '/');
-
-        /* Fetch Arguments */
-        arguments = strchr(line, ' ');
-        if (arguments != NULL)
+        /* The commands take terminated arguments; they are only copied when white-space follows them */
+        if (tokens.args.len > 0)
         {
-            *arguments = '\0';
-            arguments++;
-            arguments = ltrim(arguments);
-        }
-
-        debug("command is %s\n", command);
-        if (arguments != NULL) debug("arguments are %s\n", arguments);
-
-        /* Fetch command information */
-        for (counter = 0; commands[counter].name; counter++)
-        {
-            if (strcmp(command, commands[counter].name) == 0)
+            if (tokens.args.start[tokens.args.len] == '\0') arguments = (char *) tokens.args.start;
+            else
             {
-                index = counter;
-                break;
+                memcpy(copy, tokens.args.start, tokens.args.len);
+                copy[tokens.args.len] = '\0';
+                arguments = copy;
             }
+            debug("arguments are %s\n", arguments);
         }
 
-        if (index >= 0)
+        if (entry != NULL)
         {
             /* Execute command*/
-            if (valid_argument(command, arguments, commands[index].req_args) )
+            if (valid_argument(entry->name, arguments, entry->req_args) )
             {
-                verbose("executing command: %s %s\n", command, arguments);
-                if (commands[index].func(arguments) == false)
+                verbose("executing command: %s %s\n", entry->name, (arguments != NULL) ? arguments : "");
+                if (command_execute(entry, arguments) == false)
                 {
                     options.running = false;
-                    error("error occured in %s\n", command);
+                    error("error occured in %s\n", entry->name);
                 }
                 else
                 {
-                    /* Restore original line */
-                    if (arguments != NULL)
-                    {
-                        arguments--;
-                        *arguments = ' ';
-                    }
-
                     debug("adding \"%s\" to readline history\n", line);
                     add_history(line);
                 }
             }
         }
-        else nsilent("command %s not found\n", command);
+        else nsilent("command %.*s not found\n", (int) tokens.command.len, tokens.command.start);
+    }
+    else
+    {
+        send_irc_message(&tokens, NULL, 0, 0);
+        if (tokens.body.len > 0) add_history(line);
     }
-    else send_irc_message(line);
 }
 
-static void send_irc_message(char *msg)
+void submit_message(char *msg, const char *target)
 {
-    bool error = options.connected;
-    int channel_id = 0;
-    char channel[MAX_CHANNELS_NAMELEN];
-    char *msg_start = msg;
-    char *channel_start = msg;
+    struct line_tokens tokens;
+    uint32_t suppressed = 0;
+    uint32_t id = trace_begin();
+
+    metric_add(metric_lines_read, 1);
+    tokenize_message(msg, strlen(msg), &tokens);
+    if (is_repeat(&tokens, target, &suppressed) ) return;
+
+    msg = execute_str_plugins(msg);
+    trace_stage(id, trace_plugins);
 
-    if (options.connected == true)
+    tokenize_message(msg, strlen(msg), &tokens);
+    send_irc_message(&tokens, target, suppressed, id);
+}
+
+/** 
+* Queues a message for a group of targets. With options.fragment_size set, a message
+* which is longer, or which would not fit the line the server relays to the targets,
+* is split in fragments, which the receiving irccmd reassembles. A message which is
+* longer than FRAGMENT_MAX_RECORD would be dropped by the receiver, so it is not send.
+* 
+* @param targets the comma separated targets.
+* @param targets_len the length of the targets.
+* @param msg the message; it does not have to be terminated.
+* @param len the length of the message.
+* @param trace_id the trace id of the message; every fragment carries it.
+*/
+static void queue_group(const char *targets, size_t targets_len, const char *msg, size_t len, uint32_t trace_id)
+{
+    struct fragment_state state;
+    char fragment[FRAGMENT_MAX_SIZE +1];
+    size_t fragment_len = 0;
+    int size = irc_text_budget(targets_len);
+
+    if (options.fragment_size > 0 && options.fragment_size < size) size = options.fragment_size;
+    if (options.fragment_size <= 0 || fragment_needed(msg, len, size) == false)
     {
-        if (msg != NULL)
-        {
-            debug("sending message: %s\n", msg);
-            msg = ltrim(msg);
+        buffer_push(targets, msg, len, trace_id);
+        return;
+    }
 
-            /* Check if the first non-white-space character is a '#' */
-            if (msg[0] == '#')
-            {
-                channel_start = strchr(msg, '#');
-                /* Find space after channel; then put a \0 character there and go to the next 
-                   character which should be the start of the message */
-                msg_start = strchr(channel_start, ' ');
+    if (len > FRAGMENT_MAX_RECORD)
+    {
+        warning("message of %lu bytes to %s is larger than %d bytes, which can be reassembled; dropping it\n", (unsigned long) len, targets, FRAGMENT_MAX_RECORD);
+        return;
+    }
 
-                if (msg_start != NULL)
-                {
-                    *msg_start = '\0';
-                    msg_start++;
-                }
-            }
+    fragment_begin(&state, msg, len, size);
+    debug("sending message of %lu bytes to %s in %d fragments\n", (unsigned long) len, targets, state.count);
+    while (fragment_next(&state, fragment, &fragment_len) ) buffer_push(targets, fragment, fragment_len, trace_id);
+}
 
-            if (msg_start != NULL)
-            {
-                /* If so, find the channel in the known channels */
-                if (channel_start != NULL)
-                {
-                    channel_id = get_channel(channel_start);
-                }
+/** 
+* Queues a message for its channels. Channels which share a message are named
+* together in a single PRIVMSG, as far as the TARGMAX of the server allows, so a
+* broadcast costs a single queue entry and a single write per group of targets.
+* When messages are fragmented, a group also leaves room for a fragment of
+* FRAGMENT_MIN_SIZE bytes in the line.
+* 
+* @param channels the channels, a bit per channel id.
+* @param msg the message; it does not have to be terminated.
+* @param len the length of the message.
+* @param trace_id the trace id of the message, or 0 when it is not traced.
+*/
+static void queue_message(uint32_t channels, const char *msg, size_t len, uint32_t trace_id)
+{
+    char targets[BUFFER_TARGETS_LEN] = "";
+    size_t targets_len = 0;
+    int max_targets = irc_max_targets();
+    int no_targets = 0;
+    int channel_id = 0;
 
-                if (strlen(msg_start) > 0)
-                {
-                    /* Send the message to the correct channel */
-                    memset(channel, 0, sizeof(channel));
-                    strncpy(channel, options.channels[channel_id], sizeof(channel) );
+    for (channel_id = 0; channel_id < options.no_channels; channel_id++)
+    {
+        size_t name_len = strlen(options.channels[channel_id]);
 
-                    irc_send_raw_msg(msg_start, channel);
+        if ( (channels & (1U << channel_id) ) == 0) continue;
 
-                    if (options.interactive)
-                    {
-                        add_history(msg);
-                    }
-                }
-                error = false;
-            }
-            else debug("could not succesfully parse message; message NULL?\n");
+        if (no_targets > 0 && (no_targets >= max_targets || targets_len + name_len +2 > sizeof(targets)
+            || (options.fragment_size > 0 && irc_text_budget(targets_len + name_len +1) < FRAGMENT_MIN_SIZE) ) )
+        {
+            queue_group(targets, targets_len, msg, len, trace_id);
+            targets_len = 0;
+            no_targets = 0;
         }
-        else debug("could not succesfully parse message; message NULL?\n");
+
+        if (no_targets > 0) targets[targets_len++] = ',';
+        memcpy(&targets[targets_len], options.channels[channel_id], name_len +1);
+        targets_len += name_len;
+        no_targets++;
     }
-    else
+
+    if (no_targets > 0) queue_group(targets, targets_len, msg, len, trace_id);
+}
+
+/** 
+* Queues a message for its channels. A message starting with a known '#channel',
+* '@group' or '*' is send there, otherwise it is send to the given target.
+* 
+* @param tokens the parts of the message.
+* @param target the default channel, or NULL for the current channel.
+* @param suppressed the channels for which the message is a repeat, and is not send.
+* @param trace_id the trace id of the message, or 0 when it is not traced.
+*/
+static void send_irc_message(struct line_tokens *tokens, const char *target, uint32_t suppressed, uint32_t trace_id)
+{
+    uint32_t channels = 0;
+
+    if (tokens->body.start == NULL)
     {
-        debug("not connected to a channel yet; forgetting message\n");
+        error("failed to parse message, forgetting...\n");
+        return;
     }
-    if (error)
+
+    channels = message_channels(tokens, target) & ~suppressed;
+    if (tokens->body.len > 0 && channels != 0)
     {
-        error("failed to parse message, forgetting...\n");
-        //options.running = false;
+        debug("sending message: %.*s\n", (int) tokens->body.len, tokens->body.start);
+
+        /* Queue the message for the correct channels; it is send when the connection allows it */
+        queue_message(channels, tokens->body.start, tokens->body.len, trace_id);
     }
 }
 
 /** 
-* reads a line from a file
-* 
-* @param fd file descriptor of the file to read
-* @param line pointer to the storage where the read line should reside
-* @param size the maximum size of the given storage
+* Resolves a target to channels: '*' is every channel, '@name' the channels of a
+* group which are configured, and '#name' a single configured channel.
 * 
-* @return the number of characters read
+* @param channels receives the channels, a bit per channel id.
+* @return false when the target is not known.
 */
-static size_t sgets(int fd, char *line, size_t size)
+static bool resolve_target(const char *name, size_t len, uint32_t *channels)
 {
-    size_t i;
-    for ( i = 0; i < size - 1; ++i )
+    int channel_id = 0;
+    int group_id = 0;
+    int counter = 0;
+
+    if (len == 1 && name[0] == '*')
     {
-        char ch = 0;
-        if (read(fd, &ch, sizeof(ch) ) == 0) ch = EOF;
-        if ( ch == '\n' || ch == EOF )
+        *channels = (options.no_channels < 32) ? (1U << options.no_channels) -1 : ~0U;
+        return true;
+    }
+
+    if (len > 1 && name[0] == '@')
+    {
+        if ( (group_id = get_group(&name[1], len -1) ) < 0) return false;
+
+        *channels = 0;
+        for (counter = 0; counter < options.groups[group_id].no_channels; counter++)
         {
-            break;
+            const char *member = options.groups[group_id].channels[counter];
+
+            if ( (channel_id = get_channel(member, strlen(member), -1) ) >= 0) *channels |= (1U << channel_id);
+            else debug("%s of group %s is not one of our channels\n", member, options.groups[group_id].name);
         }
-        line[i] = ch;
+        return true;
     }
-    line[i] = '\0';
 
-    return i;
+    if ( (channel_id = get_channel(name, len, -1) ) < 0) return false;
+    *channels = (1U << channel_id);
+    return true;
 }
 
-static int get_channel(char *channel)
+/** 
+* Finds the channels of a message: those of its own target when that is known,
+* otherwise those of the given target. A line starting with an '@' which is not
+* a group is an ordinary message, so the '@word' is put back in its body. That is
+* only done when both are parts of the same line; the target of a frame is kept
+* apart from its text.
+* 
+* @param target the default target, or NULL for the current channel.
+* @return the channels, a bit per channel id.
+*/
+static uint32_t message_channels(struct line_tokens *tokens, const char *target)
 {
-    int channel_id = 0;
-    int len = strlen(channel);
+    uint32_t channels = (1U << options.current_channel_id);
 
-    while (strncmp(options.channels[channel_id], channel, len) != 0)
+    if (target != NULL) (void) resolve_target(target, strlen(target), &channels);
+    if (tokens->target.len > 0 && resolve_target(tokens->target.start, tokens->target.len, &channels) == false)
     {
-        channel_id++;
-        if (channel_id >= options.no_channels)
+        const char *separator = tokens->target.start + tokens->target.len;
+
+        if (tokens->target.start[0] == '@' && (tokens->body.start == NULL || tokens->body.start == separator +1) )
         {
-            channel_id = options.current_channel_id;
-            debug("channel %s not found, defaulting to %s\n", channel, options.channels[channel_id]);
-            break;
+            const char *end = (tokens->body.start != NULL) ? tokens->body.start + tokens->body.len : separator;
+
+            tokens->body.start = tokens->target.start;
+            tokens->body.len = end - tokens->target.start;
         }
+        else verbose("target %.*s not found\n", (int) tokens->target.len, tokens->target.start);
+        tokens->target.len = 0;
     }
 
-    return channel_id;
+    return channels;
+}
+
+/** 
+* Tells whether a message is a repeat within the dedup window for all of its
+* channels. This is checked before the plugins run, so a sensor in a fault loop
+* does not cost a plugin call per line.
+* 
+* @param suppressed receives the channels for which the message is a repeat.
+*/
+static bool is_repeat(struct line_tokens *tokens, const char *target, uint32_t *suppressed)
+{
+    uint32_t channels = 0;
+    int channel_id = 0;
+
+    *suppressed = 0;
+    if (options.dedup_window <= 0 || tokens->body.start == NULL || tokens->body.len == 0) return false;
+
+    channels = message_channels(tokens, target);
+    for (channel_id = 0; channel_id < options.no_channels; channel_id++)
+    {
+        if ( (channels & (1U << channel_id) ) == 0) continue;
+        if (dedup_check(options.channels[channel_id], tokens->body.start, tokens->body.len) == false) *suppressed |= (1U << channel_id);
+    }
+
+    return (channels != 0 && *suppressed == channels);
 }
 
 /* Return non-zero if ARG is a valid argument for CALLER, else print
       an error message and return zero. */
-static bool valid_argument(char *caller, char *arg, bool req_args)
+static bool valid_argument(const char *caller, char *arg, bool req_args)
 {
     if (!arg || !*arg)
     {
@@ -340,14 +635,10 @@ static bool valid_argument(char *caller, char *arg, bool req_args)
 
 static char *command_generator(const char *text, int state)
 {
-    char *match = NULL;
-    int len = strlen(text);
+    struct commands *match = NULL;
     if (!state) completion_index = 0;
 
-    while ( (match = commands[completion_index++].name) )
-    {
-        if (strncmp(match, text, len) == 0) return strdup(match);
-    }
+    if ( (match = command_next(text, strlen(text), &completion_index) ) != NULL) return strdup(match->name);
 
     return NULL;
 }
@@ -1,9 +1,45 @@
 #ifndef input_h_
 #define input_h_
 
+#include <stdbool.h>
+#include <stddef.h>
+
+#define INPUT_BUFSIZE (9000)
+
 void init_readline();
 void deinit_readline();
 void process_input();
+
+/** 
+* Tells whether stdin is a regular file which is mapped in memory. Its lines are
+* then fed by process_mapped_input instead of being read when select reports stdin.
+*/
+bool input_is_mapped();
+
+/** 
+* Queues lines of the mapped stdin for as long as the outbound queue has room,
+* so a large file is send at the pace of the flood timeout instead of being dropped.
+*/
+void process_mapped_input();
+
 void change_prompt();
 
+/** 
+* Runs the plugins over a message and queues it for sending.
+* 
+* @param msg the message, which will be modified.
+* @param target the default channel, or NULL for the current channel.
+*/
+void submit_message(char *msg, const char *target);
+
+/** 
+* Queues the summary of the repeats of a message. It runs through the plugins and
+* is fragmented like any other message, but is not checked for repeats itself.
+* 
+* @param channel the channel the repeats were meant for.
+* @param msg the summary; it does not have to be terminated.
+* @param len the length of the summary.
+*/
+void submit_summary(const char *channel, const char *msg, size_t len);
+
 #endif /*input_h_*/
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "main.h"
+#include "listener.h"
+#include "inputs.h"
+
+/** 
+* Opens a fifo, and creates it when it does not exist. The fifo is opened for
+* writing as well, so it does not report end of file when its last writer goes away.
+* 
+* @return the descriptor, or -1 on failure.
+*/
+static int open_fifo(const char *path)
+{
+    struct stat sts;
+    int fd = -1;
+
+    if (stat(path, &sts) != 0)
+    {
+        if (errno != ENOENT || mkfifo(path, 0660) != 0)
+        {
+            error("could not create fifo %s: %s\n", path, strerror(errno) );
+            return -1;
+        }
+    }
+    else if (S_ISFIFO(sts.st_mode) == 0)
+    {
+        error("%s is not a fifo\n", path);
+        return -1;
+    }
+
+    if ( (fd = open(path, O_RDWR | O_NONBLOCK) ) < 0) error("could not open fifo %s: %s\n", path, strerror(errno) );
+    return fd;
+}
+
+/** 
+* Opens a file, which is read once up to its end.
+* 
+* @return the descriptor, or -1 on failure.
+*/
+static int open_file(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_NONBLOCK);
+
+    if (fd < 0) error("could not open %s: %s\n", path, strerror(errno) );
+    return fd;
+}
+
+static bool channel_known(const char *channel)
+{
+    int counter = 0;
+
+    if (strlen(channel) == 0) return true;
+    for (counter = 0; counter < options.no_channels; counter++)
+    {
+        if (strncmp(options.channels[counter], channel, MAX_CHANNELS_NAMELEN) == 0) return true;
+    }
+    return false;
+}
+
+bool inputs_open(client_line_handler handler)
+{
+    int counter = 0;
+
+    for (counter = 0; counter < options.no_inputs; counter++)
+    {
+        struct input_source *source = &options.inputs[counter];
+        int fd = -1;
+
+        if (channel_known(source->channel) == false)
+        {
+            warning("input %d: channel %s is not joined; using the current channel\n", counter +1, source->channel);
+            memset(source->channel, '\0', sizeof(source->channel) );
+        }
+
+        switch (source->type)
+        {
+            case input_fifo:
+            case input_file:
+                fd = (source->type == input_fifo) ? open_fifo(source->path) : open_file(source->path);
+                if (fd < 0) return false;
+                if (listener_add_reader(fd, source->path, source->channel, handler) == false)
+                {
+                    close(fd);
+                    return false;
+                }
+                verbose("reading %s\n", source->path);
+                break;
+
+            case input_unix:
+                if (listener_open_unix(source->path, source->channel, handler) == false) return false;
+                break;
+
+            case input_tcp:
+                if (listener_open_tcp(source->port, source->channel, handler) == false) return false;
+                break;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,18 @@
+#ifndef inputs_h_
+#define inputs_h_
+
+#include <stdbool.h>
+
+#include "listener.h"
+
+/** 
+* Opens the input sources of settings.inputs. Fifos and files are read like the
+* clients of a listener, unix sockets and tcp ports are listened on; all of them
+* are multiplexed on the main loop and feed the same outbound queue.
+* 
+* @param handler the function which will receive the lines of every source.
+* @return true on success, false when a source could not be opened.
+*/
+bool inputs_open(client_line_handler handler);
+
+#endif /*inputs_h_*/
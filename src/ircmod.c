@@ -1,16 +1,237 @@
+#include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <sys/select.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "ircmod.h"
 #include "configdefaults.h"
+#include "buffer.h"
+#include "resolve.h"
+#include "tls.h"
+#include "metrics.h"
 
 static irc_session_t *session;
 static irc_callbacks_t callbacks;
 static bool init_callbacks = false;
 static time_t last_contact = 0;
+static uint64_t ping_sent = 0;
+
+/**
+* The capabilities we request from the server.
+*
+* labeled-response, batch and server-time are not requested; they add message
+* tags to every line and libircclient cannot parse those.
+*/
+static struct
+{
+    const char *name;
+    enum irc_capabilities cap;
+}
+wanted_caps[] =
+{
+    { "echo-message", cap_echo_message },
+    { NULL          , cap_none         },
+};
+
+static bool cap_requested = false;
+static unsigned int caps_enabled = 0;
+static char cap_request[200];
+
+/**
+* The control lane. Protocol messages are handed to libircclient at once, ahead
+* of any queued data; they are only kept here while its output buffer is full,
+* and the data lane waits until they are out.
+*/
+static struct
+{
+    char line[IRC_CONTROL_LEN];
+    uint64_t queued;
+}
+control[IRC_CONTROL_QUEUE];
+static int control_head = 0;
+static int control_count = 0;
+
+/* The number of channels a single PRIVMSG may name, as advertised by the server */
+static int max_targets = 1;
+
+/**
+* Notes that a control message has been handed to libircclient. A PING is timed
+* from here, not from the moment it was queued; only the oldest unanswered one is timed.
+*
+* @param queued the moment the message was queued, or 0 when it was written right away.
+*/
+static void control_written(const char *line, uint64_t queued)
+{
+    uint64_t now = metrics_now();
+
+    metric_observe(metric_control_lane, (queued > 0) ? now - queued : 0);
+    if (strncmp(line, "PING ", 5) == 0 && ping_sent == 0) ping_sent = now;
+}
+
+/**
+* Sends a protocol message, like PING, JOIN or CAP, through the control lane.
+* A message is only queued when the output buffer of libircclient is full; when
+* the connection is not ready for it, it fails.
+*
+* @return 0 when the message was written or queued, otherwise 1.
+*/
+static int irc_send_control(const char *format, ...)
+{
+    char line[IRC_CONTROL_LEN];
+    va_list args;
+
+    if (is_irc_connected() == false) return 1;
+
+    va_start(args, format);
+    (void) vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (control_count == 0)
+    {
+        if (irc_send_raw(session, "%s", line) == 0)
+        {
+            control_written(line, 0);
+            return 0;
+        }
+        if (irc_errno(session) != LIBIRC_ERR_NOMEM) return 1;
+    }
+
+    if (control_count >= IRC_CONTROL_QUEUE)
+    {
+        warning("control lane is full; dropping %s\n", line);
+        return 1;
+    }
+
+    debug("output buffer is full; %s waits in the control lane\n", line);
+    strcpy(control[(control_head + control_count) % IRC_CONTROL_QUEUE].line, line);
+    control[(control_head + control_count) % IRC_CONTROL_QUEUE].queued = metrics_now();
+    control_count++;
+    return 0;
+}
+
+bool irc_flush_control()
+{
+    while (control_count > 0 && is_irc_connected() )
+    {
+        if (irc_send_raw(session, "%s", control[control_head].line) != 0) break;
+
+        control_written(control[control_head].line, control[control_head].queued);
+        control_head = (control_head +1) % IRC_CONTROL_QUEUE;
+        control_count--;
+    }
+
+    return (control_count == 0);
+}
+
+/**
+* Handles the CAP replies of the server during capability negotiation.
+* The capabilities we want from the LS reply are requested, and
+* negotiation is ended after the server has ACKed or NAKed them.
+*
+* @param params The parameters of the event: target, subcommand, [*,] capabilities.
+* @param count The number of parameters.
+*/
+static void irc_cap_event(const char **params, unsigned int count)
+{
+    const char *subcommand = params[1];
+    bool more = (count >= 4 && strcmp(params[2], "*") == 0);
+    char caps[512];
+    char *token = NULL;
+    char *saveptr = NULL;
+    int counter = 0;
+
+    strncpy(caps, params[count -1], sizeof(caps) -1);
+    caps[sizeof(caps) -1] = '\0';
+
+    if (strcmp(subcommand, "LS") == 0)
+    {
+        for (token = strtok_r(caps, " ", &saveptr); token != NULL; token = strtok_r(NULL, " ", &saveptr) )
+        {
+            /* CAP LS 302 may add values to capabilities */
+            char *value = strchr(token, '=');
+            if (value != NULL) *value = '\0';
+
+            for (counter = 0; wanted_caps[counter].name != NULL; counter++)
+            {
+                if (strcmp(token, wanted_caps[counter].name) == 0 && strlen(cap_request) + strlen(token) +2 < sizeof(cap_request) )
+                {
+                    if (strlen(cap_request) > 0) strcat(cap_request, " ");
+                    strcat(cap_request, token);
+                }
+            }
+        }
+
+        if (more == false)
+        {
+            if (strlen(cap_request) > 0)
+            {
+                debug("requesting capabilities: %s\n", cap_request);
+                irc_send_control("CAP REQ :%s", cap_request);
+            }
+            else irc_send_control("CAP END");
+        }
+    }
+    else if (strcmp(subcommand, "ACK") == 0)
+    {
+        for (token = strtok_r(caps, " ", &saveptr); token != NULL; token = strtok_r(NULL, " ", &saveptr) )
+        {
+            bool disable = (token[0] == '-');
+            if (disable) token++;
+
+            for (counter = 0; wanted_caps[counter].name != NULL; counter++)
+            {
+                if (strcmp(token, wanted_caps[counter].name) == 0)
+                {
+                    if (disable) caps_enabled &= ~wanted_caps[counter].cap;
+                    else caps_enabled |= wanted_caps[counter].cap;
+                    verbose("capability %s %s\n", token, (disable) ? "disabled" : "enabled");
+                }
+            }
+        }
+        if (more == false) irc_send_control("CAP END");
+    }
+    else if (strcmp(subcommand, "NAK") == 0)
+    {
+        warning("server refused capabilities: %s\n", params[count -1]);
+        irc_send_control("CAP END");
+    }
+}
+
+/**
+* Reads the number of targets a PRIVMSG may have from an ISUPPORT (005) reply,
+* from TARGMAX or the older MAXTARGETS. A TARGMAX without a number has no limit.
+*
+* @param params The parameters of the event: our nick, the tokens and a text.
+* @param count The number of parameters.
+*/
+static void irc_isupport_event(const char **params, unsigned int count)
+{
+    unsigned int counter = 0;
+
+    for (counter = 1; counter < count; counter++)
+    {
+        const char *value = NULL;
+
+        if (strncmp(params[counter], "MAXTARGETS=", 11) == 0) max_targets = atoi(&params[counter][11]);
+        else if (strncmp(params[counter], "TARGMAX=", 8) == 0)
+        {
+            if ( (value = strstr(params[counter], "PRIVMSG:") ) == NULL) continue;
+
+            value += 8;
+            max_targets = (*value == ',' || *value == '\0') ? MAX_CHANNELS : atoi(value);
+        }
+        else continue;
+
+        if (max_targets < 1) max_targets = 1;
+        debug("the server accepts %d targets per message\n", max_targets);
+    }
+}
 
 void irc_general_event(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
 {
@@ -18,6 +239,16 @@ void irc_general_event(irc_session_t *session, const char *event, const char *or
     {
         last_contact = time(NULL);
         options.ping_count++;
+
+        if (ping_sent > 0)
+        {
+            metric_observe(metric_ping_rtt, metrics_now() - ping_sent);
+            ping_sent = 0;
+        }
+    }
+    else if (strcmp(event, "CAP") == 0 && count >= 3)
+    {
+        irc_cap_event(params, count);
     }
     else
     {
@@ -72,6 +303,16 @@ void irc_general_event_numeric (irc_session_t * session, unsigned int event, con
             else options.running = false;
         }
     }
+    else if ( (event == LIBIRC_RFC_ERR_NOSUCHNICK || event == LIBIRC_RFC_ERR_NOSUCHCHANNEL || event == LIBIRC_RFC_ERR_CANNOTSENDTOCHAN
+                || event == 489 /* ERR_SECUREONLYCHAN */) && count >= 2)
+    {
+        /* A message which waits for its echo will not get one */
+        if (buffer_reject(params[1]) == false) debug("event[%d]: %s\n", event, params[1]);
+    }
+    else if (event == 5) /* RPL_ISUPPORT */
+    {
+        irc_isupport_event(params, count);
+    }
     else if (event == LIBIRC_RFC_RPL_MOTD)
     {
         if (options.verbose || options.interactive)
@@ -121,7 +362,8 @@ bool join_irc_channel(char *channel, char *password)
 {
     int retval = 0;
     verbose("joining channel: %s\n", channel);
-    retval = irc_cmd_join(session, channel, password);
+    if (password != NULL && strlen(password) > 0) retval = irc_send_control("JOIN %s %s", channel, password);
+    else retval = irc_send_control("JOIN %s", channel);
     if (retval != 0)
     {
         error("join: %d: %s\n", retval, irc_strerror(irc_errno(session) ) );
@@ -134,7 +376,7 @@ bool part_irc_channel(char *channel)
 {
     int retval = 0;
     verbose("leaving channel: %s\n", channel);
-    retval = irc_cmd_part(session, channel);
+    retval = irc_send_control("PART %s", channel);
     if (retval != 0)
     {
         error("part: %d: %s\n", retval, irc_strerror(irc_errno(session) ) );
@@ -143,37 +385,125 @@ bool part_irc_channel(char *channel)
     return true;
 }
 
+/**
+* @return the socket of libircclient, or -1 when it has none.
+*/
+static int irc_socket()
+{
+    fd_set in_set;
+    fd_set out_set;
+    int maxfd = -1;
+
+    /* libircclient does not hand out its socket, but it is the only descriptor it adds */
+    FD_ZERO(&in_set);
+    FD_ZERO(&out_set);
+    if (irc_add_select_descriptors(session, &in_set, &out_set, &maxfd) != 0) return -1;
+    return maxfd;
+}
+
 static bool setup_irc_session()
 {
 	debug("setting up irc connection\n");
 	session = irc_create_session(&callbacks);
 
+    /* A new connection negotiates its capabilities again; unacknowledged messages are resend */
+    cap_requested = false;
+    caps_enabled = 0;
+    ping_sent = 0;
+    memset(cap_request, '\0', sizeof(cap_request) );
+    control_head = 0;
+    control_count = 0;
+    max_targets = 1;
+    buffer_requeue();
+
     if(options.debug) irc_option_set(session, LIBIRC_OPTION_DEBUG);
+#ifdef LIBIRC_OPTION_SSL_NO_VERIFY
+    if(options.ssl && options.ssl_verify == false) irc_option_set(session, LIBIRC_OPTION_SSL_NO_VERIFY);
+#endif
     return (session != NULL) ? true : false;
 }
 
-static int connect_irc_session()
+/**
+* Hands the server to libircclient, which makes the connection.
+*
+* @param address the numeric address of the server from the cache, or its name.
+* @param ipv6 true for an IPv6 address.
+*/
+static int connect_irc_session(const char *address, bool ipv6)
 {
     int retval = 0;
+    int port = 0;
+    char server[INET6_ADDRSTRLEN + MAX_SERVER_NAMELEN +2];
     options.connected = false;
     last_contact = time(NULL);
 
-	verbose("connecting to server: %s:%d\n", options.server, options.port);
-	retval = irc_connect(session, options.server, options.port, options.serverpassword, options.botname, PROG_STRING, PROG_STRING);
+	verbose("connecting to server: %s:%d (%s)%s\n", options.server, options.port, address, (options.ssl) ? " using ssl" : "");
+    if (options.ssl && tls_available() )
+    {
+        /* Our own tls connection keeps the session, so a reconnect can resume it; libircclient talks to it over the loopback */
+        if ( (port = tls_open(address, options.port) ) == 0) return false;
+        retval = irc_connect(session, "127.0.0.1", port, options.serverpassword, options.botname, PROG_STRING, PROG_STRING);
+        if (retval == 0) tls_expect(irc_socket() );
+    }
+    else
+    {
+        /* libircclient connects using ssl when the server name starts with a '#' */
+        (void) snprintf(server, sizeof(server), "%s%s", (options.ssl) ? "#" : "", address);
+
+        if (ipv6) retval = irc_connect6(session, server, options.port, options.serverpassword, options.botname, PROG_STRING, PROG_STRING);
+        else retval = irc_connect(session, server, options.port, options.serverpassword, options.botname, PROG_STRING, PROG_STRING);
+    }
 	if (retval != 0) 
     {
         error("connect: %d: %s\n", retval, irc_strerror(irc_errno(session) ) ); 
+#ifdef LIBIRC_ERR_SSL_NOT_SUPPORTED
+        if (irc_errno(session) == LIBIRC_ERR_SSL_NOT_SUPPORTED) error("libircclient was build without ssl support\n");
+#endif
     }
     else debug("irc session is ready\n");
 
 	return (irc_is_connected(session) == 1) ? true : false;
 }
 
+void process_irc_connect()
+{
+    bool ipv6 = false;
+    char address[INET6_ADDRSTRLEN];
+    enum resolve_results result = resolve_pending;
+
+    if (resolve_is_pending() == false) return;
+
+    if ( (result = resolve_address(address, sizeof(address), &ipv6) ) == resolve_found)
+    {
+        (void) connect_irc_session(address, ipv6);
+    }
+    else if (result == resolve_failed)
+    {
+        /* Resolving the name again would only block the loop; check_irc_connection() retries later */
+        warning("no address of %s to connect to; retrying in %ld seconds\n", options.server, (long) options.connection_timeout);
+    }
+}
+
+irc_session_t *create_replay_session()
+{
+    return (setup_irc_session() ) ? session : NULL;
+}
+
 bool create_irc_session()
 {
+    static bool first_session = true;
+
+    if (first_session == false) metric_add(metric_reconnects, 1);
+    first_session = false;
+
     if (setup_irc_session() )
     {
-        return connect_irc_session();
+        options.connected = false;
+        last_contact = time(NULL);
+
+        /* libircclient connects once the address is known; without room in the cache it does the lookup itself */
+        if (resolve_start(options.server) ) return true;
+        return connect_irc_session(options.server, false);
     }
     return false;
 }
@@ -196,7 +526,9 @@ bool check_irc_connection()
 {
     time_t current_time = time(NULL);
     time_t timeout = current_time - last_contact;
-    irc_send_raw(session, "PING %s\n", options.channels[0]);
+    /* The ping is timed once it is written, see control_written() */
+    (void) irc_send_control("PING %s", options.channels[0]);
+    resolve_poll();
 
     if (options.connected)
     {
@@ -214,6 +546,7 @@ bool check_irc_connection()
         {
             warning("no connection with the server yet; retrying (%ld seconds)\n", timeout);
             options.botname_nr = 0;
+            resolve_demote(options.server);
 
             return create_irc_session();
         }
@@ -227,7 +560,12 @@ int process_irc(fd_set *in_set, fd_set *out_set)
 
     if (is_irc_connected() )
     {
-        if ( (retval = irc_process_select_descriptors(session, in_set, out_set) ) != 0)
+        retval = irc_process_select_descriptors(session, in_set, out_set);
+
+        /* The socket may have drained; control messages which had to wait go first */
+        (void) irc_flush_control();
+
+        if (retval != 0)
         {
             int err = irc_errno(session);
             //if (err != 0) error("process irc[%d]: %s\n", err, irc_strerror(err ) );
@@ -237,6 +575,19 @@ int process_irc(fd_set *in_set, fd_set *out_set)
                 error("Could not connect to server.\n");
             }
         }
+
+        /* 
+           Start capability negotiation as soon as libircclient has registered
+           us; sending fails until the tcp connection is established.
+         */
+        if (cap_requested == false && is_irc_connected() )
+        {
+            if (irc_send_control("CAP LS 302") == 0)
+            {
+                debug("negotiating capabilities\n");
+                cap_requested = true;
+            }
+        }
     }
 
     return retval;
@@ -250,6 +601,54 @@ int close_irc_session()
 	return 0;
 }
 
+bool irc_cap_enabled(enum irc_capabilities cap)
+{
+    return ( (caps_enabled & cap) > 0) ? true : false;
+}
+
+int irc_max_targets()
+{
+    return max_targets;
+}
+
+int irc_text_budget(size_t targets_len)
+{
+    int prefix = 1 + strlen(options.botname) + 1 + IRC_USER_MAX + 1 + IRC_HOST_MAX + 1;
+
+    return IRC_LINE_LEN - 2 - prefix - (int) strlen("PRIVMSG ") - (int) targets_len - (int) strlen(" :");
+}
+
+int irc_send_ctcp(const char *nick, const char *format, ...)
+{
+    char request[IRC_CONTROL_LEN];
+    va_list args;
+
+    va_start(args, format);
+    (void) vsnprintf(request, sizeof(request), format, args);
+    va_end(args);
+
+    return irc_send_control("PRIVMSG %s :\001%s\001", nick, request);
+}
+
+bool irc_local_address(struct in_addr *address)
+{
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    int fd = -1;
+
+    if (is_irc_connected() == false) return false;
+
+    /* With our own tls connection libircclient only talks to the loopback interface */
+    if ( (fd = tls_socket() ) < 0 && (fd = irc_socket() ) < 0) return false;
+
+    if (getsockname(fd, (struct sockaddr *) &local, &len) == 0 && local.sin_family == AF_INET)
+    {
+        *address = local.sin_addr;
+        return true;
+    }
+    return false;
+}
+
 bool is_irc_connected()
 {
     return (irc_is_connected(session) == 1) ? true : false;
@@ -262,8 +661,36 @@ int irc_send_raw_msg(const char *message, const char *channel)
         int retval = 0;
 		if ( (retval = irc_cmd_msg(session, channel, message) ) != 0)
 		{
-			error("irc message[%d]: %s\n", retval, irc_strerror(irc_errno(session) ) );
+            /* The message stays at the head of its queue, and is tried again */
+            if (irc_errno(session) != LIBIRC_ERR_NOMEM)
+            {
+                error("irc message[%d]: %s\n", retval, irc_strerror(irc_errno(session) ) );
+            }
+            else debug("output buffer is full; message waits\n");
+            return 1;
 		}
+        else
+        {
+            const char *target = channel;
+
+            /* PRIVMSG <channel> :<message>\r\n */
+            metric_add(metric_messages_sent, 1);
+            metric_add(metric_bytes_sent, strlen(channel) + strlen(message) +12);
+
+            /* A message to several channels counts for each of them */
+            while (target != NULL)
+            {
+                char name[MAX_CHANNELS_NAMELEN];
+                const char *comma = strchr(target, ',');
+                size_t len = (comma != NULL) ? (size_t) (comma - target) : strlen(target);
+
+                if (len >= sizeof(name) ) len = sizeof(name) -1;
+                memcpy(name, target, len);
+                name[len] = '\0';
+                metric_channel(name, true);
+                target = (comma != NULL) ? comma +1 : NULL;
+            }
+        }
 		return 0;
 	}
 
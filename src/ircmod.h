@@ -1,6 +1,8 @@
 #ifndef ircmod_h_
 #define ircmod_h_
 
+#include <netinet/in.h>
+
 #include "def.h"
 #include "main.h"
 
@@ -12,7 +14,29 @@
     #error "ircclibclient.h not available"
 #endif
 
+#define IRC_CONTROL_QUEUE   (16)
+#define IRC_CONTROL_LEN     (512)
+#define IRC_LINE_LEN        (512)   /* a line the server relays, with its \r\n */
+#define IRC_USER_MAX        (11)    /* USERLEN, with the '~' of a user without ident */
+#define IRC_HOST_MAX        (63)
+
+/**
+* IRCv3 capabilities irccmd knows how to use.
+*/
+enum irc_capabilities
+{
+    cap_none         = 0,
+    cap_echo_message = 1,
+};
+
 bool create_irc_session();
+
+/**
+* Creates a session which is never connected, for replaying recorded events.
+*
+* @return the session, or NULL on failure.
+*/
+irc_session_t *create_replay_session();
 int close_irc_session();
 bool join_irc_channel(char *channel, char *password);
 bool part_irc_channel(char *channel);
@@ -20,9 +44,65 @@ bool is_irc_connected();
 
 int add_irc_descriptors(fd_set *in_set, fd_set *out_set, int *maxfd);
 int process_irc(fd_set *in_set, fd_set *out_set);
+
+/**
+* Lets libircclient connect a new session, once the address of the server is known.
+* Called every loop, also when select() timed out.
+*/
+void process_irc_connect();
 bool check_irc_connection();
 
 irc_callbacks_t *get_callback();
+bool irc_cap_enabled(enum irc_capabilities cap);
+
+/**
+* Sends a PRIVMSG to one or more comma separated channels.
+*
+* @return 0 when the message was handed to libircclient; otherwise 1, and the
+*         message should be kept to be send again.
+*/
 int irc_send_raw_msg(const char *message, const char *channel);
 
+/**
+* Writes the control messages which are waiting for room in the output buffer.
+* Queued data is only send when this returns true.
+*
+* @return true when no control message is waiting.
+*/
+bool irc_flush_control();
+
+/**
+* @return the number of channels a single PRIVMSG may name; 1 until the server tells otherwise.
+*/
+int irc_max_targets();
+
+/**
+* Tells how much text a PRIVMSG may carry, so the line still fits IRC_LINE_LEN once
+* the server has put our ":nick!user@host" prefix in front of it. The user and host
+* are not known to us, so their longest forms are assumed.
+*
+* @param targets_len the length of the comma separated targets of the message.
+* @return the bytes left for the text; may be 0 or less.
+*/
+int irc_text_budget(size_t targets_len);
+
+/**
+* Sends a CTCP request to a nick through the control lane, so it does not wait
+* behind queued data.
+*
+* @param nick the receiver.
+* @param format the request, without the \001 delimiters.
+* @return 0 when the request was written or queued, otherwise 1.
+*/
+int irc_send_ctcp(const char *nick, const char *format, ...);
+
+/**
+* Finds the local IPv4 address of the connection with the server, which is the
+* address other clients can reach us on in the most cases.
+*
+* @param address receives the address.
+* @return false when we are not connected, or not over IPv4.
+*/
+bool irc_local_address(struct in_addr *address);
+
 #endif /*ircmod_h_*/
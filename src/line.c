@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "line.h"
+
+static const char *skip_space(const char *p, const char *end)
+{
+    while (p < end && isspace( (unsigned char) *p) ) p++;
+    return p;
+}
+
+static const char *skip_word(const char *p, const char *end)
+{
+    while (p < end && isspace( (unsigned char) *p) == 0) p++;
+    return p;
+}
+
+static const char *trim_end(const char *start, const char *end)
+{
+    while (end > start && isspace( (unsigned char) end[-1]) ) end--;
+    return end;
+}
+
+void tokenize_command(const char *line, size_t len, struct line_tokens *tokens)
+{
+    const char *end = trim_end(line, line + len);
+    const char *p = skip_space(line, end);
+    const char *word_end = skip_word(p, end);
+
+    memset(tokens, 0, sizeof(*tokens) );
+    tokens->command.start = p;
+    tokens->command.len = word_end - p;
+
+    p = skip_space(word_end, end);
+    tokens->args.start = p;
+    tokens->args.len = end - p;
+}
+
+void tokenize_message(const char *line, size_t len, struct line_tokens *tokens)
+{
+    const char *end = trim_end(line, line + len);
+    const char *p = skip_space(line, end);
+
+    memset(tokens, 0, sizeof(*tokens) );
+
+    /* A message starting with a '#channel', an '@group' or, when enabled, a '*' for every channel names its target */
+    if (p < end && (*p == '#' || *p == '@' || (options.broadcast && *p == '*' && skip_word(p, end) == p +1) ) )
+    {
+        const char *word_end = skip_word(p, end);
+
+        tokens->target.start = p;
+        tokens->target.len = word_end - p;
+        if (word_end == end) return;
+
+        p = skip_space(word_end, end);
+    }
+
+    tokens->body.start = p;
+    tokens->body.len = end - p;
+}
+
+void tokenize_line(const char *line, size_t len, struct line_tokens *tokens)
+{
+    if (len > 0 && line[0] == '/') tokenize_command(line, len, tokens);
+    else tokenize_message(line, len, tokens);
+}
+
+size_t sgets(int fd, char *line, size_t size)
+{
+    size_t i;
+    for ( i = 0; i < size - 1; ++i )
+    {
+        char ch = 0;
+        if (read(fd, &ch, sizeof(ch) ) == 0) ch = EOF;
+        if ( ch == '\n' || ch == EOF )
+        {
+            break;
+        }
+        line[i] = ch;
+    }
+    line[i] = '\0';
+
+    return i;
+}
+
+int get_group(const char *name, size_t len)
+{
+    int group_id = 0;
+
+    for (group_id = 0; group_id < options.no_groups; group_id++)
+    {
+        if (strncmp(options.groups[group_id].name, name, len) == 0 && options.groups[group_id].name[len] == '\0') return group_id;
+    }
+
+    return -1;
+}
+
+int get_channel(const char *channel, size_t len, int default_id)
+{
+    int channel_id = 0;
+
+    while (strncmp(options.channels[channel_id], channel, len) != 0 || options.channels[channel_id][len] != '\0')
+    {
+        channel_id++;
+        if (channel_id >= options.no_channels)
+        {
+            channel_id = default_id;
+            if (default_id >= 0) debug("channel %.*s not found, defaulting to %s\n", (int) len, channel, options.channels[channel_id]);
+            break;
+        }
+    }
+
+    return channel_id;
+}
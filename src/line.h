@@ -0,0 +1,92 @@
+#ifndef line_h_
+#define line_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+* A part of a line. It points into the line and is not terminated.
+*/
+struct line_view
+{
+    const char *start;
+    size_t len;
+};
+
+/**
+* The parts of a line, as found by tokenize_line(). Parts which are not
+* present have a length of zero.
+*/
+struct line_tokens
+{
+    struct line_view command;   /* '/join' when the line is a command */
+    struct line_view args;      /* the arguments of the command */
+    struct line_view target;    /* '#channel', '@group' or '*' when a message starts with one */
+    struct line_view body;      /* the message; start is NULL when a target has no message */
+};
+
+/** 
+* Splits a line in its parts in a single pass, without modifying or copying it.
+* A line starting with a '/' is a command with arguments, otherwise it is a message
+* which may start with a '#channel', an '@group' or, with options.broadcast, a '*'. Surrounding white-space is left out of every part.
+* 
+* @param line the line.
+* @param len the length of the line.
+* @param tokens receives the parts of the line.
+*/
+void tokenize_line(const char *line, size_t len, struct line_tokens *tokens);
+
+/** 
+* Splits a message in its target, if any, and the message itself. The target is a
+* '#channel', an '@group' or a '*' for every channel. A '*' is only a target with
+* options.broadcast, since it also starts ordinary text; the target of a frame
+* may always be '*'.
+* 
+* @param line the line.
+* @param len the length of the line.
+* @param tokens receives the parts of the line.
+*/
+void tokenize_message(const char *line, size_t len, struct line_tokens *tokens);
+
+/** 
+* Splits a line in a command and its arguments, also when the command has no '/'.
+* 
+* @param line the line.
+* @param len the length of the line.
+* @param tokens receives the parts of the line.
+*/
+void tokenize_command(const char *line, size_t len, struct line_tokens *tokens);
+
+/** 
+* reads a line from a file
+* 
+* @param fd file descriptor of the file to read
+* @param line pointer to the storage where the read line should reside
+* @param size the maximum size of the given storage
+* 
+* @return the number of characters read
+*/
+size_t sgets(int fd, char *line, size_t size);
+
+/** 
+* Looks up a channel in the configured channels.
+* 
+* @param channel the (start of the) name of the channel; it does not have to be terminated.
+* @param len the length of the name.
+* @param default_id the id to return when the channel is not configured, or -1.
+* 
+* @return the id of the channel.
+*/
+int get_channel(const char *channel, size_t len, int default_id);
+
+/** 
+* Looks up a group of channels in the configured groups.
+* 
+* @param name the name of the group, without the '@'; it does not have to be terminated.
+* @param len the length of the name.
+* 
+* @return the id of the group, or -1 when the group is not configured.
+*/
+int get_group(const char *name, size_t len);
+
+#endif /*line_h_*/
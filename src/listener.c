@@ -0,0 +1,451 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "listener.h"
+
+/**
+* A listening socket and the handler for the lines of its clients.
+*/
+struct listener
+{
+    int fd;
+    bool unix_socket;
+    char path[MAX_PATH_LEN];
+    char target[MAX_CHANNELS_NAMELEN];  /* Default channel of the clients; empty for the current channel */
+    client_line_handler handler;
+};
+
+static struct listener listeners[LISTENER_MAX_LISTENERS];
+static struct client clients[LISTENER_MAX_CLIENTS];
+static int no_listeners = 0;
+static bool initialised = false;
+
+static void listener_init()
+{
+    int counter = 0;
+
+    if (initialised) return;
+    for (counter = 0; counter < LISTENER_MAX_CLIENTS; counter++) clients[counter].fd = -1;
+    initialised = true;
+}
+
+/**
+* Closes the connection with a client at once; pending replies are lost.
+*/
+static void client_drop(struct client *client)
+{
+    debug("closing client %d\n", client->fd);
+    close(client->fd);
+    free(client->out);
+    client->out = NULL;
+    client->out_len = 0;
+    client->out_size = 0;
+    client->closing = false;
+    client->fd = -1;
+    client->len = 0;
+}
+
+void client_close(struct client *client)
+{
+    if (client->fd < 0) return;
+
+    if (client->out_len > 0)
+    {
+        client->closing = true;
+        return;
+    }
+    client_drop(client);
+}
+
+/**
+* Takes a free client slot for the descriptor.
+*
+* @return the client, or NULL when all slots are taken.
+*/
+static struct client *client_add(int fd, const char *target, client_line_handler handler)
+{
+    int counter = 0;
+
+    listener_init();
+    for (counter = 0; counter < LISTENER_MAX_CLIENTS; counter++)
+    {
+        if (clients[counter].fd < 0)
+        {
+            struct client *client = &clients[counter];
+
+            memset(client, 0, sizeof(*client) );
+            client->fd = fd;
+            client->handler = handler;
+            if (target == NULL || strlen(target) == 0) target = options.channels[options.current_channel_id];
+            strncpy(client->target, target, MAX_CHANNELS_NAMELEN -1);
+            (void) fcntl(fd, F_SETFL, O_NONBLOCK);
+            return client;
+        }
+    }
+    return NULL;
+}
+
+static void client_accept(struct listener *listener)
+{
+    int fd = accept(listener->fd, NULL, NULL);
+
+    if (fd < 0)
+    {
+        if (errno != EAGAIN && errno != EINTR) warning("could not accept connection on %s\n", listener->path);
+        return;
+    }
+
+    if (client_add(fd, listener->target, listener->handler) != NULL)
+    {
+        debug("accepted client %d on %s\n", fd, listener->path);
+        return;
+    }
+
+    warning("too many clients on %s; refusing connection\n", listener->path);
+    close(fd);
+}
+
+bool listener_add_reader(int fd, const char *name, const char *target, client_line_handler handler)
+{
+    if (client_add(fd, target, handler) == NULL)
+    {
+        error("too many clients; cannot read %s\n", name);
+        return false;
+    }
+
+    debug("reading %s as client %d\n", name, fd);
+    return true;
+}
+
+/**
+* Hands the complete lines in the buffer of the client to its handler.
+*
+* @param client the client to process.
+* @param eof true when the client has closed; the last partial line is then handled as well.
+*/
+static void client_lines(struct client *client, bool eof)
+{
+    size_t start = 0;
+    size_t counter = 0;
+    char line[LISTENER_BUFSIZE];
+
+    for (counter = 0; counter < client->len; counter++)
+    {
+        if (client->buf[counter] == '\n')
+        {
+            size_t len = counter - start;
+            if (len > 0 && client->buf[counter -1] == '\r') len--;
+
+            memcpy(line, &client->buf[start], len);
+            line[len] = '\0';
+            if (len > 0)
+            {
+                client->lines++;
+                client->handler(client, line);
+            }
+
+            /* The handler may have closed the client */
+            if (client->fd < 0 || client->closing) return;
+            start = counter +1;
+        }
+    }
+
+    /* Keep the partial line; a line which fills the whole buffer is handled as is */
+    if (client->len > start && (eof || (start == 0 && client->len == sizeof(client->buf) -1) ) )
+    {
+        memcpy(line, &client->buf[start], client->len - start);
+        line[client->len - start] = '\0';
+        start = client->len;
+        client->lines++;
+        client->handler(client, line);
+    }
+
+    if (client->fd >= 0 && client->closing == false)
+    {
+        memmove(client->buf, &client->buf[start], client->len - start);
+        client->len -= start;
+    }
+}
+
+static void client_read(struct client *client)
+{
+    ssize_t result = read(client->fd, &client->buf[client->len], sizeof(client->buf) - client->len -1);
+
+    if (result > 0)
+    {
+        client->len += result;
+        client_lines(client, false);
+    }
+    else if (result == 0 || (errno != EAGAIN && errno != EINTR) )
+    {
+        if (client->len > 0) client_lines(client, true);
+        if (client->fd >= 0) client_close(client);
+    }
+}
+
+static struct listener *listener_add(int fd, const char *path, const char *target, client_line_handler handler)
+{
+    struct listener *listener = &listeners[no_listeners++];
+
+    (void) fcntl(fd, F_SETFL, O_NONBLOCK);
+    listener->fd = fd;
+    listener->handler = handler;
+    memset(listener->path, '\0', sizeof(listener->path) );
+    strncpy(listener->path, path, sizeof(listener->path) -1);
+    memset(listener->target, '\0', sizeof(listener->target) );
+    if (target != NULL) strncpy(listener->target, target, sizeof(listener->target) -1);
+
+    verbose("listening on %s\n", path);
+    return listener;
+}
+
+bool listener_open_unix(const char *path, const char *target, client_line_handler handler)
+{
+    struct sockaddr_un addr;
+    int fd = -1;
+
+    listener_init();
+    if (no_listeners >= LISTENER_MAX_LISTENERS)
+    {
+        error("too many listeners\n");
+        return false;
+    }
+
+    if (strlen(path) >= sizeof(addr.sun_path) )
+    {
+        error("socket path %s is too long\n", path);
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) -1);
+
+    if ( (fd = socket(AF_UNIX, SOCK_STREAM, 0) ) < 0)
+    {
+        error("could not create socket %s: %s\n", path, strerror(errno) );
+        return false;
+    }
+
+    /* Remove a socket left behind by a previous run */
+    (void) unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr) ) != 0 || listen(fd, LISTENER_MAX_CLIENTS) != 0)
+    {
+        error("could not listen on %s: %s\n", path, strerror(errno) );
+        close(fd);
+        return false;
+    }
+
+    listener_add(fd, path, target, handler)->unix_socket = true;
+    return true;
+}
+
+bool listener_open_tcp(int port, const char *target, client_line_handler handler)
+{
+    struct sockaddr_in addr;
+    char name[30];
+    int fd = -1;
+    int one = 1;
+
+    listener_init();
+    if (no_listeners >= LISTENER_MAX_LISTENERS)
+    {
+        error("too many listeners\n");
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    (void) snprintf(name, sizeof(name), "127.0.0.1:%d", port);
+
+    if ( (fd = socket(AF_INET, SOCK_STREAM, 0) ) < 0)
+    {
+        error("could not create socket %s: %s\n", name, strerror(errno) );
+        return false;
+    }
+
+    (void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) );
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr) ) != 0 || listen(fd, LISTENER_MAX_CLIENTS) != 0)
+    {
+        error("could not listen on %s: %s\n", name, strerror(errno) );
+        close(fd);
+        return false;
+    }
+
+    listener_add(fd, name, target, handler)->unix_socket = false;
+    return true;
+}
+
+void listener_close_all()
+{
+    int counter = 0;
+
+    listener_init();
+    for (counter = 0; counter < LISTENER_MAX_CLIENTS; counter++)
+    {
+        if (clients[counter].fd >= 0) client_drop(&clients[counter]);
+    }
+
+    for (counter = 0; counter < no_listeners; counter++)
+    {
+        close(listeners[counter].fd);
+        if (listeners[counter].unix_socket) (void) unlink(listeners[counter].path);
+    }
+    no_listeners = 0;
+}
+
+void listener_add_descriptors(fd_set *in_set, fd_set *out_set, int *maxfd)
+{
+    time_t now = time(NULL);
+    int counter = 0;
+
+    for (counter = 0; counter < no_listeners; counter++)
+    {
+        FD_SET(listeners[counter].fd, in_set);
+        if (listeners[counter].fd > *maxfd) *maxfd = listeners[counter].fd;
+    }
+
+    for (counter = 0; counter < LISTENER_MAX_CLIENTS && initialised; counter++)
+    {
+        struct client *client = &clients[counter];
+
+        if (client->fd < 0) continue;
+        if (client->out_len > 0 && (now - client->out_since) > LISTENER_WRITE_TIMEOUT)
+        {
+            warning("client %d has not taken its replies for %d seconds; closing it\n", client->fd, LISTENER_WRITE_TIMEOUT);
+            client_drop(client);
+            continue;
+        }
+
+        if (client->closing == false) FD_SET(client->fd, in_set);
+        if (client->out_len > 0) FD_SET(client->fd, out_set);
+        if (client->fd > *maxfd) *maxfd = client->fd;
+    }
+}
+
+/**
+* Sends the pending replies which the client can take now.
+*/
+static void client_flush(struct client *client)
+{
+    ssize_t result = write(client->fd, client->out, client->out_len);
+
+    if (result < 0)
+    {
+        if (errno == EAGAIN || errno == EINTR) return;
+        debug("client %d is gone: %s\n", client->fd, strerror(errno) );
+        client_drop(client);
+        return;
+    }
+
+    memmove(client->out, &client->out[result], client->out_len - result);
+    client->out_len -= result;
+    client->out_since = time(NULL);
+    if (client->out_len == 0 && client->closing) client_drop(client);
+}
+
+void listener_process(fd_set *in_set, fd_set *out_set)
+{
+    int counter = 0;
+
+    for (counter = 0; counter < LISTENER_MAX_CLIENTS && initialised; counter++)
+    {
+        struct client *client = &clients[counter];
+
+        if (client->fd >= 0 && client->out_len > 0 && FD_ISSET(client->fd, out_set) ) client_flush(client);
+        if (client->fd >= 0 && client->closing == false && FD_ISSET(client->fd, in_set) ) client_read(client);
+    }
+
+    for (counter = 0; counter < no_listeners; counter++)
+    {
+        if (FD_ISSET(listeners[counter].fd, in_set) ) client_accept(&listeners[counter]);
+    }
+}
+
+/**
+* Keeps the part of a reply which the client could not take yet.
+*
+* @return false when the client has too much pending already.
+*/
+static bool client_keep(struct client *client, const char *buf, size_t len)
+{
+    if (client->out_len + len > LISTENER_MAX_OUTPUT) return false;
+
+    if (client->out_len + len > client->out_size)
+    {
+        size_t size = (client->out_size > 0) ? client->out_size : LISTENER_BUFSIZE;
+        char *out = NULL;
+
+        while (size < client->out_len + len) size *= 2;
+        if ( (out = realloc(client->out, size) ) == NULL) return false;
+        client->out = out;
+        client->out_size = size;
+    }
+
+    if (client->out_len == 0) client->out_since = time(NULL);
+    memcpy(&client->out[client->out_len], buf, len);
+    client->out_len += len;
+    return true;
+}
+
+int client_write(struct client *client, const char *buf, size_t len)
+{
+    size_t written = 0;
+
+    if (client->fd < 0 || client->closing) return -1;
+
+    /* A reply may not overtake the pending ones */
+    while (client->out_len == 0 && written < len)
+    {
+        ssize_t result = write(client->fd, &buf[written], len - written);
+        if (result < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) break;
+            debug("client %d is gone: %s\n", client->fd, strerror(errno) );
+            client_drop(client);
+            return -1;
+        }
+        written += result;
+    }
+
+    if (written < len && client_keep(client, &buf[written], len - written) == false)
+    {
+        warning("client %d does not take its replies; closing it\n", client->fd);
+        client_drop(client);
+        return -1;
+    }
+    return len;
+}
+
+int client_printf(struct client *client, const char *format, ...)
+{
+    char reply[LISTENER_BUFSIZE];
+    va_list args;
+    int len = 0;
+
+    if (client->fd < 0) return -1;
+
+    va_start(args, format);
+    len = vsnprintf(reply, sizeof(reply), format, args);
+    va_end(args);
+
+    if (len < 0) return -1;
+    if (len >= (int) sizeof(reply) ) len = sizeof(reply) -1;
+
+    return client_write(client, reply, len);
+}
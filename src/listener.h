@@ -0,0 +1,107 @@
+#ifndef listener_h_
+#define listener_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/select.h>
+
+#include "main.h"
+
+#define LISTENER_MAX_LISTENERS  (4 + MAX_INPUTS)
+#define LISTENER_MAX_CLIENTS    (16 + MAX_INPUTS)
+#define LISTENER_BUFSIZE        (9000)
+#define LISTENER_MAX_OUTPUT     (1024 * 1024)   /* replies a client has not taken yet, at most */
+#define LISTENER_WRITE_TIMEOUT  (10)            /* seconds a client may take no replies before it is closed */
+
+struct client;
+
+/**
+* Called for every complete line a client sends. The line is a copy and may be modified.
+*/
+typedef void (*client_line_handler)(struct client *client, char *line);
+
+/**
+* A connection accepted on one of the listeners.
+*/
+struct client
+{
+    int fd;
+    char buf[LISTENER_BUFSIZE];
+    size_t len;
+    char target[MAX_CHANNELS_NAMELEN];  /* Default channel for the messages of this client */
+    unsigned long lines;                /* the lines handed to the handler, the current one included */
+    client_line_handler handler;
+    char *out;                          /* replies the client has not taken yet; they are send when it is writable */
+    size_t out_len;
+    size_t out_size;
+    time_t out_since;                   /* the last time the client took a reply */
+    bool closing;                       /* closed once the pending replies are send */
+};
+
+/**
+* Creates a unix domain socket at the given path and listens on it.
+* A stale socket file at that path is removed first.
+*
+* @param path the path of the socket.
+* @param target the default channel of the clients, or NULL for the current channel.
+* @param handler the function which will receive the lines of the clients.
+*
+* @return true on success, otherwise false.
+*/
+bool listener_open_unix(const char *path, const char *target, client_line_handler handler);
+
+/**
+* Listens on the given tcp port of the loopback interface.
+*
+* @param port the port to listen on.
+* @param target the default channel of the clients, or NULL for the current channel.
+* @param handler the function which will receive the lines of the clients.
+*
+* @return true on success, otherwise false.
+*/
+bool listener_open_tcp(int port, const char *target, client_line_handler handler);
+
+/**
+* Reads the lines of an open descriptor, like a fifo or a file, as if it were a client.
+* The descriptor is closed at end of file.
+*
+* @param fd the descriptor.
+* @param name the name of the descriptor, used for reporting.
+* @param target the default channel of the lines, or NULL for the current channel.
+* @param handler the function which will receive the lines.
+*
+* @return true on success, false when there are too many clients.
+*/
+bool listener_add_reader(int fd, const char *name, const char *target, client_line_handler handler);
+
+/**
+* Closes all listeners and clients, and removes the socket files.
+*/
+void listener_close_all();
+
+void listener_add_descriptors(fd_set *in_set, fd_set *out_set, int *maxfd);
+void listener_process(fd_set *in_set, fd_set *out_set);
+
+/**
+* Closes the connection with a client, once its pending replies are send. Can be
+* called from a line handler.
+*/
+void client_close(struct client *client);
+
+/**
+* Sends the whole buffer to a client. What the client cannot take at once is kept,
+* and send when it is writable; the main loop never waits for a client. A client
+* which lets more than LISTENER_MAX_OUTPUT bytes pile up is closed.
+*
+* @return the number of bytes written or kept, or -1 when the client is gone.
+*/
+int client_write(struct client *client, const char *buf, size_t len);
+
+/**
+* Sends a formatted reply to a client.
+*
+* @return the number of bytes written, or -1 on error.
+*/
+int client_printf(struct client *client, const char *format, ...);
+
+#endif /*listener_h_*/
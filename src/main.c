@@ -2,6 +2,7 @@
 #include <unistd.h>
 #include <signal.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <fcntl.h>
 
@@ -16,6 +17,21 @@
 #include "configdefaults.h"
 #include "ircmod.h"
 #include "input.h"
+#include "buffer.h"
+#include "listener.h"
+#include "submit.h"
+#include "commands.h"
+#include "inputs.h"
+#include "follow.h"
+#include "dedup.h"
+#include "fragment.h"
+#include "dcc.h"
+#include "resolve.h"
+#include "tls.h"
+#include "metrics.h"
+#include "output.h"
+#include "trace.h"
+#include "record.h"
 
 /** 
 * This is the config structure where all the important configuration options are located.
@@ -34,9 +50,14 @@ struct config_options options =
     .showchannel          = CONFIG_SHOWCHANNEL,       /**< This will enable showing of the channel in the irc output */
     .shownick             = CONFIG_SHOWNICK,          /**< This will enable showing of the nickname in the irc output */
     .showjoins            = CONFIG_SHOWJOINS,
+    .broadcast            = CONFIG_BROADCAST,         /**< a line starting with '* ' is send to every channel; off, as '*' also starts ordinary text */
 
     .mode                 = CONFIG_MODE,              /**< this will define the mode of the application */
+    .input_format         = CONFIG_INPUT_FORMAT,      /**< how the messages on stdin are framed */
     .port                 = CONFIG_PORT,              /**< this will hold the port which should be used to connect to the irc server */
+    .ssl                  = CONFIG_SSL,               /**< connect to the irc server using ssl/tls */
+    .ssl_verify           = CONFIG_SSL_VERIFY,        /**< verify the certificate of the irc server when using ssl/tls */
+    .ssl_session_file     = CONFIG_SSL_SESSION_FILE,  /**< keeps the tls session across restarts, so a reconnect can resume it; empty keeps it in memory */
     .server               = CONFIG_SERVER,            /**< this will hold the server url or ip which should be used to connect to the irc server */
     .serverpassword       = CONFIG_SERVERPASSWORD,    /**< this will hold the password neccesary to connect to the irc server; this can be empty */
     .channels             = {CONFIG_CHANNEL},         /**< this will hold the channel name, including '#' the bot would like to  join */
@@ -52,12 +73,34 @@ struct config_options options =
     .current_channel_id   = 0,
     .retry_init_connect   = false,
     .connection_timeout   = CONFIG_CONNECTION_TIMEOUT,
+    .dns_ttl              = CONFIG_DNS_TTL,           /**< the number of seconds the addresses of the server are cached */
     .ping_count           = 0,
     .output_flood_timeout = CONFIG_OUTGOING_FLOOD_TIMEOUT,
+    .dedup_window         = CONFIG_DEDUP_WINDOW,      /**< the msec within which repeated messages are suppressed; 0 disables it */
+    .fragment_size        = CONFIG_FRAGMENT_SIZE,     /**< longer messages are send in fragments, and fragments are reassembled; 0 disables it */
+    .queue_size           = CONFIG_QUEUE_SIZE,        /**< the number of outbound messages kept in memory */
+    .spoolfile            = CONFIG_SPOOLFILE,         /**< outbound messages which do not fit in memory are appended to this file; empty disables spooling */
+    .daemon               = false,                    /**< keep running and accept messages from '--submit' clients on the socket */
+    .submit               = false,                    /**< hand stdin to a running daemon instead of connecting ourselves */
+    .socketpath           = CONFIG_SOCKET,            /**< the unix socket of the daemon */
+    .controlpath          = CONFIG_CONTROL,           /**< the unix socket on which commands are accepted; empty disables it */
+    .metrics_port         = CONFIG_METRICS_PORT,      /**< the local tcp port for the metrics; 0 disables it */
+    .metricspath          = CONFIG_METRICS_SOCKET,    /**< the unix socket for the metrics; empty disables it */
+    .dump_metrics         = false,
+    .tracefile            = CONFIG_TRACEFILE,         /**< the file the stages of every message are written to; empty disables it */
+    .recordfile           = CONFIG_RECORDFILE,        /**< the file all irc events are recorded to; empty disables it */
+    .replayfile           = "",                       /**< a recording to replay instead of connecting */
+    .replay_realtime      = false,                    /**< replay at the recorded pace instead of as fast as possible */
+    .followfile           = CONFIG_FOLLOWFILE,        /**< the file which is followed like tail -F; empty disables it */
+    .followstate          = CONFIG_FOLLOWSTATE,       /**< the checkpoint of the followed file; empty for the default */
+    .send_nick            = "",                       /**< the nick '--send_file' offers the file to */
+    .send_file            = "",                       /**< the file which is send over DCC; empty when nothing is send */
+    .receive_dir          = CONFIG_RECEIVE_DIR,       /**< files offered over DCC are accepted into this directory; empty refuses them */
+    .dcc_address          = CONFIG_DCC_ADDRESS,       /**< the IPv4 address offered to DCC receivers; empty for the address of the irc connection */
 };
      
 /** 
-* A simple signal replacement for SIGINT and SIGHUP.
+* A simple signal replacement for SIGINT.
 * when called, this will gracefully end the program.
 */
 static void sigfunc()
@@ -66,6 +109,192 @@ static void sigfunc()
     options.running = false;
 }
 
+/** 
+* The signal handler for SIGHUP.
+* The config file will be reloaded by the main loop.
+*/
+static void sighup()
+{
+    debug("Received hangup\n");
+    options.reload = true;
+}
+
+/** 
+* The signal handler for SIGUSR1.
+* The metrics will be written to stderr by the main loop.
+*/
+static void sigusr1()
+{
+    options.dump_metrics = true;
+}
+
+/* The channels of the config files and the commandline; not those joined or parted at runtime */
+static char configured_channels[MAX_CHANNELS][MAX_CHANNELS_NAMELEN];
+static int no_configured_channels = 0;
+
+/**
+* @return the index of the channel in the list, or -1 when it is not in the list.
+*/
+static int channel_index(const char *channel, char list[][MAX_CHANNELS_NAMELEN], int no_channels)
+{
+    int counter = 0;
+
+    for (counter = 0; counter < no_channels; counter++)
+    {
+        if (strncmp(list[counter], channel, MAX_CHANNELS_NAMELEN) == 0) return counter;
+    }
+    return -1;
+}
+
+static void remember_configured_channels()
+{
+    memcpy(configured_channels, options.channels, sizeof(configured_channels) );
+    no_configured_channels = options.no_channels;
+}
+
+static void add_channel(const char *channel, const char *password, int weight, int priority)
+{
+    int index = options.no_channels++;
+
+    memset(options.channels[index], '\0', MAX_CHANNELS_NAMELEN);
+    memset(options.channelpasswords[index], '\0', MAX_PASSWD_LEN);
+    strncpy(options.channels[index], channel, MAX_CHANNELS_NAMELEN -1);
+    strncpy(options.channelpasswords[index], password, MAX_PASSWD_LEN -1);
+    options.channelweights[index] = weight;
+    options.channelpriorities[index] = priority;
+}
+
+/** 
+* Re-reads the config files and the commandline, while staying connected.
+* Only the channels which were added to or removed from the config are joined or
+* parted; channels which were joined or parted at runtime are left as they are. Settings
+* which are used per message, like plugins, output formats and the flood timeout,
+* take effect immediately. Settings of the connection itself, of the
+* outbound queue, the inputs and the followed file are kept until the next restart.
+*/
+static void reload_config()
+{
+    int counter = 0;
+    int index = 0;
+    int old_no_channels = options.no_channels;
+    char old_channels[MAX_CHANNELS][MAX_CHANNELS_NAMELEN];
+    char old_passwords[MAX_CHANNELS][MAX_PASSWD_LEN];
+    int old_weights[MAX_CHANNELS];
+    int old_priorities[MAX_CHANNELS];
+    int no_new_channels = 0;
+    char new_channels[MAX_CHANNELS][MAX_CHANNELS_NAMELEN];
+    char new_passwords[MAX_CHANNELS][MAX_PASSWD_LEN];
+    int new_weights[MAX_CHANNELS];
+    int new_priorities[MAX_CHANNELS];
+    char old_server[MAX_SERVER_NAMELEN];
+    char botname[MAX_BOT_NAMELEN];
+    char spoolfile[MAX_PATH_LEN];
+    char followfile[MAX_PATH_LEN];
+    int old_port = options.port;
+    bool old_ssl = options.ssl;
+    bool interactive = options.interactive;
+    enum modes mode = options.mode;
+    int queue_size = options.queue_size;
+    int maxlines = options.maxlines;
+    int no_inputs = options.no_inputs;
+    struct input_source inputs[MAX_INPUTS];
+
+    options.reload = false;
+    verbose("reloading config\n");
+
+    memcpy(old_channels, options.channels, sizeof(old_channels) );
+    memcpy(old_passwords, options.channelpasswords, sizeof(old_passwords) );
+    memcpy(old_weights, options.channelweights, sizeof(old_weights) );
+    memcpy(old_priorities, options.channelpriorities, sizeof(old_priorities) );
+    memcpy(old_server, options.server, sizeof(old_server) );
+    memcpy(botname, options.botname, sizeof(botname) );
+    memcpy(spoolfile, options.spoolfile, sizeof(spoolfile) );
+    memcpy(followfile, options.followfile, sizeof(followfile) );
+    memcpy(inputs, options.inputs, sizeof(inputs) );
+
+    /* Lists which are appended to by the config files start empty; tables which were removed stay empty */
+    options.no_pluginpaths = 0;
+    options.no_plugins = 0;
+    options.no_groups = 0;
+    memset(options.groups, 0, sizeof(options.groups) );
+    options.no_inputs = 0;
+    memset(options.inputs, 0, sizeof(options.inputs) );
+
+    (void) read_config_file(SYSTEM_CONFIG_FILE);
+    (void) read_config_file(options.configfile);
+    if (arg_parsesecondary() != 0) warning("commandline could not be applied again\n");
+    register_plugin_commands();
+
+    /* These belong to the running session */
+    memcpy(options.botname, botname, sizeof(botname) );
+    memcpy(options.spoolfile, spoolfile, sizeof(spoolfile) );
+    memcpy(options.followfile, followfile, sizeof(followfile) );
+    options.queue_size = queue_size;
+    options.maxlines = maxlines;
+    if (options.no_inputs != no_inputs || memcmp(options.inputs, inputs, sizeof(inputs) ) != 0)
+    {
+        warning("inputs changed; they will be used after a restart\n");
+    }
+    memcpy(options.inputs, inputs, sizeof(inputs) );
+    options.no_inputs = no_inputs;
+    options.interactive = interactive;
+    options.mode = mode;
+    if (options.interactive)
+    {
+        options.showchannel = true;
+        options.shownick = true;
+    }
+
+    if (strncmp(old_server, options.server, MAX_SERVER_NAMELEN) != 0 || old_port != options.port || old_ssl != options.ssl)
+    {
+        warning("server settings changed; they will be used after the next reconnect\n");
+    }
+
+    memcpy(new_channels, options.channels, sizeof(new_channels) );
+    memcpy(new_passwords, options.channelpasswords, sizeof(new_passwords) );
+    memcpy(new_weights, options.channelweights, sizeof(new_weights) );
+    memcpy(new_priorities, options.channelpriorities, sizeof(new_priorities) );
+    no_new_channels = options.no_channels;
+    options.no_channels = 0;
+
+    /* Part the channels which were removed from the config; the others keep their place, with the settings of the config */
+    for (counter = 0; counter < old_no_channels; counter++)
+    {
+        if ( (index = channel_index(old_channels[counter], new_channels, no_new_channels) ) >= 0)
+        {
+            add_channel(old_channels[counter], new_passwords[index], new_weights[index], new_priorities[index]);
+        }
+        else if (channel_index(old_channels[counter], configured_channels, no_configured_channels) < 0)
+        {
+            add_channel(old_channels[counter], old_passwords[counter], old_weights[counter], old_priorities[counter]);
+        }
+        else if (is_irc_connected() ) part_irc_channel(old_channels[counter]);
+    }
+
+    /* Join the channels which were added to the config */
+    for (counter = 0; counter < no_new_channels; counter++)
+    {
+        if (channel_index(new_channels[counter], configured_channels, no_configured_channels) >= 0) continue;
+        if (channel_index(new_channels[counter], options.channels, options.no_channels) >= 0) continue;
+
+        if (options.no_channels == MAX_CHANNELS)
+        {
+            warning("too many channels; not joining %s\n", new_channels[counter]);
+            continue;
+        }
+        add_channel(new_channels[counter], new_passwords[counter], new_weights[counter], new_priorities[counter]);
+        if (is_irc_connected() ) join_irc_channel(new_channels[counter], new_passwords[counter]);
+    }
+
+    memcpy(configured_channels, new_channels, sizeof(configured_channels) );
+    no_configured_channels = no_new_channels;
+
+    if (options.current_channel_id >= options.no_channels) options.current_channel_id = 0;
+    change_prompt();
+
+    verbose("config reloaded; %d channels\n", options.no_channels);
+}
+
 /** 
 * This callback is called when the irc connection with the server is established.
 * We will do things here like joining a channel and logging in at userserv
@@ -88,6 +317,9 @@ static void irc_server_connect(irc_session_t *session, const char *event, const
     {
     	join_irc_channel(options.channels[counter], options.channelpasswords[counter]);
     }
+
+    /* Files are offered once we are registered, and again after a reconnect */
+    dcc_offer();
 }
 
 /** 
@@ -135,37 +367,39 @@ static void irc_mode_callback(irc_session_t *session, const char *event, const c
 static void irc_channel_callback(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count) 
 {
     bool send = false;
+
+    /* Our own messages echoed back by the server; they have been delivered */
+    if (irc_cap_enabled(cap_echo_message) && count >= 2)
+    {
+        char nick[100];
+        irc_target_get_nick(origin, nick, sizeof(nick) -1);
+
+        if (strcasecmp(nick, options.botname) == 0)
+        {
+            buffer_ack(params[0], params[1]);
+            return;
+        }
+    }
+
+    if (count >= 2)
+    {
+        metric_add(metric_messages_received, 1);
+        metric_add(metric_bytes_received, strlen(params[1]) );
+        metric_channel(params[0], false);
+    }
+
     if ( (options.mode & output) > 0)
     {
         if (count >= 2)
         {
+            const char *text = params[1];
             char nick[100];
             irc_target_get_nick(origin, nick, sizeof(nick) -1);
 
-            if (strncmp(params[0], options.channels[options.current_channel_id], strlen(options.channels[options.current_channel_id]) ) == 0
-                && options.interactive)
-            {
-                printf("%s@%s: %s\n", nick, params[0], params[1]);
-                send = true;
-            }
-            else if (options.showchannel && options.shownick)
+            /* Fragments are collected; the record is printed once it is complete */
+            if (options.fragment_size <= 0 || fragment_receive(nick, params[0], params[1], &text) != fragment_partial)
             {
-                printf("%s - %s: %s\n", params[0], nick, params[1]);
-                send = true;
-            }
-            else if (options.showchannel)
-            {
-                printf("%s - %s\n", params[0], params[1]);
-                send = true;
-            }
-            else if (options.shownick)
-            {
-                printf("%s: %s\n", nick, params[1]);
-                send = true;
-            }
-            else
-            {
-                printf("%s\n", params[1]);
+                print_channel_message(stdout, nick, params[0], text);
                 send = true;
             }
 
@@ -184,6 +418,97 @@ static void irc_channel_callback(irc_session_t *session, const char *event, cons
     if (send) { usleep(1); debug("printed out message\n"); }
 }
 
+/** 
+* Handles the lines of a '--submit' client. A first line '/target <channel>' sets the
+* default channel of the client; all other lines are messages, so data which happens
+* to start with '/target ' is send like any other line.
+* 
+* @param client the client which send the line.
+* @param line the line itself.
+*/
+static void submit_handler(struct client *client, char *line)
+{
+    if (client->lines == 1 && strncmp(line, "/target ", 8) == 0)
+    {
+        memset(client->target, '\0', sizeof(client->target) );
+        strncpy(client->target, &line[8], sizeof(client->target) -1);
+        debug("client target set to %s\n", client->target);
+    }
+    else submit_message(line, client->target);
+}
+
+/** 
+* This callback is called for CTCP requests. The DCC negotiation of other irccmd's
+* is handled here; the rest is answered by libircclient.
+* 
+* @param session This will provide the irc session
+* @param event This contains what kind of event the callback triggers
+* @param origin Contains the sender of this event
+* @param params The parameters of the event, can be zero.
+* @param count The number of parameters.
+*/
+static void irc_ctcp_callback(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count) 
+{
+    if (count >= 1)
+    {
+        char nick[MAX_NICK_LEN];
+        irc_target_get_nick(origin, nick, sizeof(nick) -1);
+
+        if (dcc_request(nick, params[0]) ) return;
+    }
+    irc_event_ctcp_internal(session, event, origin, params, count);
+}
+
+/** 
+* Sets the callbacks of irccmd in the callbacks of the irc session.
+* 
+* @return the callbacks.
+*/
+static irc_callbacks_t *setup_callbacks()
+{
+    irc_callbacks_t *callbacks = get_callback();
+
+    callbacks->event_connect = irc_server_connect;
+    callbacks->event_channel = irc_channel_callback;
+    callbacks->event_join    = irc_mode_callback;
+    callbacks->event_ctcp_req = irc_ctcp_callback;
+    return callbacks;
+}
+
+/** 
+* Feeds a recording through the callbacks, instead of connecting to the server.
+* Used to benchmark the receive path on recorded traffic.
+* 
+* @return 0 on success, otherwise 1.
+*/
+static int replay_main()
+{
+    irc_callbacks_t *callbacks = setup_callbacks();
+    irc_session_t *session = NULL;
+    uint64_t start = 0;
+    long events = 0;
+
+    if (buffer_init() == false) return 1;
+    if ( (session = create_replay_session() ) == NULL)
+    {
+        error("could not create an irc session for the replay\n");
+        buffer_deinit();
+        return 1;
+    }
+
+    start = metrics_now();
+    events = record_replay(options.replayfile, session, callbacks, options.replay_realtime);
+    if (events >= 0 && options.silent == false)
+    {
+        double elapsed = (metrics_now() - start) / 1000000.0;
+        fprintf(stderr, "replayed %ld events in %.3f seconds (%.0f events/s)\n", events, elapsed, (elapsed > 0.0) ? events / elapsed : 0.0);
+    }
+
+    buffer_deinit();
+    close_irc_session();
+    return (events < 0) ? 1 : 0;
+}
+
 /** 
 * Main application loop.
 * 
@@ -198,14 +523,40 @@ static int prog_main()
     fd_set readset;
     fd_set writeset;
     struct timeval tv;
-    irc_callbacks_t *callbacks = get_callback();
-
-    callbacks->event_connect = irc_server_connect;
-    callbacks->event_channel = irc_channel_callback;
-	callbacks->event_join    = irc_mode_callback;
+    irc_callbacks_t *callbacks = setup_callbacks();
 
     debug("starting main loop\n");
 
+    register_plugin_commands();
+    if (buffer_init() == false) return 1;
+    if (options.daemon)
+    {
+        if (listener_open_unix(options.socketpath, NULL, submit_handler) == false) return 1;
+    }
+    if (strlen(options.controlpath) > 0)
+    {
+        if (listener_open_unix(options.controlpath, NULL, command_client_handler) == false) return 1;
+    }
+    if (inputs_open(submit_handler) == false) return 1;
+    if (strlen(options.followfile) > 0)
+    {
+        if (follow_open(options.followfile, options.followstate) == false) return 1;
+    }
+    if (metrics_open() == false) return 1;
+    if (strlen(options.send_file) > 0)
+    {
+        if (dcc_send_file(options.send_nick, options.send_file) == false) return 1;
+    }
+    if (strlen(options.tracefile) > 0)
+    {
+        if (trace_open(options.tracefile) == false) return 1;
+    }
+    if (strlen(options.recordfile) > 0)
+    {
+        if (record_open(options.recordfile) == false) return 1;
+        record_install(callbacks);
+    }
+
     bool connection_setup = false;
     do
     {
@@ -230,41 +581,83 @@ static int prog_main()
         tv.tv_sec = timeout;
         tv.tv_usec = 0;
 
-        if (is_irc_connected() )
+        FD_ZERO(&readset);
+        FD_ZERO(&writeset);
+
+        /* Input is also read while disconnected; it will be queued until we are back */
+        if ( (options.mode & input) > 0)
         {
-            FD_ZERO(&readset);
-            FD_ZERO(&writeset);
+            if (input_is_mapped() ) process_mapped_input();
+            else FD_SET(STDIN_FILENO, &readset);
+        }
 
-            if ( (options.mode & input) > 0)
+        if (is_irc_connected() )
+        {
+            add_irc_descriptors(&readset, &writeset, &maxfd);
+        }
+        else tv.tv_sec = 1;
+        listener_add_descriptors(&readset, &writeset, &maxfd);
+        follow_add_descriptors(&readset, &maxfd);
+        dcc_add_descriptors(&readset, &writeset, &maxfd);
+        tls_add_descriptors(&readset, &writeset, &maxfd);
+
+        buffer_select_timeout(&tv);
+        dedup_select_timeout(&tv);
+        resolve_select_timeout(&tv);
+        result = select(maxfd +1, &readset, &writeset, NULL, &tv);
+
+        if (result == 0)
+        {
+        } 
+        else if (result < 0)
+        {
+            if (options.running && errno != EINTR) error("error on select\n");
+        }
+        else 
+        {
+            if (process_irc(&readset, &writeset) != 0)
             {
-                FD_SET(STDIN_FILENO, &readset);
             }
 
-            add_irc_descriptors(&readset, &writeset, &maxfd);
-            result = select(maxfd +1, &readset, &writeset, NULL, &tv);
-
-            if (result == 0)
-            {
-            } 
-            else if (result < 0)
+            if (FD_ISSET(STDIN_FILENO, &readset) )
             {
-                if (options.running) error("error on select\n");
+                process_input();
             }
-            else 
-            {
-                if (process_irc(&readset, &writeset) != 0)
-                {
-                }
 
-                if (FD_ISSET(STDIN_FILENO, &readset) )
-                {
-                    process_input();
-                }
-            }
+            listener_process(&readset, &writeset);
+            follow_process(&readset);
+            dcc_process(&readset, &writeset);
+            tls_process(&readset, &writeset);
         }
-        else
+
+        /* A new session connects once the address of the server is known */
+        process_irc_connect();
+
+        if (options.reload)
+        {
+            reload_config();
+        }
+
+        if (options.dump_metrics)
+        {
+            options.dump_metrics = false;
+            metrics_write(stderr);
+        }
+
+        /* Summarise the repeats whose window has passed, then send whatever the flood timeout allows */
+        dedup_flush(options.input_closed);
+        buffer_flush();
+        fragment_expire();
+        dcc_expire();
+        if (options.input_closed && buffer_is_empty() && dcc_is_busy() == false)
+        {
+            debug("input closed and outbound queue empty\n");
+            options.running = false;
+        }
+        if (strlen(options.send_file) > 0 && buffer_is_empty() && dcc_is_busy() == false)
         {
-            sleep(1);
+            debug("file transfer has ended\n");
+            options.running = false;
         }
 
         now = time(NULL);
@@ -275,7 +668,20 @@ static int prog_main()
         }
     }
 
-    return close_irc_session();
+    listener_close_all();
+    dcc_close_all();
+    tls_close();
+    dedup_flush(true);
+    buffer_deinit();
+
+    /* The followed file is checkpointed once the queue is spooled, or known to be lost */
+    follow_close();
+    trace_close();
+    record_close();
+
+    /* A file which could not be send is reported in the exit code */
+    if (close_irc_session() != 0 || (strlen(options.send_file) > 0 && dcc_failures() > 0) ) return 1;
+    return 0;
 }
 
 /** 
@@ -307,8 +713,13 @@ int main(int argc, char **argv)
     sigemptyset( &setmask.sa_mask );
     setmask.sa_handler = sigfunc;
     setmask.sa_flags   = 0;
-    sigaction( SIGHUP,  &setmask, (struct sigaction *) NULL );      /* Hangup */
     sigaction( SIGINT,  &setmask, (struct sigaction *) NULL );      /* Interrupt (Ctrl-C) */
+    setmask.sa_handler = sighup;
+    sigaction( SIGHUP,  &setmask, (struct sigaction *) NULL );      /* Hangup; reload config */
+    setmask.sa_handler = sigusr1;
+    sigaction( SIGUSR1, &setmask, (struct sigaction *) NULL );      /* Write the metrics to stderr */
+    setmask.sa_handler = SIG_IGN;
+    sigaction( SIGPIPE, &setmask, (struct sigaction *) NULL );      /* A peer which has gone; write() fails with EPIPE instead */
 
 /*---------------- Configuration code -----------------*/
     /*set options to defaults*/
@@ -368,6 +779,7 @@ int main(int argc, char **argv)
             options.running = false;
             debug("parsing secondaries failed\n");
         }
+        remember_configured_channels();
     }
 /*---------------- Configuration code end--------------*/
     {
@@ -376,13 +788,30 @@ int main(int argc, char **argv)
         verbose("mode is set to '%s'\n", temp[options.mode]);
     }
 
+    /* the daemon only reads from its socket */
+    if (options.daemon)
+    {
+        options.interactive = false;
+        options.mode &= ~input;
+    }
+
     /*let's fire it up*/
-    if (options.running)
+    if (options.running && options.submit)
+    {
+        exitcode = submit_main();
+    }
+    else if (options.running && strlen(options.replayfile) > 0)
+    {
+        options.interactive = false;
+        exitcode = replay_main();
+    }
+    else if (options.running)
     {
         init_readline();
         exitcode = prog_main();
         deinit_readline();
     }
+    arg_clean();
 
 
     /*exitting gracefully*/
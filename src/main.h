@@ -6,12 +6,15 @@
 #include <stdbool.h>
 #include <time.h>
 
-#define MAX_CHANNELS (20)
+#define MAX_CHANNELS (20)      /* at most 32; a set of channels is a bit mask */
 #define MAX_CHANNELS_NAMELEN (20)
 #define MAX_SERVER_NAMELEN (20)
 #define MAX_BOT_NAMELEN (9)
+#define MAX_NICK_LEN (100)
 #define MAX_PASSWD_LEN (20)
 #define MAX_PATH_LEN (100)
+#define MAX_INPUTS (8)
+#define MAX_GROUPS (8)
 
 #define OUTPUT_TIME_DIV 10000
 
@@ -34,6 +37,51 @@ enum modes
     both       = 3,
 };
 
+/** 
+* How the messages on stdin are framed.
+*/
+enum input_formats
+{
+    format_line,    /* a line per message, routed by a leading '#channel' */
+    format_nul,     /* NUL terminated messages for the current channel */
+    format_lp,      /* length prefixed frames with a target and a text */
+    format_json,    /* a JSON object per line, with a target and a text */
+};
+
+/** 
+* The kinds of input sources, next to stdin.
+*/
+enum input_types
+{
+    input_fifo,
+    input_file,
+    input_unix,
+    input_tcp,
+};
+
+/** 
+* An input source from settings.inputs; its lines are send to its channel
+* unless they start with a '#channel' of their own.
+*/
+struct input_source
+{
+    enum input_types type;
+    char path[MAX_PATH_LEN];            /* fifo, file and unix */
+    int port;                           /* tcp */
+    char channel[MAX_CHANNELS_NAMELEN]; /* empty for the current channel */
+};
+
+/** 
+* A named group of channels from settings.groups. A message to '@name' is send
+* to all of them at once.
+*/
+struct channel_group
+{
+    char name[MAX_CHANNELS_NAMELEN];
+    int no_channels;
+    char channels[MAX_CHANNELS][MAX_CHANNELS_NAMELEN];
+};
+
 /** 
 * This struct contains the application specific settings.
 */
@@ -41,6 +89,7 @@ struct config_options
 {
     bool running;
     bool connected;
+    bool reload;
 
     char configfile[100];
     enum modes mode;
@@ -50,19 +99,27 @@ struct config_options
 
     bool interactive;    
     bool keepreading;    
+    bool input_closed;
+    enum input_formats input_format;
 
     bool showchannel;
     bool shownick;
     bool showjoins;
+    bool broadcast;         /* a line starting with '* ' goes to every channel */
     int maxlines;
 
     int port;
+    bool ssl;
+    bool ssl_verify;
+    char ssl_session_file[MAX_PATH_LEN];
     int no_channels;
     char botname[MAX_BOT_NAMELEN];
     char server[MAX_SERVER_NAMELEN];
     char serverpassword[MAX_PASSWD_LEN];
     char channels[MAX_CHANNELS][MAX_CHANNELS_NAMELEN];
     char channelpasswords[MAX_CHANNELS][MAX_PASSWD_LEN];
+    int channelweights[MAX_CHANNELS];       /* the share of the outbound traffic; 0 counts as 1 */
+    int channelpriorities[MAX_CHANNELS];    /* queues of a higher priority are send first */
 
     bool enableplugins;
     int no_pluginpaths;
@@ -73,10 +130,44 @@ struct config_options
     int botname_nr;
     int current_channel_id;
     time_t connection_timeout;
+    int dns_ttl;
 
     bool retry_init_connect;
     uint64_t ping_count;
     int output_flood_timeout;
+    int dedup_window;
+    int fragment_size;
+
+    int queue_size;
+    char spoolfile[MAX_PATH_LEN];
+
+    bool daemon;
+    bool submit;
+    char socketpath[MAX_PATH_LEN];
+    char controlpath[MAX_PATH_LEN];
+
+    int metrics_port;
+    char metricspath[MAX_PATH_LEN];
+    bool dump_metrics;
+
+    char tracefile[MAX_PATH_LEN];
+    char recordfile[MAX_PATH_LEN];
+    char replayfile[MAX_PATH_LEN];
+    bool replay_realtime;
+
+    char followfile[MAX_PATH_LEN];
+    char followstate[MAX_PATH_LEN];
+
+    char send_nick[MAX_NICK_LEN];
+    char send_file[MAX_PATH_LEN];
+    char receive_dir[MAX_PATH_LEN];
+    char dcc_address[MAX_SERVER_NAMELEN];
+
+    int no_inputs;
+    struct input_source inputs[MAX_INPUTS];
+
+    int no_groups;
+    struct channel_group groups[MAX_GROUPS];
 };
 
 extern struct config_options options;
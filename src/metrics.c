@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "main.h"
+#include "buffer.h"
+#include "listener.h"
+#include "metrics.h"
+
+#define METRICS_BUCKETS         (26)    /* 1 usec up to 2^25 usec (33 sec) */
+#define METRICS_MAX_CHANNELS    (MAX_CHANNELS *2)
+
+/**
+* A histogram with power-of-two buckets. Bucket n counts the values of at most 2^n usec.
+* The counts are not cumulative; that is done when the histogram is written.
+*/
+struct histogram
+{
+    uint64_t buckets[METRICS_BUCKETS];
+    uint64_t sum;
+    uint64_t count;
+};
+
+struct channel_metrics
+{
+    char name[MAX_CHANNELS_NAMELEN];
+    uint64_t sent;
+    uint64_t received;
+};
+
+struct plugin_metrics
+{
+    char name[MAX_CHANNELS_NAMELEN];
+    struct histogram latency;
+};
+
+static const char *counter_names[metric_max_counters][2] =
+{
+    { "irccmd_lines_read_total"        , "Lines read from stdin and clients" },
+    { "irccmd_messages_sent_total"     , "Messages send to the irc server" },
+    { "irccmd_messages_received_total" , "Channel messages received from the irc server" },
+    { "irccmd_sent_bytes_total"        , "Bytes of the PRIVMSG lines send to the irc server" },
+    { "irccmd_received_bytes_total"    , "Bytes of the channel messages received from the irc server" },
+    { "irccmd_reconnects_total"        , "Reconnects to the irc server" },
+    { "irccmd_dcc_bytes_sent_total"    , "Bytes of files send over DCC" },
+    { "irccmd_dcc_bytes_received_total", "Bytes of files received over DCC" },
+    { "irccmd_tls_handshakes_total"    , "Tls handshakes with the irc server" },
+    { "irccmd_tls_resumptions_total"   , "Tls handshakes which resumed an earlier session" },
+};
+
+static const char *histogram_names[metric_max_histograms][2] =
+{
+    { "irccmd_ping_rtt_seconds"        , "Round trip time of our PINGs to the irc server" },
+    { "irccmd_control_lane_seconds"    , "Time protocol messages like PING and JOIN wait before they are written" },
+    { "irccmd_data_lane_seconds"       , "Time channel messages wait in the outbound queue before they are written" },
+};
+
+static uint64_t counters[metric_max_counters];
+static struct histogram histograms[metric_max_histograms];
+static struct channel_metrics channels[METRICS_MAX_CHANNELS];
+static struct plugin_metrics plugins[MAX_CHANNELS];
+
+uint64_t metrics_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ( (uint64_t) ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+static void histogram_observe(struct histogram *histogram, uint64_t usec)
+{
+    int bucket = 0;
+
+    while (bucket < METRICS_BUCKETS && usec > (1ULL << bucket) ) bucket++;
+    if (bucket < METRICS_BUCKETS) __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&histogram->sum, usec, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+}
+
+static void histogram_write(FILE *fp, const char *name, const char *labels, struct histogram *histogram)
+{
+    uint64_t cumulative = 0;
+    int bucket = 0;
+    const char *sep = (strlen(labels) > 0) ? "," : "";
+
+    for (bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+    {
+        cumulative += __atomic_load_n(&histogram->buckets[bucket], __ATOMIC_RELAXED);
+        fprintf(fp, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, sep, (double) (1ULL << bucket) / 1000000.0, (unsigned long long) cumulative);
+    }
+    fprintf(fp, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, (unsigned long long) histogram->count);
+    fprintf(fp, "%s_sum%s%s%s %g\n", name, (*sep) ? "{" : "", labels, (*sep) ? "}" : "", (double) histogram->sum / 1000000.0);
+    fprintf(fp, "%s_count%s%s%s %llu\n", name, (*sep) ? "{" : "", labels, (*sep) ? "}" : "", (unsigned long long) histogram->count);
+}
+
+void metric_add(enum metric_counters counter, uint64_t value)
+{
+    __atomic_fetch_add(&counters[counter], value, __ATOMIC_RELAXED);
+}
+
+void metric_observe(enum metric_histograms histogram, uint64_t usec)
+{
+    histogram_observe(&histograms[histogram], usec);
+}
+
+void metric_channel(const char *channel, bool sent)
+{
+    int counter = 0;
+
+    for (counter = 0; counter < METRICS_MAX_CHANNELS; counter++)
+    {
+        struct channel_metrics *entry = &channels[counter];
+
+        /* Channels are added in the first free slot; the table is never cleared */
+        if (entry->name[0] == '\0') strncpy(entry->name, channel, MAX_CHANNELS_NAMELEN -1);
+        if (strncmp(entry->name, channel, MAX_CHANNELS_NAMELEN -1) != 0) continue;
+
+        if (sent) __atomic_fetch_add(&entry->sent, 1, __ATOMIC_RELAXED);
+        else __atomic_fetch_add(&entry->received, 1, __ATOMIC_RELAXED);
+        return;
+    }
+}
+
+void metric_plugin(const char *plugin, uint64_t usec)
+{
+    int counter = 0;
+
+    for (counter = 0; counter < MAX_CHANNELS; counter++)
+    {
+        struct plugin_metrics *entry = &plugins[counter];
+
+        if (entry->name[0] == '\0') strncpy(entry->name, plugin, MAX_CHANNELS_NAMELEN -1);
+        if (strncmp(entry->name, plugin, MAX_CHANNELS_NAMELEN -1) != 0) continue;
+
+        histogram_observe(&entry->latency, usec);
+        return;
+    }
+}
+
+/**
+* Escapes a label value as the Prometheus text format requires. An escaped value
+* takes twice the length of the value at most.
+*
+* @param escaped receives the escaped value; it holds 2 * strlen(value) +1 bytes.
+*/
+static void label_escape(char *escaped, const char *value)
+{
+    for (; *value != '\0'; value++)
+    {
+        if (*value == '\\' || *value == '"') *escaped++ = '\\';
+        if (*value == '\n')
+        {
+            *escaped++ = '\\';
+            *escaped++ = 'n';
+        }
+        else *escaped++ = *value;
+    }
+    *escaped = '\0';
+}
+
+/**
+* Writes a label value, escaped as the Prometheus text format requires.
+*/
+static void label_write(FILE *fp, const char *value)
+{
+    char escaped[2 * strlen(value) +1];
+
+    label_escape(escaped, value);
+    fputs(escaped, fp);
+}
+
+void metrics_write(FILE *fp)
+{
+    int counter = 0;
+
+    for (counter = 0; counter < metric_max_counters; counter++)
+    {
+        fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n", counter_names[counter][0], counter_names[counter][1], counter_names[counter][0]);
+        fprintf(fp, "%s %llu\n", counter_names[counter][0], (unsigned long long) __atomic_load_n(&counters[counter], __ATOMIC_RELAXED) );
+    }
+
+    fprintf(fp, "# HELP irccmd_channel_messages_total Messages per channel and direction\n# TYPE irccmd_channel_messages_total counter\n");
+    for (counter = 0; counter < METRICS_MAX_CHANNELS && channels[counter].name[0] != '\0'; counter++)
+    {
+        fprintf(fp, "irccmd_channel_messages_total{channel=\"");
+        label_write(fp, channels[counter].name);
+        fprintf(fp, "\",direction=\"sent\"} %llu\n", (unsigned long long) channels[counter].sent);
+        fprintf(fp, "irccmd_channel_messages_total{channel=\"");
+        label_write(fp, channels[counter].name);
+        fprintf(fp, "\",direction=\"received\"} %llu\n", (unsigned long long) channels[counter].received);
+    }
+
+    fprintf(fp, "# HELP irccmd_queue_depth Messages in the in-memory outbound queue\n# TYPE irccmd_queue_depth gauge\n");
+    fprintf(fp, "irccmd_queue_depth %lu\n", (unsigned long) buffer_depth() );
+    fprintf(fp, "# HELP irccmd_spooled_bytes Bytes in the spool file waiting to be send\n# TYPE irccmd_spooled_bytes gauge\n");
+    fprintf(fp, "irccmd_spooled_bytes %lu\n", (unsigned long) buffer_spooled_bytes() );
+    fprintf(fp, "# HELP irccmd_dropped_total Outbound messages which were dropped\n# TYPE irccmd_dropped_total counter\n");
+    fprintf(fp, "irccmd_dropped_total %lu\n", buffer_dropped() );
+    fprintf(fp, "# HELP irccmd_pings_total PONGs received from the irc server\n# TYPE irccmd_pings_total counter\n");
+    fprintf(fp, "irccmd_pings_total %llu\n", (unsigned long long) options.ping_count);
+    fprintf(fp, "# HELP irccmd_connected Whether irccmd has joined its channels\n# TYPE irccmd_connected gauge\n");
+    fprintf(fp, "irccmd_connected %d\n", (options.connected) ? 1 : 0);
+
+    for (counter = 0; counter < metric_max_histograms; counter++)
+    {
+        fprintf(fp, "# HELP %s %s\n# TYPE %s histogram\n", histogram_names[counter][0], histogram_names[counter][1], histogram_names[counter][0]);
+        histogram_write(fp, histogram_names[counter][0], "", &histograms[counter]);
+    }
+
+    fprintf(fp, "# HELP irccmd_plugin_latency_seconds Time a plugin takes per message\n# TYPE irccmd_plugin_latency_seconds histogram\n");
+    for (counter = 0; counter < MAX_CHANNELS && plugins[counter].name[0] != '\0'; counter++)
+    {
+        char name[2 * sizeof(plugins[counter].name) +1];
+        char labels[sizeof(name) +20];
+
+        label_escape(name, plugins[counter].name);
+        (void) snprintf(labels, sizeof(labels), "plugin=\"%s\"", name);
+        histogram_write(fp, "irccmd_plugin_latency_seconds", labels, &plugins[counter].latency);
+    }
+
+    fflush(fp);
+}
+
+/**
+* Answers a http request on the metrics listener, whatever was asked, and closes the connection.
+*/
+static void metrics_handler(struct client *client, char *line)
+{
+    char *body = NULL;
+    size_t len = 0;
+    FILE *fp = open_memstream(&body, &len);
+
+    debug("metrics request: %s\n", line);
+    if (fp != NULL)
+    {
+        metrics_write(fp);
+        fclose(fp);
+
+        client_printf(client, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n", (unsigned long) len);
+        client_write(client, body, len);
+        free(body);
+    }
+    else client_printf(client, "HTTP/1.0 500 Internal Server Error\r\nConnection: close\r\n\r\n");
+
+    client_close(client);
+}
+
+bool metrics_open()
+{
+    bool success = true;
+
+    if (options.metrics_port > 0)
+    {
+        if (listener_open_tcp(options.metrics_port, NULL, metrics_handler) == false) success = false;
+    }
+
+    if (strlen(options.metricspath) > 0)
+    {
+        if (listener_open_unix(options.metricspath, NULL, metrics_handler) == false) success = false;
+    }
+
+    return success;
+}
@@ -0,0 +1,75 @@
+#ifndef metrics_h_
+#define metrics_h_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+* The counters irccmd keeps.
+*/
+enum metric_counters
+{
+    metric_lines_read,
+    metric_messages_sent,
+    metric_messages_received,
+    metric_bytes_sent,
+    metric_bytes_received,
+    metric_reconnects,
+    metric_dcc_bytes_sent,
+    metric_dcc_bytes_received,
+    metric_tls_handshakes,
+    metric_tls_resumed,
+    metric_max_counters,
+};
+
+/**
+* The latency histograms irccmd keeps; all values are in microseconds.
+*/
+enum metric_histograms
+{
+    metric_ping_rtt,
+    metric_control_lane,    /* from queueing a protocol message to writing it */
+    metric_data_lane,       /* from queueing a channel message to writing it */
+    metric_max_histograms,
+};
+
+/**
+* Returns a monotonic timestamp in microseconds, for measuring latencies.
+*/
+uint64_t metrics_now();
+
+void metric_add(enum metric_counters counter, uint64_t value);
+void metric_observe(enum metric_histograms histogram, uint64_t usec);
+
+/**
+* Counts a message send to, or received from, a channel.
+*
+* @param channel the channel of the message.
+* @param sent true for a message we send, false for a message we received.
+*/
+void metric_channel(const char *channel, bool sent);
+
+/**
+* Records how long a plugin took to process a single message.
+*
+* @param plugin the name of the plugin.
+* @param usec the time it took, in microseconds.
+*/
+void metric_plugin(const char *plugin, uint64_t usec);
+
+/**
+* Writes all metrics in the Prometheus text format.
+*
+* @param fp the stream to write to.
+*/
+void metrics_write(FILE *fp);
+
+/**
+* Starts serving the metrics over http on the configured port and/or unix socket.
+*
+* @return false when a configured listener could not be opened.
+*/
+bool metrics_open();
+
+#endif /*metrics_h_*/
@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "output.h"
+
+void print_channel_message(FILE *fp, const char *nick, const char *channel, const char *text)
+{
+    if (strncmp(channel, options.channels[options.current_channel_id], strlen(options.channels[options.current_channel_id]) ) == 0
+        && options.interactive)
+    {
+        fprintf(fp, "%s@%s: %s\n", nick, channel, text);
+    }
+    else if (options.showchannel && options.shownick)
+    {
+        fprintf(fp, "%s - %s: %s\n", channel, nick, text);
+    }
+    else if (options.showchannel)
+    {
+        fprintf(fp, "%s - %s\n", channel, text);
+    }
+    else if (options.shownick)
+    {
+        fprintf(fp, "%s: %s\n", nick, text);
+    }
+    else
+    {
+        fprintf(fp, "%s\n", text);
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef output_h_
+#define output_h_
+
+#include <stdio.h>
+
+/** 
+* Prints a message received in a channel, formatted as the showchannel,
+* shownick and interactive settings require.
+* 
+* @param fp the stream to print to.
+* @param nick the nick of the sender.
+* @param channel the channel the message was send to.
+* @param text the message itself.
+*/
+void print_channel_message(FILE *fp, const char *nick, const char *channel, const char *text);
+
+#endif /*output_h_*/
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "main.h"
+#include "metrics.h"
+#include "record.h"
+
+#define RECORD_BUFSIZE      (64 * 1024)
+#define RECORD_MAX_PARAMS   (32)
+
+/**
+* The callbacks which can be recorded; the kind of event is stored with every record,
+* since for example a PRIVMSG can arrive through event_channel as well as event_privmsg.
+*/
+enum record_events
+{
+    record_connect,
+    record_nick,
+    record_quit,
+    record_join,
+    record_part,
+    record_mode,
+    record_umode,
+    record_topic,
+    record_kick,
+    record_channel,
+    record_privmsg,
+    record_notice,
+    record_invite,
+    record_ctcp_req,
+    record_ctcp_rep,
+    record_ctcp_action,
+    record_unknown,
+    record_numeric,
+    record_max_events,
+};
+
+/* Where the callback of every kind of event lives; numeric events have their own signature */
+static const size_t offsets[record_numeric] =
+{
+    [record_connect]     = offsetof(irc_callbacks_t, event_connect),
+    [record_nick]        = offsetof(irc_callbacks_t, event_nick),
+    [record_quit]        = offsetof(irc_callbacks_t, event_quit),
+    [record_join]        = offsetof(irc_callbacks_t, event_join),
+    [record_part]        = offsetof(irc_callbacks_t, event_part),
+    [record_mode]        = offsetof(irc_callbacks_t, event_mode),
+    [record_umode]       = offsetof(irc_callbacks_t, event_umode),
+    [record_topic]       = offsetof(irc_callbacks_t, event_topic),
+    [record_kick]        = offsetof(irc_callbacks_t, event_kick),
+    [record_channel]     = offsetof(irc_callbacks_t, event_channel),
+    [record_privmsg]     = offsetof(irc_callbacks_t, event_privmsg),
+    [record_notice]      = offsetof(irc_callbacks_t, event_notice),
+    [record_invite]      = offsetof(irc_callbacks_t, event_invite),
+    [record_ctcp_req]    = offsetof(irc_callbacks_t, event_ctcp_req),
+    [record_ctcp_rep]    = offsetof(irc_callbacks_t, event_ctcp_rep),
+    [record_ctcp_action] = offsetof(irc_callbacks_t, event_ctcp_action),
+    [record_unknown]     = offsetof(irc_callbacks_t, event_unknown),
+};
+
+/**
+* Every record starts with this header, followed by the event name, the origin and the
+* parameters. Each string is stored as a 16 bit length followed by its characters.
+*/
+struct record_header
+{
+    uint64_t usec;      /* since the start of the recording */
+    uint32_t code;      /* the numeric event, if any */
+    uint16_t kind;      /* enum record_events */
+    uint16_t count;     /* the number of parameters */
+};
+
+static FILE *recording = NULL;
+static uint64_t started = 0;
+static irc_callbacks_t real;
+
+static irc_event_callback_t *event_callback(irc_callbacks_t *callbacks, enum record_events kind)
+{
+    return (irc_event_callback_t *) ( (char *) callbacks + offsets[kind]);
+}
+
+static void write_string(const char *string)
+{
+    size_t len = (string != NULL) ? strlen(string) : 0;
+    uint16_t len16 = (len > UINT16_MAX) ? UINT16_MAX : len;
+
+    (void) fwrite(&len16, sizeof(len16), 1, recording);
+    if (len16 > 0) (void) fwrite(string, 1, len16, recording);
+}
+
+static void record_event(enum record_events kind, unsigned int code, const char *event, const char *origin, const char **params, unsigned int count)
+{
+    struct record_header header;
+    unsigned int counter = 0;
+
+    if (recording == NULL) return;
+    if (count > RECORD_MAX_PARAMS) count = RECORD_MAX_PARAMS;
+
+    header.usec = metrics_now() - started;
+    header.code = code;
+    header.kind = kind;
+    header.count = count;
+
+    (void) fwrite(&header, sizeof(header), 1, recording);
+    write_string(event);
+    write_string(origin);
+    for (counter = 0; counter < count; counter++) write_string(params[counter]);
+
+    if (ferror(recording) )
+    {
+        error("could not write to the recording; recording stopped\n");
+        record_close();
+    }
+}
+
+/* A shim per callback, which records the event and hands it to the real callback */
+#define RECORD_SHIM(name) \
+    static void shim_##name(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count) \
+    { \
+        record_event(record_##name, 0, event, origin, params, count); \
+        real.event_##name(session, event, origin, params, count); \
+    }
+
+RECORD_SHIM(connect)
+RECORD_SHIM(nick)
+RECORD_SHIM(quit)
+RECORD_SHIM(join)
+RECORD_SHIM(part)
+RECORD_SHIM(mode)
+RECORD_SHIM(umode)
+RECORD_SHIM(topic)
+RECORD_SHIM(kick)
+RECORD_SHIM(channel)
+RECORD_SHIM(privmsg)
+RECORD_SHIM(notice)
+RECORD_SHIM(invite)
+RECORD_SHIM(ctcp_req)
+RECORD_SHIM(ctcp_rep)
+RECORD_SHIM(ctcp_action)
+RECORD_SHIM(unknown)
+
+static void shim_numeric(irc_session_t *session, unsigned int event, const char *origin, const char **params, unsigned int count)
+{
+    record_event(record_numeric, event, "", origin, params, count);
+    real.event_numeric(session, event, origin, params, count);
+}
+
+static const irc_event_callback_t shims[record_numeric] =
+{
+    [record_connect]     = shim_connect,
+    [record_nick]        = shim_nick,
+    [record_quit]        = shim_quit,
+    [record_join]        = shim_join,
+    [record_part]        = shim_part,
+    [record_mode]        = shim_mode,
+    [record_umode]       = shim_umode,
+    [record_topic]       = shim_topic,
+    [record_kick]        = shim_kick,
+    [record_channel]     = shim_channel,
+    [record_privmsg]     = shim_privmsg,
+    [record_notice]      = shim_notice,
+    [record_invite]      = shim_invite,
+    [record_ctcp_req]    = shim_ctcp_req,
+    [record_ctcp_rep]    = shim_ctcp_rep,
+    [record_ctcp_action] = shim_ctcp_action,
+    [record_unknown]     = shim_unknown,
+};
+
+bool record_open(const char *path)
+{
+    uint32_t version = RECORD_VERSION;
+
+    if ( (recording = fopen(path, "w") ) == NULL)
+    {
+        error("could not open recording %s: %s\n", path, strerror(errno) );
+        return false;
+    }
+
+    (void) setvbuf(recording, NULL, _IOFBF, RECORD_BUFSIZE);
+    if (fwrite(RECORD_MAGIC, strlen(RECORD_MAGIC), 1, recording) != 1 || fwrite(&version, sizeof(version), 1, recording) != 1)
+    {
+        error("could not write to recording %s\n", path);
+        record_close();
+        return false;
+    }
+
+    started = metrics_now();
+    verbose("recording irc events to %s\n", path);
+    return true;
+}
+
+void record_close()
+{
+    if (recording == NULL) return;
+
+    fclose(recording);
+    recording = NULL;
+}
+
+void record_install(irc_callbacks_t *callbacks)
+{
+    int kind = 0;
+
+    real = *callbacks;
+    for (kind = 0; kind < record_numeric; kind++)
+    {
+        irc_event_callback_t *callback = event_callback(callbacks, kind);
+        if (*callback != NULL) *callback = shims[kind];
+    }
+    if (callbacks->event_numeric != NULL) callbacks->event_numeric = shim_numeric;
+}
+
+/**
+* Reads a length prefixed string into buf, and terminates it.
+*
+* @return the start of the string, or NULL when the recording is truncated.
+*/
+static char *read_string(FILE *fp, char **buf, size_t *size, size_t *used)
+{
+    uint16_t len = 0;
+
+    if (fread(&len, sizeof(len), 1, fp) != 1) return NULL;
+    if (*used + len +1 > *size)
+    {
+        char *new_buf = realloc(*buf, *used + len +1 + RECORD_BUFSIZE);
+        if (new_buf == NULL) return NULL;
+        *buf = new_buf;
+        *size = *used + len +1 + RECORD_BUFSIZE;
+    }
+
+    if (len > 0 && fread(&(*buf)[*used], 1, len, fp) != len) return NULL;
+    (*buf)[*used + len] = '\0';
+    *used += len +1;
+
+    /* Offsets rather than pointers are kept by the caller; buf may move */
+    return &(*buf)[*used - len -1];
+}
+
+static void sleep_until(uint64_t due)
+{
+    uint64_t now = metrics_now();
+    struct timespec ts;
+
+    if (due <= now) return;
+    ts.tv_sec = (due - now) / 1000000ULL;
+    ts.tv_nsec = ( (due - now) % 1000000ULL) * 1000;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR && options.running);
+}
+
+long record_replay(const char *path, irc_session_t *session, irc_callbacks_t *callbacks, bool realtime)
+{
+    char magic[sizeof(RECORD_MAGIC)];
+    uint32_t version = 0;
+    struct record_header header;
+    char *buf = NULL;
+    size_t size = 0;
+    long events = 0;
+    uint64_t start = metrics_now();
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL)
+    {
+        error("could not open recording %s: %s\n", path, strerror(errno) );
+        return -1;
+    }
+
+    if (fread(magic, strlen(RECORD_MAGIC), 1, fp) != 1 || memcmp(magic, RECORD_MAGIC, strlen(RECORD_MAGIC) ) != 0
+        || fread(&version, sizeof(version), 1, fp) != 1 || version != RECORD_VERSION)
+    {
+        error("%s is not a recording of this version of irccmd\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    (void) setvbuf(fp, NULL, _IOFBF, RECORD_BUFSIZE);
+    while (options.running && fread(&header, sizeof(header), 1, fp) == 1)
+    {
+        size_t offsets_used[RECORD_MAX_PARAMS +2];
+        const char *params[RECORD_MAX_PARAMS];
+        size_t used = 0;
+        unsigned int counter = 0;
+
+        if (header.kind >= record_max_events || header.count > RECORD_MAX_PARAMS) break;
+
+        /* Read all strings first; the buffer may move while it grows */
+        for (counter = 0; counter < header.count + 2u; counter++)
+        {
+            offsets_used[counter] = used;
+            if (read_string(fp, &buf, &size, &used) == NULL) break;
+        }
+        if (counter < header.count + 2u)
+        {
+            warning("recording %s is truncated\n", path);
+            break;
+        }
+        for (counter = 0; counter < header.count; counter++) params[counter] = &buf[offsets_used[counter +2]];
+
+        if (realtime) sleep_until(start + header.usec);
+
+        if (header.kind == record_numeric)
+        {
+            if (callbacks->event_numeric != NULL) callbacks->event_numeric(session, header.code, &buf[offsets_used[1]], params, header.count);
+        }
+        else
+        {
+            irc_event_callback_t callback = *event_callback(callbacks, header.kind);
+            if (callback != NULL) callback(session, &buf[offsets_used[0]], &buf[offsets_used[1]], params, header.count);
+        }
+        events++;
+    }
+
+    free(buf);
+    fclose(fp);
+    return events;
+}
@@ -0,0 +1,39 @@
+#ifndef record_h_
+#define record_h_
+
+#include <stdbool.h>
+
+#include "ircmod.h"
+
+#define RECORD_MAGIC    "IRCRECRD"
+#define RECORD_VERSION  (1)
+
+/**
+* Starts recording every irc event to the given file, which is truncated.
+*
+* @return true on success, otherwise false.
+*/
+bool record_open(const char *path);
+void record_close();
+
+/**
+* Puts a recording shim in front of every callback which is set. Must be
+* called after the callbacks are set and before the session is created.
+*
+* @param callbacks the callbacks of the session.
+*/
+void record_install(irc_callbacks_t *callbacks);
+
+/**
+* Feeds a recording through the callbacks, without a network connection.
+*
+* @param path the recording to replay.
+* @param session the session handed to the callbacks; it is not connected.
+* @param callbacks the callbacks to call.
+* @param realtime true to keep the recorded pace, false to replay as fast as possible.
+*
+* @return the number of replayed events, or -1 on error.
+*/
+long record_replay(const char *path, irc_session_t *session, irc_callbacks_t *callbacks, bool realtime);
+
+#endif /*record_h_*/
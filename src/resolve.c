@@ -0,0 +1,263 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <netdb.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "def.h"
+#include "main.h"
+#include "configdefaults.h"
+#include "resolve.h"
+
+#define RESOLVE_CACHE_SIZE      (4)
+#define RESOLVE_MAX_ADDRESSES   (8)
+#define RESOLVE_POLL            (250)   /* msec between looks at a background lookup which is awaited */
+#define RESOLVE_RETRY           (10)    /* sec before a failed lookup is retried */
+
+/**
+* A cached lookup of a single host.
+*/
+struct resolve_entry
+{
+    char host[MAX_SERVER_NAMELEN +1];
+    struct sockaddr_storage addrs[RESOLVE_MAX_ADDRESSES];
+    socklen_t addrlens[RESOLVE_MAX_ADDRESSES];
+    int no_addrs;
+    time_t expires;
+
+#ifdef HAVE_GETADDRINFO_A
+    bool pending;
+    struct gaicb request;
+#endif
+};
+
+static struct resolve_entry cache[RESOLVE_CACHE_SIZE];
+
+static const struct addrinfo hints =
+{
+    .ai_family   = AF_UNSPEC,
+    .ai_socktype = SOCK_STREAM,
+};
+
+/* The host whose addresses are awaited for a connection, or NULL */
+static struct resolve_entry *awaited = NULL;
+
+/**
+* Stores the result of a lookup in the cache entry. IPv6 and IPv4 addresses
+* are interleaved, starting with IPv6, so that a dead route of one family only
+* costs a single connection attempt.
+*/
+static void store_addresses(struct resolve_entry *entry, struct addrinfo *result)
+{
+    struct addrinfo *ai = NULL;
+    int family = 0;
+    int families[2] = { AF_INET6, AF_INET };
+    bool added = true;
+    struct addrinfo *next[2] = { result, result };
+
+    entry->no_addrs = 0;
+    while (added && entry->no_addrs < RESOLVE_MAX_ADDRESSES)
+    {
+        added = false;
+        for (family = 0; family < 2 && entry->no_addrs < RESOLVE_MAX_ADDRESSES; family++)
+        {
+            for (ai = next[family]; ai != NULL && ai->ai_family != families[family]; ai = ai->ai_next);
+            if (ai == NULL)
+            {
+                next[family] = NULL;
+                continue;
+            }
+
+            memcpy(&entry->addrs[entry->no_addrs], ai->ai_addr, ai->ai_addrlen);
+            entry->addrlens[entry->no_addrs] = ai->ai_addrlen;
+            entry->no_addrs++;
+            next[family] = ai->ai_next;
+            added = true;
+        }
+    }
+
+    entry->expires = time(NULL) + options.dns_ttl;
+    debug("cached %d addresses of %s\n", entry->no_addrs, entry->host);
+}
+
+static void lookup_sync(struct resolve_entry *entry)
+{
+    struct addrinfo *result = NULL;
+    int err = 0;
+
+    debug("resolving %s\n", entry->host);
+    if ( (err = getaddrinfo(entry->host, NULL, &hints, &result) ) != 0)
+    {
+        error("could not resolve %s: %s\n", entry->host, gai_strerror(err) );
+        entry->expires = time(NULL) + RESOLVE_RETRY;
+        return;
+    }
+
+    store_addresses(entry, result);
+    freeaddrinfo(result);
+}
+
+/**
+* Starts a background lookup for the entry, when supported.
+* Otherwise the lookup is done right away.
+*/
+static void lookup_async(struct resolve_entry *entry)
+{
+#ifdef HAVE_GETADDRINFO_A
+    struct gaicb *requests[1] = { &entry->request };
+
+    if (entry->pending) return;
+
+    memset(&entry->request, 0, sizeof(entry->request) );
+    entry->request.ar_name = entry->host;
+    entry->request.ar_request = &hints;
+
+    debug("resolving %s in the background\n", entry->host);
+    if (getaddrinfo_a(GAI_NOWAIT, requests, 1, NULL) == 0) entry->pending = true;
+    else lookup_sync(entry);
+#else
+    lookup_sync(entry);
+#endif
+}
+
+static struct resolve_entry *find_entry(const char *host)
+{
+    struct resolve_entry *entry = NULL;
+    int counter = 0;
+
+    for (counter = 0; counter < RESOLVE_CACHE_SIZE; counter++)
+    {
+        if (strncmp(cache[counter].host, host, MAX_SERVER_NAMELEN) == 0) return &cache[counter];
+    }
+
+    /* Not cached; replace the entry which expires first */
+    for (counter = 0; counter < RESOLVE_CACHE_SIZE; counter++)
+    {
+#ifdef HAVE_GETADDRINFO_A
+        if (cache[counter].pending) continue;
+#endif
+        if (entry == NULL || cache[counter].expires < entry->expires) entry = &cache[counter];
+    }
+
+    if (entry != NULL)
+    {
+        memset(entry->host, '\0', sizeof(entry->host) );
+        strncpy(entry->host, host, MAX_SERVER_NAMELEN);
+        entry->no_addrs = 0;
+        entry->expires = 0;
+    }
+    return entry;
+}
+
+bool resolve_start(const char *host)
+{
+    struct resolve_entry *entry = NULL;
+
+    awaited = NULL;
+    if ( (entry = find_entry(host) ) == NULL) return false;
+
+    resolve_poll();
+    if (entry->no_addrs == 0 || entry->expires <= time(NULL) ) lookup_async(entry);
+
+    awaited = entry;
+    return true;
+}
+
+enum resolve_results resolve_address(char *address, size_t len, bool *ipv6)
+{
+    struct resolve_entry *entry = awaited;
+
+    if (entry == NULL) return resolve_failed;
+
+    resolve_poll();
+#ifdef HAVE_GETADDRINFO_A
+    /* A stale entry is used while it is refreshed; a new one waits for its lookup */
+    if (entry->pending && entry->no_addrs == 0) return resolve_pending;
+#endif
+    awaited = NULL;
+    if (entry->no_addrs == 0) return resolve_failed;
+
+    *ipv6 = (entry->addrs[0].ss_family == AF_INET6);
+    if (*ipv6) inet_ntop(AF_INET6, &( (struct sockaddr_in6 *) &entry->addrs[0])->sin6_addr, address, len);
+    else inet_ntop(AF_INET, &( (struct sockaddr_in *) &entry->addrs[0])->sin_addr, address, len);
+    return resolve_found;
+}
+
+bool resolve_is_pending()
+{
+    return (awaited != NULL) ? true : false;
+}
+
+void resolve_select_timeout(struct timeval *tv)
+{
+    if (awaited == NULL) return;
+
+    if ( (unsigned long long) tv->tv_sec * 1000ULL + (tv->tv_usec / 1000) > RESOLVE_POLL)
+    {
+        tv->tv_sec = RESOLVE_POLL / 1000;
+        tv->tv_usec = (RESOLVE_POLL % 1000) * 1000;
+    }
+}
+
+void resolve_demote(const char *host)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen = 0;
+    int counter = 0;
+
+    for (counter = 0; counter < RESOLVE_CACHE_SIZE; counter++)
+    {
+        struct resolve_entry *entry = &cache[counter];
+
+        if (entry->no_addrs < 2 || strncmp(entry->host, host, MAX_SERVER_NAMELEN) != 0) continue;
+
+        addr = entry->addrs[0];
+        addrlen = entry->addrlens[0];
+        memmove(&entry->addrs[0], &entry->addrs[1], (entry->no_addrs -1) * sizeof(entry->addrs[0]) );
+        memmove(&entry->addrlens[0], &entry->addrlens[1], (entry->no_addrs -1) * sizeof(entry->addrlens[0]) );
+        entry->addrs[entry->no_addrs -1] = addr;
+        entry->addrlens[entry->no_addrs -1] = addrlen;
+        debug("the first address of %s did not answer; the next one is tried first\n", host);
+    }
+}
+
+void resolve_poll()
+{
+#ifdef HAVE_GETADDRINFO_A
+    int counter = 0;
+    time_t now = time(NULL);
+
+    for (counter = 0; counter < RESOLVE_CACHE_SIZE; counter++)
+    {
+        struct resolve_entry *entry = &cache[counter];
+        if (strlen(entry->host) == 0) continue;
+
+        if (entry->pending)
+        {
+            int err = gai_error(&entry->request);
+            if (err == EAI_INPROGRESS) continue;
+
+            entry->pending = false;
+            if (err == 0)
+            {
+                store_addresses(entry, entry->request.ar_result);
+                freeaddrinfo(entry->request.ar_result);
+            }
+            else
+            {
+                warning("could not resolve %s: %s; using the cached addresses\n", entry->host, gai_strerror(err) );
+                entry->expires = now + (options.dns_ttl / 10) + RESOLVE_RETRY;
+            }
+            continue;
+        }
+
+        /* Refresh entries in the background before they expire */
+        if (entry->no_addrs > 0 && (entry->expires - now) < (options.dns_ttl / 10) ) lookup_async(entry);
+    }
+#endif
+}
@@ -0,0 +1,63 @@
+#ifndef resolve_h_
+#define resolve_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/time.h>
+
+/**
+* The outcome of resolve_address().
+*/
+enum resolve_results
+{
+    resolve_pending,        /* the lookup is still going on */
+    resolve_found,          /* an address was found */
+    resolve_failed,         /* the host could not be resolved */
+};
+
+/**
+* Starts looking for the addresses of the given host. The addresses are cached for
+* options.dns_ttl seconds; a stale cache entry is still used while a new lookup is
+* done in the background. Without getaddrinfo_a the lookup is done right away.
+*
+* @param host the host name or address of the server.
+* @return false when there is no room in the cache for the host.
+*/
+bool resolve_start(const char *host);
+
+/**
+* Hands out the address to connect to, once the lookup started by resolve_start()
+* is done. IPv6 and IPv4 addresses take turns; an address which did not answer is
+* moved to the back by resolve_demote().
+*
+* @param address storage for the numeric address.
+* @param len the size of the address storage.
+* @param ipv6 will be set to true for an IPv6 address.
+* @return whether the lookup is still going on, found an address, or failed.
+*/
+enum resolve_results resolve_address(char *address, size_t len, bool *ipv6);
+
+/**
+* @return true while resolve_address() has to be asked again.
+*/
+bool resolve_is_pending();
+
+/**
+* Shortens the select timeout while a lookup is awaited; a background lookup has no
+* descriptor to wait for.
+*/
+void resolve_select_timeout(struct timeval *tv);
+
+/**
+* Moves the first address of the host to the back, since a connection to it failed.
+*/
+void resolve_demote(const char *host);
+
+/**
+* Collects the results of background lookups, and starts a new lookup for cache
+* entries which are about to expire. Should be called regularly from the main loop.
+*/
+void resolve_poll();
+
+#endif /*resolve_h_*/
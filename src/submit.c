@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "main.h"
+#include "submit.h"
+
+static bool write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t result = write(fd, buf, len);
+        if (result < 0)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += result;
+        len -= result;
+    }
+    return true;
+}
+
+int submit_main()
+{
+    struct sockaddr_un addr;
+    char buff[9000];
+    ssize_t len = 0;
+    int fd = -1;
+
+    memset(&addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, options.socketpath, sizeof(addr.sun_path) -1);
+
+    if ( (fd = socket(AF_UNIX, SOCK_STREAM, 0) ) < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr) ) != 0)
+    {
+        error("could not reach the irccmd daemon at %s: %s\n", options.socketpath, strerror(errno) );
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    debug("connected to daemon at %s\n", options.socketpath);
+
+    len = snprintf(buff, sizeof(buff), "/target %s\n", options.channels[options.current_channel_id]);
+    if (write_all(fd, buff, len) == false) len = -1;
+
+    /* Stdin is passed on as is; the daemon splits it into lines */
+    while (len >= 0 && (len = read(STDIN_FILENO, buff, sizeof(buff) ) ) != 0)
+    {
+        if (len < 0)
+        {
+            if (errno == EINTR) len = 0;
+            continue;
+        }
+        if (write_all(fd, buff, len) == false) len = -1;
+    }
+
+    if (len < 0) error("lost the connection with the irccmd daemon: %s\n", strerror(errno) );
+    close(fd);
+
+    return (len < 0) ? 1 : 0;
+}
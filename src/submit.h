@@ -0,0 +1,13 @@
+#ifndef submit_h_
+#define submit_h_
+
+/** 
+* Hands stdin to a running irccmd daemon over its unix socket, instead of
+* connecting to the irc server ourselves. The current channel is handed
+* to the daemon as the default target of this client.
+* 
+* @return 0 on success, 1 when the daemon could not be reached.
+*/
+int submit_main();
+
+#endif /*submit_h_*/
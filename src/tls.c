@@ -0,0 +1,564 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "def.h"
+#include "main.h"
+#include "metrics.h"
+#include "tls.h"
+
+#ifdef HAVE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+enum tls_states
+{
+    tls_closed,
+    tls_connecting,     /* waiting for the tcp connection to the server */
+    tls_handshaking,
+    tls_established,
+};
+
+/**
+* The tls connection to the server, and the plain connection of libircclient
+* which it is bridged to.
+*/
+struct tls_bridge
+{
+    enum tls_states state;
+    int listen_fd;
+    int client_fd;                      /* the connection of libircclient */
+    int server_fd;
+    int client_port;                    /* the local port of libircclient; 0 until it is known */
+    SSL *ssl;
+    bool want_write;                    /* the last SSL call waits until the server can be written */
+    char up[TLS_BUFSIZE];               /* from libircclient to the server */
+    size_t up_len;
+    size_t up_offset;
+    char down[TLS_BUFSIZE];             /* from the server to libircclient */
+    size_t down_len;
+    size_t down_offset;
+};
+
+static struct tls_bridge bridge = { .state = tls_closed, .listen_fd = -1, .client_fd = -1, .server_fd = -1 };
+static SSL_CTX *context = NULL;
+
+/* The session of the last connection, which the next connection resumes */
+static SSL_SESSION *cached_session = NULL;
+
+static const char *tls_error()
+{
+    static char text[256];
+
+    ERR_error_string_n(ERR_get_error(), text, sizeof(text) );
+    return text;
+}
+
+/**
+* @return true when the server is a name, and not an address.
+*/
+static bool server_is_name()
+{
+    struct in6_addr addr;
+
+    return (inet_pton(AF_INET, options.server, &addr) != 1 && inet_pton(AF_INET6, options.server, &addr) != 1) ? true : false;
+}
+
+/**
+* @return true when the session belongs to options.server.
+*/
+static bool session_matches(SSL_SESSION *session)
+{
+    const char *host = SSL_SESSION_get0_hostname(session);
+
+    if (host == NULL) return (server_is_name() ) ? false : true;
+    return (strcmp(host, options.server) == 0) ? true : false;
+}
+
+static void session_save(SSL_SESSION *session)
+{
+    char path[MAX_PATH_LEN +5];
+    FILE *file = NULL;
+    int fd = -1;
+
+    if (strlen(options.ssl_session_file) == 0) return;
+
+    /* The session holds the keys of the connection; it is only readable by us */
+    (void) snprintf(path, sizeof(path), "%s.tmp", options.ssl_session_file);
+    if ( (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600) ) < 0 || (file = fdopen(fd, "w") ) == NULL)
+    {
+        warning("cannot keep the tls session in %s: %s\n", path, strerror(errno) );
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    if (PEM_write_SSL_SESSION(file, session) != 1 || fclose(file) != 0 || rename(path, options.ssl_session_file) != 0)
+    {
+        warning("cannot keep the tls session in %s\n", options.ssl_session_file);
+        (void) unlink(path);
+        return;
+    }
+    debug("kept the tls session in %s\n", options.ssl_session_file);
+}
+
+static void session_load()
+{
+    FILE *file = NULL;
+    SSL_SESSION *session = NULL;
+
+    if (strlen(options.ssl_session_file) == 0 || (file = fopen(options.ssl_session_file, "r") ) == NULL) return;
+
+    session = PEM_read_SSL_SESSION(file, NULL, NULL, NULL);
+    fclose(file);
+
+    if (session == NULL)
+    {
+        warning("cannot read the tls session in %s\n", options.ssl_session_file);
+    }
+    else if (session_matches(session) == false) SSL_SESSION_free(session);
+    else
+    {
+        debug("read the tls session in %s\n", options.ssl_session_file);
+        cached_session = session;
+    }
+}
+
+static void session_forget()
+{
+    if (cached_session == NULL) return;
+
+    SSL_SESSION_free(cached_session);
+    cached_session = NULL;
+    if (strlen(options.ssl_session_file) > 0) (void) unlink(options.ssl_session_file);
+}
+
+/**
+* Called by OpenSSL for every session, or ticket, the server hands out.
+*
+* @return 1, as the session is kept.
+*/
+static int session_new(SSL *ssl, SSL_SESSION *session)
+{
+    if (cached_session != NULL) SSL_SESSION_free(cached_session);
+    cached_session = session;
+    session_save(session);
+    return 1;
+}
+
+static bool context_init()
+{
+    if (context != NULL) return true;
+
+    if ( (context = SSL_CTX_new(TLS_client_method() ) ) == NULL)
+    {
+        error("cannot set up tls: %s\n", tls_error() );
+        return false;
+    }
+
+    (void) SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+    (void) SSL_CTX_set_default_verify_paths(context);
+    SSL_CTX_set_mode(context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    /* Sessions are kept by us, only for the next connection to the same server */
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(context, session_new);
+
+    session_load();
+    return true;
+}
+
+/**
+* @return true when the SSL call only has to wait for the server; false on an error.
+*/
+static bool tls_retry(int retval)
+{
+    int err = SSL_get_error(bridge.ssl, retval);
+
+    bridge.want_write = (err == SSL_ERROR_WANT_WRITE) ? true : false;
+    return (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) ? true : false;
+}
+
+static void close_fd(int *fd)
+{
+    if (*fd >= 0) close(*fd);
+    *fd = -1;
+}
+
+void tls_close()
+{
+    if (bridge.ssl != NULL)
+    {
+        if (bridge.state == tls_established) (void) SSL_shutdown(bridge.ssl);
+        SSL_free(bridge.ssl);
+        bridge.ssl = NULL;
+    }
+
+    close_fd(&bridge.listen_fd);
+    close_fd(&bridge.client_fd);
+    close_fd(&bridge.server_fd);
+    bridge.state = tls_closed;
+    bridge.client_port = 0;
+    bridge.want_write = false;
+    bridge.up_len = bridge.up_offset = 0;
+    bridge.down_len = bridge.down_offset = 0;
+}
+
+/**
+* Closes both sides; libircclient sees the end of its connection, and reconnects.
+*/
+static void bridge_fail(const char *reason)
+{
+    warning("tls connection to %s closed: %s\n", options.server, reason);
+    tls_close();
+}
+
+static int bridge_listen()
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    memset(&addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    if ( (bridge.listen_fd = socket(AF_INET, SOCK_STREAM, 0) ) < 0 || bind(bridge.listen_fd, (struct sockaddr *) &addr, sizeof(addr) ) != 0
+        || listen(bridge.listen_fd, 1) != 0 || getsockname(bridge.listen_fd, (struct sockaddr *) &addr, &len) != 0)
+    {
+        error("cannot listen for libircclient: %s\n", strerror(errno) );
+        return 0;
+    }
+    (void) fcntl(bridge.listen_fd, F_SETFL, O_NONBLOCK);
+    return ntohs(addr.sin_port);
+}
+
+static bool server_connect(const char *address, int port)
+{
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+    char service[8];
+    int err = 0;
+
+    memset(&hints, 0, sizeof(hints) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    (void) snprintf(service, sizeof(service), "%d", port);
+
+    if ( (err = getaddrinfo(address, service, &hints, &result) ) != 0)
+    {
+        error("could not resolve %s: %s\n", address, gai_strerror(err) );
+        return false;
+    }
+
+    if ( (bridge.server_fd = socket(result->ai_family, SOCK_STREAM, 0) ) < 0 || fcntl(bridge.server_fd, F_SETFL, O_NONBLOCK) != 0
+        || (connect(bridge.server_fd, result->ai_addr, result->ai_addrlen) != 0 && errno != EINPROGRESS) )
+    {
+        error("cannot connect to %s: %s\n", address, strerror(errno) );
+        freeaddrinfo(result);
+        return false;
+    }
+    freeaddrinfo(result);
+    return true;
+}
+
+int tls_open(const char *address, int port)
+{
+    int local_port = 0;
+
+    tls_close();
+    if (context_init() == false) return 0;
+
+    if (server_connect(address, port) == false || (local_port = bridge_listen() ) == 0)
+    {
+        tls_close();
+        return 0;
+    }
+
+    bridge.state = tls_connecting;
+    debug("bridging tls to %s:%d on port %d\n", address, port, local_port);
+    return local_port;
+}
+
+void tls_expect(int fd)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    if (bridge.state == tls_closed || getsockname(fd, (struct sockaddr *) &addr, &len) != 0 || addr.sin_family != AF_INET) return;
+    bridge.client_port = ntohs(addr.sin_port);
+}
+
+static void client_accept()
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = -1;
+
+    if ( (fd = accept(bridge.listen_fd, (struct sockaddr *) &addr, &len) ) < 0) return;
+
+    /* Another local user could connect first, and talk to the server as us */
+    if (bridge.client_port == 0 || ntohs(addr.sin_port) != bridge.client_port)
+    {
+        warning("refused a connection to the tls bridge from port %d\n", ntohs(addr.sin_port) );
+        close(fd);
+        return;
+    }
+
+    (void) fcntl(fd, F_SETFL, O_NONBLOCK);
+    bridge.client_fd = fd;
+    close_fd(&bridge.listen_fd);
+}
+
+static void server_handshake()
+{
+    int retval = 0;
+
+    if ( (retval = SSL_connect(bridge.ssl) ) == 1)
+    {
+        bridge.state = tls_established;
+        bridge.want_write = false;
+        metric_add(metric_tls_handshakes, 1);
+        if (SSL_session_reused(bridge.ssl) )
+        {
+            metric_add(metric_tls_resumed, 1);
+            verbose("resumed the tls session with %s (%s)\n", options.server, SSL_get_version(bridge.ssl) );
+        }
+        else verbose("tls connection with %s (%s, %s)\n", options.server, SSL_get_version(bridge.ssl), SSL_get_cipher_name(bridge.ssl) );
+        return;
+    }
+    if (tls_retry(retval) ) return;
+
+    /* A session which the server no longer takes is not offered again */
+    session_forget();
+    if (SSL_get_verify_result(bridge.ssl) != X509_V_OK)
+    {
+        error("certificate of %s is not trusted: %s\n", options.server, X509_verify_cert_error_string(SSL_get_verify_result(bridge.ssl) ) );
+    }
+    else error("tls handshake with %s: %s\n", options.server, tls_error() );
+    tls_close();
+}
+
+static void server_connected()
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if (getsockopt(bridge.server_fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0)
+    {
+        error("cannot connect to %s: %s\n", options.server, strerror(err) );
+        tls_close();
+        return;
+    }
+
+    if ( (bridge.ssl = SSL_new(context) ) == NULL || SSL_set_fd(bridge.ssl, bridge.server_fd) != 1)
+    {
+        error("cannot set up tls: %s\n", tls_error() );
+        tls_close();
+        return;
+    }
+
+    if (server_is_name() ) (void) SSL_set_tlsext_host_name(bridge.ssl, options.server);
+    if (options.ssl_verify)
+    {
+        SSL_set_verify(bridge.ssl, SSL_VERIFY_PEER, NULL);
+        if (server_is_name() ) (void) SSL_set1_host(bridge.ssl, options.server);
+        else (void) X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(bridge.ssl), options.server);
+    }
+    else SSL_set_verify(bridge.ssl, SSL_VERIFY_NONE, NULL);
+
+    if (cached_session != NULL && session_matches(cached_session) ) (void) SSL_set_session(bridge.ssl, cached_session);
+
+    bridge.state = tls_handshaking;
+    server_handshake();
+}
+
+/**
+* Moves the data which is waiting on either side to the other one.
+*/
+static void bridge_pump()
+{
+    ssize_t retval = 0;
+
+    /* libircclient to the server */
+    if (bridge.up_len == 0 && bridge.client_fd >= 0)
+    {
+        if ( (retval = read(bridge.client_fd, bridge.up, sizeof(bridge.up) ) ) == 0)
+        {
+            debug("libircclient closed the tls bridge\n");
+            tls_close();
+            return;
+        }
+        if (retval < 0 && errno != EAGAIN && errno != EINTR)
+        {
+            bridge_fail(strerror(errno) );
+            return;
+        }
+        if (retval > 0)
+        {
+            bridge.up_len = retval;
+            bridge.up_offset = 0;
+        }
+    }
+    if (bridge.up_offset < bridge.up_len)
+    {
+        if ( (retval = SSL_write(bridge.ssl, &bridge.up[bridge.up_offset], bridge.up_len - bridge.up_offset) ) > 0)
+        {
+            bridge.up_offset += retval;
+            if (bridge.up_offset == bridge.up_len) bridge.up_len = bridge.up_offset = 0;
+        }
+        else if (tls_retry(retval) == false)
+        {
+            bridge_fail(tls_error() );
+            return;
+        }
+    }
+
+    /* The server to libircclient; records which OpenSSL already holds are read until libircclient is full */
+    while (bridge.client_fd >= 0)
+    {
+        if (bridge.down_offset == bridge.down_len)
+        {
+            bridge.down_len = bridge.down_offset = 0;
+            if ( (retval = SSL_read(bridge.ssl, bridge.down, sizeof(bridge.down) ) ) <= 0)
+            {
+                if (tls_retry(retval) ) break;
+                bridge_fail( (SSL_get_error(bridge.ssl, retval) == SSL_ERROR_ZERO_RETURN) ? "closed by the server" : tls_error() );
+                return;
+            }
+            bridge.down_len = retval;
+        }
+
+        if ( (retval = write(bridge.client_fd, &bridge.down[bridge.down_offset], bridge.down_len - bridge.down_offset) ) < 0)
+        {
+            if (errno == EAGAIN || errno == EINTR) break;
+            bridge_fail(strerror(errno) );
+            return;
+        }
+        bridge.down_offset += retval;
+    }
+}
+
+bool tls_available()
+{
+    return true;
+}
+
+int tls_socket()
+{
+    return bridge.server_fd;
+}
+
+void tls_add_descriptors(fd_set *in_set, fd_set *out_set, int *maxfd)
+{
+    int fd = -1;
+
+    if (bridge.listen_fd >= 0)
+    {
+        FD_SET(bridge.listen_fd, in_set);
+        if (bridge.listen_fd > *maxfd) *maxfd = bridge.listen_fd;
+    }
+
+    if ( (fd = bridge.server_fd) < 0) return;
+    switch (bridge.state)
+    {
+        case tls_connecting:
+            FD_SET(fd, out_set);
+            break;
+
+        case tls_handshaking:
+            if (bridge.want_write) FD_SET(fd, out_set);
+            else FD_SET(fd, in_set);
+            break;
+
+        case tls_established:
+            if (bridge.want_write || bridge.up_offset < bridge.up_len) FD_SET(fd, out_set);
+            if (bridge.client_fd >= 0)
+            {
+                if (bridge.down_offset == bridge.down_len) FD_SET(fd, in_set);
+                if (bridge.up_len == 0) FD_SET(bridge.client_fd, in_set);
+                if (bridge.down_offset < bridge.down_len) FD_SET(bridge.client_fd, out_set);
+                if (bridge.client_fd > *maxfd) *maxfd = bridge.client_fd;
+            }
+            break;
+
+        case tls_closed:
+            return;
+    }
+    if (fd > *maxfd) *maxfd = fd;
+}
+
+void tls_process(fd_set *in_set, fd_set *out_set)
+{
+    bool ready = false;
+
+    if (bridge.listen_fd >= 0 && FD_ISSET(bridge.listen_fd, in_set) ) client_accept();
+    if (bridge.server_fd < 0) return;
+
+    ready = (FD_ISSET(bridge.server_fd, in_set) || FD_ISSET(bridge.server_fd, out_set) ) ? true : false;
+    if (bridge.client_fd >= 0 && (FD_ISSET(bridge.client_fd, in_set) || FD_ISSET(bridge.client_fd, out_set) ) ) ready = true;
+
+    switch (bridge.state)
+    {
+        case tls_connecting:
+            if (FD_ISSET(bridge.server_fd, out_set) ) server_connected();
+            break;
+
+        case tls_handshaking:
+            if (ready) server_handshake();
+            break;
+
+        case tls_established:
+            if (ready) bridge_pump();
+            break;
+
+        case tls_closed:
+            break;
+    }
+}
+
+#else
+
+bool tls_available()
+{
+    return false;
+}
+
+int tls_open(const char *address, int port)
+{
+    return 0;
+}
+
+void tls_expect(int fd)
+{
+}
+
+int tls_socket()
+{
+    return -1;
+}
+
+void tls_add_descriptors(fd_set *in_set, fd_set *out_set, int *maxfd)
+{
+}
+
+void tls_process(fd_set *in_set, fd_set *out_set)
+{
+}
+
+void tls_close()
+{
+}
+
+#endif /* HAVE_OPENSSL */
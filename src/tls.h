@@ -0,0 +1,49 @@
+#ifndef tls_h_
+#define tls_h_
+
+#include <stdbool.h>
+#include <sys/select.h>
+
+#define TLS_BUFSIZE     (16 * 1024)     /* the size of a tls record */
+
+/**
+* @return true when irccmd was build with OpenSSL, and does tls itself.
+*/
+bool tls_available();
+
+/**
+* Opens a tls connection to the irc server, and a plain bridge to it on the
+* loopback interface for libircclient. A session of an earlier connection to the
+* same server is resumed, which saves the server a full handshake on a reconnect.
+* With options.ssl_session_file the session is also kept across restarts.
+*
+* An earlier connection is closed first.
+*
+* @param address the address of the server.
+* @param port the port of the server.
+* @return the loopback port libircclient connects to, or 0 on failure.
+*/
+int tls_open(const char *address, int port);
+
+/**
+* Only the connection from the local socket fd is bridged; another local user
+* could otherwise connect first, and talk to the server as us.
+*
+* @param fd the socket of libircclient, once it connects to the bridge.
+*/
+void tls_expect(int fd);
+
+/**
+* @return the socket of the connection to the server, or -1 when there is none.
+*/
+int tls_socket();
+
+void tls_add_descriptors(fd_set *in_set, fd_set *out_set, int *maxfd);
+void tls_process(fd_set *in_set, fd_set *out_set);
+
+/**
+* Closes the connection, and its bridge.
+*/
+void tls_close();
+
+#endif /* tls_h_ */
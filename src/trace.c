@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "def.h"
+#include "main.h"
+#include "configdefaults.h"
+#include "metrics.h"
+#include "trace.h"
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
+
+#define TRACE_BUFSIZE   (64 * 1024)
+
+static FILE *trace = NULL;
+static uint32_t next_id = 0;
+
+bool trace_open(const char *path)
+{
+    struct trace_header header;
+
+    if ( (trace = fopen(path, "w") ) == NULL)
+    {
+        error("could not open trace file %s: %s\n", path, strerror(errno) );
+        return false;
+    }
+
+    /* Records are small; let stdio collect them */
+    (void) setvbuf(trace, NULL, _IOFBF, TRACE_BUFSIZE);
+
+    memset(&header, 0, sizeof(header) );
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic) );
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(struct trace_record);
+    if (fwrite(&header, sizeof(header), 1, trace) != 1)
+    {
+        error("could not write to trace file %s\n", path);
+        trace_close();
+        return false;
+    }
+
+    verbose("tracing messages to %s\n", path);
+    return true;
+}
+
+void trace_close()
+{
+    if (trace == NULL) return;
+
+    fclose(trace);
+    trace = NULL;
+}
+
+uint32_t trace_begin()
+{
+#ifndef HAVE_SYS_SDT_H
+    if (trace == NULL) return 0;
+#endif
+
+    /* 0 means 'not traced' */
+    if (++next_id == 0) next_id = 1;
+
+    trace_stage(next_id, trace_read);
+    return next_id;
+}
+
+void trace_stage(uint32_t id, enum trace_stages stage)
+{
+    struct trace_record record;
+
+    if (id == 0) return;
+
+#ifdef HAVE_SYS_SDT_H
+    DTRACE_PROBE2(irccmd, stage, id, stage);
+#endif
+
+    if (trace == NULL) return;
+
+    record.usec = metrics_now();
+    record.id = id;
+    record.stage = stage;
+    record.reserved = 0;
+
+    if (fwrite(&record, sizeof(record), 1, trace) != 1)
+    {
+        error("could not write to the trace file; tracing stopped\n");
+        trace_close();
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef trace_h_
+#define trace_h_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TRACE_MAGIC     "IRCTRACE"
+#define TRACE_VERSION   (1)
+
+/**
+* The stages a message passes on its way from stdin to the channel.
+*/
+enum trace_stages
+{
+    trace_read,         /* The line has been read */
+    trace_plugins,      /* The plugins are done with it */
+    trace_enqueued,     /* It is in the outbound queue */
+    trace_written,      /* It has been written to the irc socket */
+    trace_echoed,       /* The server echoed it back */
+    trace_max_stages,
+};
+
+/**
+* The header at the start of a trace file.
+*/
+struct trace_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+/**
+* A trace file holds one record per stage of a message, in the order they happened.
+*/
+struct trace_record
+{
+    uint64_t usec;      /* monotonic timestamp */
+    uint32_t id;        /* the message; ids start at 1 for every run */
+    uint16_t stage;     /* enum trace_stages */
+    uint16_t reserved;
+};
+
+/**
+* Starts writing trace records to the given file, which is truncated.
+*
+* @return true on success, otherwise false.
+*/
+bool trace_open(const char *path);
+void trace_close();
+
+/**
+* Starts tracing a new message, and records its read stage.
+*
+* @return the id of the message, or 0 when tracing is off.
+*/
+uint32_t trace_begin();
+
+/**
+* Records that a message has reached a stage. Id 0 is ignored.
+*/
+void trace_stage(uint32_t id, enum trace_stages stage);
+
+#endif /*trace_h_*/
@@ -0,0 +1,152 @@
+/*
+* Prints the latency distribution of every stage in an irccmd trace file.
+*
+* usage: irccmd-tracestat <tracefile>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "trace.h"
+
+/**
+* An interval between two stages which is reported.
+*/
+struct interval
+{
+    const char *name;
+    enum trace_stages from;
+    enum trace_stages to;
+};
+
+static const struct interval intervals[] =
+{
+    { "read -> plugins"     , trace_read     , trace_plugins  },
+    { "plugins -> enqueued" , trace_plugins  , trace_enqueued },
+    { "enqueued -> written" , trace_enqueued , trace_written  },
+    { "written -> echoed"   , trace_written  , trace_echoed   },
+    { "read -> written"     , trace_read     , trace_written  },
+    { "read -> echoed"      , trace_read     , trace_echoed   },
+    { NULL                  , trace_read     , trace_read     },
+};
+
+/* The timestamps of every message, indexed by id and stage; 0 when the stage was not reached */
+static uint64_t *stages = NULL;
+static uint32_t max_id = 0;
+
+static bool grow(uint32_t id)
+{
+    uint32_t new_max = (max_id == 0) ? 4096 : max_id;
+    uint64_t *new_stages = NULL;
+
+    while (new_max <= id) new_max *= 2;
+    if ( (new_stages = realloc(stages, (size_t) new_max * trace_max_stages * sizeof(*stages) ) ) == NULL) return false;
+
+    memset(&new_stages[(size_t) max_id * trace_max_stages], 0, (size_t) (new_max - max_id) * trace_max_stages * sizeof(*stages) );
+    stages = new_stages;
+    max_id = new_max;
+    return true;
+}
+
+static int compare_uint64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void print_interval(const struct interval *interval, uint32_t last_id, uint64_t *samples)
+{
+    size_t no_samples = 0;
+    uint32_t id = 0;
+
+    for (id = 1; id <= last_id; id++)
+    {
+        uint64_t from = stages[(size_t) id * trace_max_stages + interval->from];
+        uint64_t to = stages[(size_t) id * trace_max_stages + interval->to];
+
+        if (from > 0 && to >= from) samples[no_samples++] = to - from;
+    }
+
+    if (no_samples == 0)
+    {
+        printf("%-22s %10d\n", interval->name, 0);
+        return;
+    }
+
+    qsort(samples, no_samples, sizeof(*samples), compare_uint64);
+    printf("%-22s %10lu %10llu %10llu %10llu %10llu %10llu\n", interval->name, (unsigned long) no_samples,
+            (unsigned long long) samples[0],
+            (unsigned long long) samples[(size_t) (0.50 * (no_samples -1) )],
+            (unsigned long long) samples[(size_t) (0.90 * (no_samples -1) )],
+            (unsigned long long) samples[(size_t) (0.99 * (no_samples -1) )],
+            (unsigned long long) samples[no_samples -1]);
+}
+
+int main(int argc, char **argv)
+{
+    struct trace_header header;
+    struct trace_record record;
+    const struct interval *interval = NULL;
+    uint64_t *samples = NULL;
+    uint32_t last_id = 0;
+    unsigned long records = 0;
+    FILE *fp = NULL;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <tracefile>\n", argv[0]);
+        return 2;
+    }
+
+    if ( (fp = fopen(argv[1], "r") ) == NULL)
+    {
+        fprintf(stderr, "could not open %s: %s\n", argv[1], strerror(errno) );
+        return 1;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic) ) != 0
+        || header.version != TRACE_VERSION || header.record_size != sizeof(record) )
+    {
+        fprintf(stderr, "%s is not a trace file of this version of irccmd\n", argv[1]);
+        fclose(fp);
+        return 1;
+    }
+
+    while (fread(&record, sizeof(record), 1, fp) == 1)
+    {
+        uint64_t *stage = NULL;
+
+        records++;
+        if (record.id == 0 || record.stage >= trace_max_stages) continue;
+        if (record.id >= max_id && grow(record.id) == false)
+        {
+            fprintf(stderr, "out of memory\n");
+            fclose(fp);
+            return 1;
+        }
+
+        /* A message which is send again after a reconnect keeps its first timestamps, except for the write */
+        stage = &stages[(size_t) record.id * trace_max_stages + record.stage];
+        if (*stage == 0 || record.stage == trace_written) *stage = record.usec;
+        if (record.id > last_id) last_id = record.id;
+    }
+    fclose(fp);
+
+    printf("%lu records of %lu messages; all times in usec\n\n", records, (unsigned long) last_id);
+    printf("%-22s %10s %10s %10s %10s %10s %10s\n", "stage", "count", "min", "p50", "p90", "p99", "max");
+
+    if (last_id > 0 && (samples = malloc( (size_t) last_id * sizeof(*samples) ) ) == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (interval = intervals; interval->name != NULL && last_id > 0; interval++) print_interval(interval, last_id, samples);
+
+    free(samples);
+    free(stages);
+    return 0;
+}